@@ -0,0 +1,196 @@
+// The MIT License
+// 
+// Copyright (c) 2022     Marcus Der      marcusder@hotmail.com
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#include <float.h>
+#include <math.h>
+#include <thread>
+#include "PapaAdaptive.h"
+
+// how far each new measurement pulls the running cost
+#define COST_SMOOTHING 0.25f
+// what a scheduler is assumed to gain per worker until it has been measured
+#define PARALLEL_EFFICIENCY 0.75f
+// strides tried for a subsampled decode, each doubling the last
+#define MAX_STRIDE 64
+
+PapaLatencyModel::PapaLatencyModel() : _cores(max(std::thread::hardware_concurrency(), 1u))
+{
+    // rough costs of a desktop core, only a starting point until real timings come in
+    for (UINT format = 0; format < 16; format++) {
+        FLOAT ns;
+        switch (format) {
+        case 1: // RGBA8888
+        case 2: // RGBX8888
+        case 3: // BGRA8888
+        case 13: // R8
+            ns = 1.0f;
+            break;
+        case 4: // DXT1
+            ns = 2.5f;
+            break;
+        case 6: // DXT5
+            ns = 3.5f;
+            break;
+        default: // the float formats, which also measure their range first
+            ns = 5.0f;
+            break;
+        }
+        _decodeNs[format][0] = ns;
+        _decodeNs[format][1] = ns;
+        _seenParallelDecode[format] = FALSE;
+    }
+
+    static const FLOAT scaleNs[PAPA_FILTER_COUNT] = { 0.5f, 4.0f, 60.0f, 1.5f, 5.0f };
+    for (UINT filter = 0; filter < PAPA_FILTER_COUNT; filter++) {
+        _scaleNs[filter][0] = scaleNs[filter];
+        _scaleNs[filter][1] = scaleNs[filter];
+        _seenParallelScale[filter] = FALSE;
+    }
+}
+
+FLOAT PapaLatencyModel::PredictMs(const PAPA_TEXTURE_INFO* info, UINT cx, const PAPA_THUMB_PLAN* plan, UINT threads) const
+{
+    PAPA_TEXTURE_INFO mip;
+    if (FAILED(PapaGetMipInfo(info, plan->mip, &mip))) {
+        return FLT_MAX;
+    }
+    USHORT width;
+    USHORT height;
+    PapaGetSubsampledSize(mip.format, mip.width, mip.height, plan->stride, &width, &height);
+    FLOAT texels = (FLOAT)width * height;
+
+    FLOAT factor = (FLOAT)cx / (FLOAT)min(info->width, info->height);
+    FLOAT pixels = max(roundf(info->width * factor), 1.0f) * max(roundf(info->height * factor), 1.0f);
+    FLOAT work = PapaFilterReadsAllTexels(plan->filter) ? texels + pixels : pixels;
+
+    // unmeasured parallel costs are guessed from the serial ones, the linear filter is serial
+    FLOAT speedup = max(min(threads, _cores) * PARALLEL_EFFICIENCY, 1.0f);
+    UINT format = mip.format & 15;
+    FLOAT decodeNs = !plan->parallel ? _decodeNs[format][0] : _seenParallelDecode[format] ? _decodeNs[format][1] : _decodeNs[format][0] / speedup;
+    BOOL parallelScale = plan->parallel && plan->filter != PAPA_FILTER_LINEAR;
+    FLOAT scaleNs = !parallelScale ? _scaleNs[plan->filter][0] : _seenParallelScale[plan->filter] ? _scaleNs[plan->filter][1] : _scaleNs[plan->filter][0] / speedup;
+
+    return (texels * decodeNs + work * scaleNs) / 1e6f;
+}
+
+// Candidates run from best to worst quality, each tried serially first so a thumbnail only
+// takes the scheduler from others when it has to.
+PAPA_THUMB_PLAN PapaLatencyModel::Plan(const PAPA_TEXTURE_INFO* info, UINT cx, FLOAT budgetMs, UINT threads)
+{
+    PAPA_THUMB_PLAN candidates[4 + 8];
+    UINT count = 0;
+    UINT shorter = min(info->width, info->height);
+
+    if (cx > shorter) {
+        static const PAPA_SCALE_FILTER upscale[] = { PAPA_FILTER_BICUBIC, PAPA_FILTER_BILINEAR, PAPA_FILTER_NEAREST };
+        for (PAPA_SCALE_FILTER filter : upscale) {
+            candidates[count++] = { 0, 1, filter, FALSE, 0 };
+        }
+    } else if (cx == shorter) {
+        candidates[count++] = { 0, 1, PAPA_FILTER_NEAREST, FALSE, 0 };
+    } else {
+        // the smallest mip that still has cx on its short side loses nothing
+        UINT mip = 0;
+        PAPA_TEXTURE_INFO next;
+        while (SUCCEEDED(PapaGetMipInfo(info, mip + 1, &next)) && min(next.width, next.height) >= cx) {
+            mip++;
+        }
+        PAPA_TEXTURE_INFO level;
+        PapaGetMipInfo(info, mip, &level);
+
+        candidates[count++] = { mip, 1, PAPA_FILTER_LINEAR, FALSE, 0 };
+        candidates[count++] = { mip, 1, PAPA_FILTER_BOX, FALSE, 0 };
+
+        // then fewer and fewer blocks, as long as there are still cx of them on the short side
+        UINT stride = 1;
+        if (PapaTextureDataSize(level.format, 1, 1) != 0) {
+            USHORT width;
+            USHORT height;
+            for (UINT wider = 2; wider <= MAX_STRIDE; wider *= 2) {
+                PapaGetSubsampledSize(level.format, level.width, level.height, wider, &width, &height);
+                if (min(width, height) < cx) {
+                    break;
+                }
+                stride = wider;
+                candidates[count++] = { mip, stride, PAPA_FILTER_BOX, FALSE, 0 };
+            }
+        }
+        candidates[count++] = { mip, stride, PAPA_FILTER_NEAREST, FALSE, 0 };
+    }
+
+    std::lock_guard<std::mutex> lock(_lock);
+    PAPA_THUMB_PLAN cheapest = candidates[count - 1];
+    cheapest.predictedMs = FLT_MAX;
+    for (UINT i = 0; i < count; i++) {
+        for (BOOL parallel = FALSE; parallel <= (threads > 1 ? TRUE : FALSE); parallel++) {
+            PAPA_THUMB_PLAN plan = candidates[i];
+            plan.parallel = parallel;
+            plan.predictedMs = PredictMs(info, cx, &plan, threads);
+            if (plan.predictedMs <= budgetMs) {
+                return plan;
+            }
+            if (plan.predictedMs < cheapest.predictedMs) {
+                cheapest = plan;
+            }
+        }
+    }
+    return cheapest;
+}
+
+VOID PapaLatencyModel::RecordDecode(BYTE format, BOOL parallel, ULONGLONG texels, double ms)
+{
+    if (texels == 0 || ms < 0) {
+        return;
+    }
+    FLOAT ns = (FLOAT)(ms * 1e6 / (double)texels);
+    std::lock_guard<std::mutex> lock(_lock);
+    FLOAT& cost = _decodeNs[format & 15][parallel ? 1 : 0];
+    if (parallel && !_seenParallelDecode[format & 15]) {
+        cost = ns;
+        _seenParallelDecode[format & 15] = TRUE;
+    } else {
+        cost += (ns - cost) * COST_SMOOTHING;
+    }
+}
+
+VOID PapaLatencyModel::RecordScale(PAPA_SCALE_FILTER filter, BOOL parallel, ULONGLONG work, double ms)
+{
+    if (work == 0 || ms < 0) {
+        return;
+    }
+    parallel = parallel && filter != PAPA_FILTER_LINEAR;
+    FLOAT ns = (FLOAT)(ms * 1e6 / (double)work);
+    std::lock_guard<std::mutex> lock(_lock);
+    FLOAT& cost = _scaleNs[filter][parallel ? 1 : 0];
+    if (parallel && !_seenParallelScale[filter]) {
+        cost = ns;
+        _seenParallelScale[filter] = TRUE;
+    } else {
+        cost += (ns - cost) * COST_SMOOTHING;
+    }
+}
+
+PapaLatencyModel* PapaGetLatencyModel()
+{
+    static PapaLatencyModel model;
+    return &model;
+}
@@ -0,0 +1,87 @@
+// The MIT License
+// 
+// Copyright (c) 2022     Marcus Der      marcusder@hotmail.com
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#pragma once
+
+#include <mutex>
+#include "PapaCore.h"
+
+// Latency budgeted thumbnails. With PAPA_THUMB_OPTIONS::latencyBudget set, PapaRenderThumbnail
+// asks the process wide PapaLatencyModel for a plan: which mip to decode, whether to decode
+// only every stride'th block, which filter to scale with and whether to spread the work over
+// the scheduler. The plan is the best quality whose predicted time fits the budget, or the
+// cheapest there is when none does. Each render then reports how long it really took, so the
+// predictions follow the machine and the load it is under.
+
+enum PAPA_SCALE_FILTER
+{
+    PAPA_FILTER_NEAREST,
+    PAPA_FILTER_BILINEAR,
+    PAPA_FILTER_BICUBIC,
+    PAPA_FILTER_BOX,        // area average in gamma space
+    PAPA_FILTER_LINEAR,     // area average in linear light, see PapaResampleLinear
+    PAPA_FILTER_COUNT
+};
+
+struct PAPA_THUMB_PLAN
+{
+    UINT mip;                   // mip level decoded, 0 for the full texture
+    UINT stride;                // decode one block (or texel) in stride along each axis, 1 for all of them
+    PAPA_SCALE_FILTER filter;
+    BOOL parallel;              // decode and scale on the scheduler
+    FLOAT predictedMs;
+};
+
+// whether filter's cost follows the source texels (the area filters) or the output pixels
+inline BOOL PapaFilterReadsAllTexels(PAPA_SCALE_FILTER filter)
+{
+    return filter == PAPA_FILTER_BOX || filter == PAPA_FILTER_LINEAR;
+}
+
+// Running costs per decoded texel by format, and per unit of scaling work by filter, each
+// kept separately for serial and scheduled runs. Safe to share between threads.
+class PapaLatencyModel
+{
+public:
+    PapaLatencyModel();
+
+    // the plan for a thumbnail of info at cx inside budgetMs, with threads workers on offer
+    PAPA_THUMB_PLAN Plan(const PAPA_TEXTURE_INFO* info, UINT cx, FLOAT budgetMs, UINT threads);
+
+    // decodes read the payload too, texels is what was decoded after any mip and stride
+    VOID RecordDecode(BYTE format, BOOL parallel, ULONGLONG texels, double ms);
+    // work is source texels plus output pixels for the area filters, output pixels otherwise
+    VOID RecordScale(PAPA_SCALE_FILTER filter, BOOL parallel, ULONGLONG work, double ms);
+
+private:
+    FLOAT PredictMs(const PAPA_TEXTURE_INFO* info, UINT cx, const PAPA_THUMB_PLAN* plan, UINT threads) const;
+
+    std::mutex _lock;
+    FLOAT _decodeNs[16][2];                 // by format, then serial / parallel
+    FLOAT _scaleNs[PAPA_FILTER_COUNT][2];
+    BOOL _seenParallelDecode[16];
+    BOOL _seenParallelScale[PAPA_FILTER_COUNT];
+    UINT _cores;                            // more workers than this gain nothing
+};
+
+// shared by every thumbnail in the process
+PapaLatencyModel* PapaGetLatencyModel();
@@ -0,0 +1,542 @@
+// The MIT License
+// 
+// Copyright (c) 2022     Marcus Der      marcusder@hotmail.com
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#include <string.h>
+#include <map>
+#include <mutex>
+#include <new>
+#include <vector>
+#include "PapaBatch.h"
+#include "PapaThumbnailProvider.h"
+
+// Two items whose thumbnails would come from the same texture entry and payload bytes at the
+// same cx get the same key, whichever files they are in. With hash left zero it is the
+// item's shape, which is all that is compared before anything is hashed.
+struct CONTENT_KEY
+{
+    ULONGLONG shape[4];     // format, mips and size, then payload bytes, of texture 0 and of the entry used
+    ULONGLONG hash[2];
+    UINT cx;
+
+    bool operator<(const CONTENT_KEY& other) const
+    {
+        INT order = memcmp(shape, other.shape, sizeof(shape));
+        if (order == 0) {
+            order = memcmp(hash, other.hash, sizeof(hash));
+        }
+        return order != 0 ? order < 0 : cx < other.cx;
+    }
+};
+
+// The first item to finish reading a payload with a key renders it, later ones stop before
+// decoding and wait on it as followers. They are given a copy when it finishes, so no
+// worker ever blocks on another.
+struct CONTENT_ENTRY
+{
+    UINT owner;
+    BOOL done;
+    std::vector<UINT> followers;
+};
+
+// what the first pass learns of an item from its headers
+struct ITEM_SHAPE
+{
+    HRESULT result;
+    IStream* stream;
+    PAPA_TEXTURE_INFO used;     // the entry the provider will thumbnail from
+    CONTENT_KEY key;
+    BOOL hash;                  // another item has the same shape, so the payloads are compared
+};
+
+struct BATCH_JOB
+{
+    PAPA_BATCH_ITEM* items;
+    PapaScheduler* scheduler;
+    std::vector<ITEM_SHAPE> shapes;
+    std::mutex lock;
+    std::map<CONTENT_KEY, CONTENT_ENTRY> contents;
+};
+
+// PAPA_SOURCE over an item's stream. Offsets are from the start of the stream, as they are
+// for the provider's own reads, so both agree on where every entry and payload sits.
+static HRESULT ReadItemStream(VOID* context, ULONGLONG offset, VOID* buffer, ULONG size)
+{
+    IStream* stream = (IStream*)context;
+    LARGE_INTEGER seek = LARGE_INTEGER();
+    seek.QuadPart = (LONGLONG)offset;
+
+    ULONG read = 0;
+    if (stream->Seek(seek, STREAM_SEEK_SET, NULL) != S_OK || stream->Read(buffer, size, &read) != S_OK || read != size) {
+        return E_FAIL;
+    }
+    return S_OK;
+}
+
+// the provider reads the papa header from wherever the stream is, so hand it back at the start
+static HRESULT RewindItemStream(IStream* stream)
+{
+    LARGE_INTEGER zero = LARGE_INTEGER();
+    return stream->Seek(zero, STREAM_SEEK_SET, NULL) == S_OK ? S_OK : E_FAIL;
+}
+
+static inline ULONGLONG RotateLeft(ULONGLONG value, UINT bits)
+{
+    return (value << bits) | (value >> (64 - bits));
+}
+
+// 128 bits of hash from four independent lanes of 8 byte words, so the multiplies overlap
+// and it runs at close to memory speed
+class PapaContentHash
+{
+public:
+    PapaContentHash() : _length(0)
+    {
+        _lanes[0] = 0x9E3779B97F4A7C15ULL;
+        _lanes[1] = 0xC2B2AE3D27D4EB4FULL;
+        _lanes[2] = 0x165667B19E3779F9ULL;
+        _lanes[3] = 0x27D4EB2F165667C5ULL;
+    }
+
+    // size must be a multiple of 32 for every call but the last
+    VOID Update(const BYTE* data, SIZE_T size)
+    {
+        SIZE_T i = 0;
+        ULONGLONG words[4];
+        for (; i + sizeof(words) <= size; i += sizeof(words)) {
+            memcpy(words, data + i, sizeof(words));
+            Mix(words);
+        }
+        if (i < size) {
+            memset(words, 0, sizeof(words));
+            memcpy(words, data + i, size - i);
+            Mix(words);
+        }
+        _length += size;
+    }
+
+    VOID Final(ULONGLONG hash[2])
+    {
+        ULONGLONG a = Avalanche(_lanes[0] ^ RotateLeft(_lanes[2], 17) ^ _length);
+        ULONGLONG b = Avalanche(_lanes[1] ^ RotateLeft(_lanes[3], 29) ^ _length);
+        hash[0] = a + b;
+        hash[1] = a ^ RotateLeft(b, 32);
+    }
+
+private:
+    VOID Mix(const ULONGLONG words[4])
+    {
+        for (UINT lane = 0; lane < 4; lane++) {
+            _lanes[lane] = RotateLeft(_lanes[lane] ^ (words[lane] * 0x87C37B91114253D5ULL), 31) * 0x4CF5AD432745937FULL;
+        }
+    }
+
+    // the murmur3 finaliser
+    static ULONGLONG Avalanche(ULONGLONG value)
+    {
+        value ^= value >> 33;
+        value *= 0xFF51AFD7ED558CCDULL;
+        value ^= value >> 33;
+        value *= 0xC4CEB9FE1A85EC53ULL;
+        value ^= value >> 33;
+        return value;
+    }
+
+    ULONGLONG _lanes[4];
+    ULONGLONG _length;
+};
+
+// Reads the entry the provider will thumbnail from, texture 0 or the preview that stands in
+// for it at cx, and leaves the stream rewound.
+static VOID ReadShape(PAPA_BATCH_ITEM* item, ITEM_SHAPE* shape)
+{
+    memset(shape, 0, sizeof(*shape));
+    shape->stream = item->pStream;
+    PAPA_SOURCE source = { ReadItemStream, shape->stream };
+
+    PAPA_TEXTURE_INFO texture;
+    shape->result = PapaReadTextureInfo(&source, 0, &texture);
+    if (SUCCEEDED(shape->result)) {
+        PAPA_TEXTURE_INFO preview;
+        shape->used = texture;
+        if (PapaReadPreviewInfo(&source, &preview) == S_OK && PapaPreviewCovers(&preview, &texture, item->cx)) {
+            shape->used = preview;
+        }
+
+        // the fields that shape the thumbnail, not where the payload happens to sit
+        const PAPA_TEXTURE_INFO* entries[2] = { &texture, &shape->used };
+        for (UINT i = 0; i < 2; i++) {
+            shape->key.shape[i * 2] = entries[i]->format | ((ULONGLONG)entries[i]->mips << 8) | ((ULONGLONG)entries[i]->width << 16) | ((ULONGLONG)entries[i]->height << 32);
+            shape->key.shape[i * 2 + 1] = entries[i]->dataSize;
+        }
+        shape->key.cx = item->cx;
+    }
+
+    if (FAILED(RewindItemStream(shape->stream))) {
+        shape->result = E_FAIL;
+    }
+}
+
+// the first item to read a payload with this key becomes its owner, FALSE for those after
+static BOOL ClaimContent(BATCH_JOB* job, UINT index, const CONTENT_KEY& key)
+{
+    std::lock_guard<std::mutex> lock(job->lock);
+    if (job->contents.find(key) != job->contents.end()) {
+        return FALSE;
+    }
+    CONTENT_ENTRY& entry = job->contents[key];
+    entry.owner = index;
+    entry.done = FALSE;
+    return TRUE;
+}
+
+enum HASH_STATE
+{
+    HASH_PENDING,       // the payload hasn't been read through yet
+    HASH_SKIPPED,       // not read in an order that could be hashed, so it renders as one of a kind
+    HASH_OWNER,         // hashed and claimed, the render went on
+    HASH_DUPLICATE,     // hashed and already claimed by another item, the render was stopped
+};
+
+// Hands an item's stream to the provider and hashes the payload of the entry it thumbnails
+// from as the provider reads it, so each payload is read once whether or not it turns out to
+// be a duplicate. Once the last payload byte is in, the item claims the content or, if
+// another item got there first, fails the read so the provider gives up before decoding.
+class CHashingStream : public IStream
+{
+public:
+    CHashingStream(IStream* inner, BATCH_JOB* job, UINT index) : _cRef(1), _inner(inner), _job(job), _index(index), _hashed(0), _state(HASH_PENDING)
+    {
+        _inner->AddRef();
+        _key = job->shapes[index].key;
+        _used = job->shapes[index].used;
+    }
+
+    virtual ~CHashingStream()
+    {
+        _inner->Release();
+    }
+
+    HASH_STATE GetState() const
+    {
+        return _state;
+    }
+
+    const CONTENT_KEY& GetKey() const
+    {
+        return _key;
+    }
+
+    // IUnknown
+    IFACEMETHODIMP QueryInterface(REFIID riid, void **ppv)
+    {
+        static const QITAB qit[] =
+        {
+            QITABENT(CHashingStream, IStream),
+            QITABENT(CHashingStream, ISequentialStream),
+            { 0 },
+        };
+        return QISearch(this, qit, riid, ppv);
+    }
+
+    IFACEMETHODIMP_(ULONG) AddRef()
+    {
+        return InterlockedIncrement(&_cRef);
+    }
+
+    IFACEMETHODIMP_(ULONG) Release()
+    {
+        ULONG cRef = InterlockedDecrement(&_cRef);
+        if (!cRef)
+        {
+            delete this;
+        }
+        return cRef;
+    }
+
+    // ISequentialStream
+    IFACEMETHODIMP Read(void *pv, ULONG cb, ULONG *pcbRead)
+    {
+        LARGE_INTEGER zero = LARGE_INTEGER();
+        ULARGE_INTEGER position;
+        HRESULT hr = _inner->Seek(zero, STREAM_SEEK_CUR, &position);
+        ULONG read = 0;
+        if (SUCCEEDED(hr)) {
+            hr = _inner->Read(pv, cb, &read);
+        }
+        if (pcbRead != NULL) {
+            *pcbRead = read;
+        }
+        if (SUCCEEDED(hr) && _state == HASH_PENDING) {
+            Hash(position.QuadPart, (const BYTE*)pv, read);
+        }
+        return _state == HASH_DUPLICATE ? E_ABORT : hr;
+    }
+
+    IFACEMETHODIMP Write(const void *, ULONG, ULONG *)
+    {
+        return STG_E_ACCESSDENIED;
+    }
+
+    // IStream
+    IFACEMETHODIMP Seek(LARGE_INTEGER dlibMove, DWORD dwOrigin, ULARGE_INTEGER *plibNewPosition)
+    {
+        return _inner->Seek(dlibMove, dwOrigin, plibNewPosition);
+    }
+
+#ifdef _WIN32 // the shim's IStream stops at Seek
+    IFACEMETHODIMP SetSize(ULARGE_INTEGER)
+    {
+        return STG_E_ACCESSDENIED;
+    }
+
+    IFACEMETHODIMP CopyTo(IStream *pstm, ULARGE_INTEGER cb, ULARGE_INTEGER *pcbRead, ULARGE_INTEGER *pcbWritten)
+    {
+        return _inner->CopyTo(pstm, cb, pcbRead, pcbWritten);
+    }
+
+    IFACEMETHODIMP Commit(DWORD)
+    {
+        return S_OK;
+    }
+
+    IFACEMETHODIMP Revert()
+    {
+        return S_OK;
+    }
+
+    IFACEMETHODIMP LockRegion(ULARGE_INTEGER, ULARGE_INTEGER, DWORD)
+    {
+        return STG_E_INVALIDFUNCTION;
+    }
+
+    IFACEMETHODIMP UnlockRegion(ULARGE_INTEGER, ULARGE_INTEGER, DWORD)
+    {
+        return STG_E_INVALIDFUNCTION;
+    }
+
+    IFACEMETHODIMP Stat(STATSTG *pstatstg, DWORD grfStatFlag)
+    {
+        return _inner->Stat(pstatstg, grfStatFlag);
+    }
+
+    IFACEMETHODIMP Clone(IStream **)
+    {
+        return E_NOTIMPL;
+    }
+#endif
+
+private:
+    // feeds the part of a read that continues the payload into the hash. a read that skips
+    // ahead or splits the payload off a 32 byte boundary leaves the item unhashed
+    VOID Hash(ULONGLONG offset, const BYTE* data, ULONG size)
+    {
+        ULONGLONG start = max(offset, _used.dataOffset + _hashed);
+        ULONGLONG end = min(offset + size, _used.dataOffset + _used.dataSize);
+        if (start >= end) {
+            return;
+        }
+        if (start != _used.dataOffset + _hashed || (end < _used.dataOffset + _used.dataSize && (end - start) % 32 != 0)) {
+            _state = HASH_SKIPPED;
+            return;
+        }
+
+        _hash.Update(data + (start - offset), (SIZE_T)(end - start));
+        _hashed += end - start;
+        if (_hashed == _used.dataSize) {
+            _hash.Final(_key.hash);
+            _state = ClaimContent(_job, _index, _key) ? HASH_OWNER : HASH_DUPLICATE;
+        }
+    }
+
+    long _cRef;
+    IStream* _inner;
+    BATCH_JOB* _job;
+    UINT _index;
+    PAPA_TEXTURE_INFO _used;
+    CONTENT_KEY _key;
+    PapaContentHash _hash;
+    ULONGLONG _hashed;      // payload bytes hashed so far, from its start
+    HASH_STATE _state;
+};
+
+static VOID RenderItem(BATCH_JOB* job, PAPA_BATCH_ITEM* item, IStream* stream)
+{
+    CPapaThumbProvider* provider = new (std::nothrow) CPapaThumbProvider();
+    if (provider == NULL) {
+        item->hr = E_OUTOFMEMORY;
+        return;
+    }
+
+    PAPA_THUMB_OPTIONS options = {};
+    options.scheduler = job->scheduler;
+    provider->SetOptions(&options);
+
+    // a duplicate that falls back to its own render has been read once already
+    item->hr = RewindItemStream(stream);
+    if (SUCCEEDED(item->hr)) {
+        item->hr = provider->Initialize(stream, STGM_READ);
+    }
+    if (SUCCEEDED(item->hr)) {
+        item->hr = provider->GetThumbnail(item->cx, &item->hbmp, &item->alpha);
+    }
+    provider->Release();
+}
+
+// a DIB of its own for item holding the pixels of owner's
+static VOID CopyThumbnail(const PAPA_BATCH_ITEM* owner, PAPA_BATCH_ITEM* item)
+{
+    DIBSECTION dib;
+    if (GetObject(owner->hbmp, sizeof(dib), (LPVOID)&dib) != sizeof(dib)) {
+        item->hr = E_FAIL;
+        return;
+    }
+
+    BITMAPINFO bmi = { sizeof(bmi.bmiHeader) };
+    bmi.bmiHeader.biWidth = dib.dsBmih.biWidth;
+    bmi.bmiHeader.biHeight = dib.dsBmih.biHeight;
+    bmi.bmiHeader.biPlanes = 1;
+    bmi.bmiHeader.biBitCount = 32;
+    bmi.bmiHeader.biCompression = BI_RGB;
+    BYTE* bits = NULL;
+    item->hbmp = CreateDIBSection(NULL, &bmi, DIB_RGB_COLORS, reinterpret_cast<void**>(&bits), NULL, 0);
+    if (item->hbmp == NULL) {
+        item->hr = E_OUTOFMEMORY;
+        return;
+    }
+    memcpy(bits, dib.dsBm.bmBits, (SIZE_T)dib.dsBmih.biWidth * dib.dsBmih.biHeight * 4);
+    item->alpha = owner->alpha;
+    item->shared = TRUE;
+    item->hr = S_OK;
+}
+
+// the followers of one owner once it has rendered
+struct FOLLOWER_JOB
+{
+    BATCH_JOB* job;
+    const PAPA_BATCH_ITEM* owner;
+    const UINT* followers;
+};
+
+// an owner that failed may have failed on its own stream, so its followers try theirs
+static VOID FollowerTask(VOID* context, UINT index)
+{
+    FOLLOWER_JOB* followers = (FOLLOWER_JOB*)context;
+    PAPA_BATCH_ITEM* item = &followers->job->items[followers->followers[index]];
+    if (SUCCEEDED(followers->owner->hr)) {
+        CopyThumbnail(followers->owner, item);
+    } else {
+        RenderItem(followers->job, item, item->pStream);
+    }
+}
+
+static VOID ShapeItemTask(VOID* context, UINT index)
+{
+    BATCH_JOB* job = (BATCH_JOB*)context;
+    ReadShape(&job->items[index], &job->shapes[index]);
+}
+
+static VOID BatchItemTask(VOID* context, UINT index)
+{
+    BATCH_JOB* job = (BATCH_JOB*)context;
+    PAPA_BATCH_ITEM* item = &job->items[index];
+    ITEM_SHAPE* shape = &job->shapes[index];
+    item->hbmp = NULL;
+    item->alpha = WTSAT_UNKNOWN;
+    item->shared = FALSE;
+
+    // one of a kind is rendered on its own and fails there if it has to
+    CHashingStream* stream = shape->hash ? new (std::nothrow) CHashingStream(item->pStream, job, index) : NULL;
+    if (stream == NULL) {
+        RenderItem(job, item, item->pStream);
+        return;
+    }
+
+    RenderItem(job, item, stream);
+    HASH_STATE state = stream->GetState();
+    CONTENT_KEY key = stream->GetKey();
+    stream->Release();
+    if (state == HASH_PENDING || state == HASH_SKIPPED) {
+        return;
+    }
+
+    std::vector<UINT> followers;
+    {
+        std::lock_guard<std::mutex> lock(job->lock);
+        CONTENT_ENTRY& entry = job->contents[key];
+        if (state == HASH_OWNER) {
+            entry.done = TRUE;
+            followers.swap(entry.followers);
+        } else if (!entry.done) {
+            entry.followers.push_back(index);
+            return;
+        } else if (SUCCEEDED(job->items[entry.owner].hr)) {
+            CopyThumbnail(&job->items[entry.owner], item);
+            return;
+        }
+    }
+
+    // a duplicate whose owner failed tries its own stream
+    if (state == HASH_DUPLICATE) {
+        RenderItem(job, item, item->pStream);
+        return;
+    }
+
+    // copies of a big texture's thumbnail are big too, so they are spread out like the rest
+    if (!followers.empty()) {
+        FOLLOWER_JOB followerJob = { job, item, followers.data() };
+        job->scheduler->ParallelFor((UINT)followers.size(), FollowerTask, &followerJob);
+    }
+}
+
+HRESULT PapaBatchGetThumbnails(PAPA_BATCH_ITEM* items, UINT count, PapaScheduler* scheduler)
+{
+    if (items == NULL || scheduler == NULL) {
+        return E_INVALIDARG;
+    }
+
+    BATCH_JOB job;
+    job.items = items;
+    job.scheduler = scheduler;
+    job.shapes.resize(count);
+
+    // headers first, then only items whose shape turns up more than once hash their payload
+    // as it is read for the render
+    scheduler->ParallelFor(count, ShapeItemTask, &job);
+    std::map<CONTENT_KEY, UINT> shapes;
+    for (UINT i = 0; i < count; i++) {
+        if (SUCCEEDED(job.shapes[i].result)) {
+            shapes[job.shapes[i].key]++;
+        }
+    }
+    for (UINT i = 0; i < count; i++) {
+        job.shapes[i].hash = SUCCEEDED(job.shapes[i].result) && shapes[job.shapes[i].key] > 1;
+    }
+
+    scheduler->ParallelFor(count, BatchItemTask, &job);
+
+    for (UINT i = 0; i < count; i++) {
+        if (FAILED(items[i].hr)) {
+            return S_FALSE;
+        }
+    }
+    return S_OK;
+}
@@ -0,0 +1,47 @@
+// The MIT License
+// 
+// Copyright (c) 2022     Marcus Der      marcusder@hotmail.com
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#pragma once
+
+#include <thumbcache.h> // For IThumbnailProvider.
+#include <Windows.h>
+#include "PapaScheduler.h"
+
+// One file of a batch run. The papa file must start the stream, its offsets are read from there.
+struct PAPA_BATCH_ITEM
+{
+    IStream* pStream;       // in
+    UINT cx;                // in, requested thumbnail size
+    HBITMAP hbmp;           // out, owned by the caller when hr succeeded
+    WTS_ALPHATYPE alpha;    // out
+    HRESULT hr;             // out
+    BOOL shared;            // out, hbmp is a copy of an earlier item's with the same texture
+};
+
+// Generates the thumbnails for every item on the given scheduler. Each file is a task of
+// its own which splits its decoding and scaling into further tasks, so one huge texture
+// doesn't leave the rest of the pool idle. Items whose texture entry and payload hash the
+// same at the same cx, such as the copies a mod ships with every unit variant, are decoded
+// once and the rest handed copies. The payload is hashed as the render reads it, so it is
+// still read once per item, but a duplicate stops there and waits on the first. Returns
+// S_FALSE if any of the items failed.
+HRESULT PapaBatchGetThumbnails(PAPA_BATCH_ITEM* items, UINT count, PapaScheduler* scheduler);
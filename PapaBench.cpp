@@ -0,0 +1,460 @@
+// The MIT License
+// 
+// Copyright (c) 2022     Marcus Der      marcusder@hotmail.com
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+// papa-bench runs the pipeline GetThumbnail does (header, payload read, decode, scale,
+// badge) over a corpus of real textures and reports throughput and latency percentiles per
+// format and size, so the files that stall Explorer show up by name rather than vanishing
+// into an average.
+//
+// POSIX only, build with:
+//   g++ -std=c++17 -O2 -pthread -o papa-bench PapaBench.cpp PapaFiles.cpp PapaCore.cpp PapaAdaptive.cpp PapaColour.cpp PapaScheduler.cpp
+//
+//   papa-bench [-s sizes] [-r repeats] [-w warmups] [-j threads] [-L] [-S] [-B ms] [-n slowest]
+//              [-o results.tsv] [-b baseline.tsv] paths...
+//
+//   -s  comma separated cx values, 32,96,256,1024 by default (the Explorer icon sizes)
+//   -r  timed runs per file and size, the median is its latency. 3 by default
+//   -w  untimed runs first, 1 by default so the files come from the page cache. -w 0 times
+//       cold reads on a freshly dropped cache
+//   -j  give the pipeline a scheduler with this many workers, as the provider can have
+//   -L  -S  linear light and streaming options, as PAPA_THUMB_OPTIONS
+//   -B  latency budget in milliseconds, as PAPA_THUMB_OPTIONS. The warmups also train the
+//       latency model
+//   -n  how many of the slowest files to list, 10 by default
+//
+// Files run one at a time so each latency is the whole file's own. -o saves every file's
+// latency, and -b reads a file saved that way by another build and prints both side by
+// side, with the files that got slowest relative to it.
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <algorithm>
+#include <chrono>
+#include <map>
+#include <string>
+#include <vector>
+#include "PapaCore.h"
+#include "PapaFiles.h"
+
+#define DEFAULT_REPEATS 3
+#define DEFAULT_WARMUPS 1
+#define DEFAULT_SLOWEST 10
+#define MAX_SIZES 16
+
+static const UINT g_defaultSizes[] = { 32, 96, 256, 1024 };
+
+// largest texture side each size bucket takes, the last catches the rest
+static const LONG g_bucketLimits[] = { 64, 256, 1024, 4096, 0x7FFFFFFF };
+static const CHAR* g_bucketNames[] = { "<=64", "<=256", "<=1k", "<=4k", ">4k" };
+
+// one file at one cx
+struct SAMPLE
+{
+    std::string path;
+    std::string format;
+    LONG width;
+    LONG height;
+    ULONG64 bytes;      // the file's size
+    UINT cx;
+    double ms;          // median of the timed runs
+    HRESULT result;
+};
+
+static std::string GetFormatName(BYTE format)
+{
+    static const CHAR* names[] = { "?", "RGBA8888", "RGBX8888", "BGRA8888", "DXT1", "DXT3", "DXT5",
+                                   "R32F", "RG32F", "RGBA32F", "R16F", "RG16F", "RGBA16F", "R8" };
+    if (format < sizeof(names) / sizeof(names[0])) {
+        return names[format];
+    }
+    return "format" + std::to_string(format);
+}
+
+static const CHAR* GetBucketName(LONG width, LONG height)
+{
+    LONG larger = max(width, height);
+    UINT bucket = 0;
+    while (larger > g_bucketLimits[bucket]) {
+        bucket++;
+    }
+    return g_bucketNames[bucket];
+}
+
+static double GetMilliseconds(std::chrono::steady_clock::time_point start)
+{
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+// open, render and free, the way GetThumbnail takes a file from stream to bitmap
+static HRESULT RunPipeline(const CHAR* path, UINT cx, const PAPA_THUMB_OPTIONS* options, PapaScratch* scratch)
+{
+    PAPA_SOURCE source;
+    HRESULT result = PapaOpenFileSource(path, &source);
+    if (SUCCEEDED(result)) {
+        PAPA_IMAGE thumbnail;
+        result = PapaRenderThumbnail(&source, cx, options, scratch, &thumbnail);
+        if (SUCCEEDED(result)) {
+            PapaFreeImage(&thumbnail);
+        }
+        PapaCloseFileSource(&source);
+    }
+    return result;
+}
+
+static VOID MeasureFile(const std::string& path, const UINT* sizes, UINT sizeCount, UINT repeats, UINT warmups,
+                        const PAPA_THUMB_OPTIONS* options, PapaScratch* scratch, std::vector<SAMPLE>* samples)
+{
+    SAMPLE sample;
+    sample.path = path;
+    sample.width = 0;
+    sample.height = 0;
+
+    struct stat info;
+    sample.bytes = stat(path.c_str(), &info) == 0 ? (ULONG64)info.st_size : 0;
+
+    PAPA_SOURCE source;
+    PAPA_TEXTURE_INFO texture;
+    HRESULT opened = PapaOpenFileSource(path.c_str(), &source);
+    if (SUCCEEDED(opened)) {
+        opened = PapaReadTextureInfo(&source, 0, &texture);
+        PapaCloseFileSource(&source);
+    }
+    if (SUCCEEDED(opened)) {
+        sample.format = GetFormatName(texture.format);
+        sample.width = texture.width;
+        sample.height = texture.height;
+    } else {
+        sample.format = "invalid";
+    }
+
+    std::vector<double> runs(repeats);
+    for (UINT s = 0; s < sizeCount; s++) {
+        sample.cx = sizes[s];
+        for (UINT i = 0; i < warmups; i++) {
+            RunPipeline(path.c_str(), sample.cx, options, scratch);
+        }
+        for (UINT i = 0; i < repeats; i++) {
+            std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+            sample.result = RunPipeline(path.c_str(), sample.cx, options, scratch);
+            runs[i] = GetMilliseconds(start);
+        }
+        std::sort(runs.begin(), runs.end());
+        sample.ms = runs[repeats / 2];
+        samples->push_back(sample);
+    }
+}
+
+// nearest rank percentile of sorted values
+static double GetPercentile(const std::vector<double>& sorted, double percent)
+{
+    SIZE_T rank = (SIZE_T)ceil(percent / 100.0 * sorted.size());
+    return sorted[rank > 0 ? rank - 1 : 0];
+}
+
+struct GROUP
+{
+    std::vector<double> ms;
+    ULONG64 bytes;
+};
+
+static std::string GetGroupKey(const SAMPLE& sample, BOOL all)
+{
+    CHAR key[64];
+    snprintf(key, sizeof(key), "%5u %-9s %-6s", sample.cx, all ? "all" : sample.format.c_str(), all ? "" : GetBucketName(sample.width, sample.height));
+    return key;
+}
+
+static std::map<std::string, GROUP> GroupSamples(const std::vector<SAMPLE>& samples)
+{
+    std::map<std::string, GROUP> groups;
+    for (const SAMPLE& sample : samples) {
+        for (BOOL all = FALSE; all <= TRUE; all++) {
+            GROUP& group = groups[GetGroupKey(sample, all)];
+            group.ms.push_back(sample.ms);
+            group.bytes += sample.bytes;
+        }
+    }
+    for (auto& entry : groups) {
+        std::sort(entry.second.ms.begin(), entry.second.ms.end());
+    }
+    return groups;
+}
+
+static VOID PrintReport(const std::vector<SAMPLE>& samples, UINT slowest)
+{
+    printf("   cx format    size    files  files/s     MB/s      p50      p95      p99      max  (ms)\n");
+    for (const auto& entry : GroupSamples(samples)) {
+        const GROUP& group = entry.second;
+        double total = 0;
+        for (double ms : group.ms) {
+            total += ms;
+        }
+        double seconds = max(total / 1000.0, 1e-9);
+        printf("%s %6zu %8.1f %8.1f %8.2f %8.2f %8.2f %8.2f\n", entry.first.c_str(), group.ms.size(), group.ms.size() / seconds,
+               group.bytes / 1e6 / seconds, GetPercentile(group.ms, 50), GetPercentile(group.ms, 95), GetPercentile(group.ms, 99), group.ms.back());
+    }
+
+    std::vector<const SAMPLE*> sorted;
+    for (const SAMPLE& sample : samples) {
+        sorted.push_back(&sample);
+    }
+    std::sort(sorted.begin(), sorted.end(), [](const SAMPLE* a, const SAMPLE* b) { return a->ms > b->ms; });
+
+    printf("\nslowest:\n");
+    for (SIZE_T i = 0; i < sorted.size() && i < slowest; i++) {
+        const SAMPLE* sample = sorted[i];
+        printf("%9.2f ms  cx %-5u %-9s %5dx%-5d %s%s\n", sample->ms, sample->cx, sample->format.c_str(), sample->width, sample->height,
+               sample->path.c_str(), FAILED(sample->result) ? "  (failed)" : "");
+    }
+}
+
+static BOOL WriteSamples(const CHAR* path, const std::vector<SAMPLE>& samples)
+{
+    FILE* file = fopen(path, "w");
+    if (file == NULL) {
+        return FALSE;
+    }
+    fprintf(file, "path\tformat\twidth\theight\tbytes\tcx\tms\tresult\n");
+    for (const SAMPLE& sample : samples) {
+        fprintf(file, "%s\t%s\t%d\t%d\t%llu\t%u\t%.4f\t%08x\n", sample.path.c_str(), sample.format.c_str(), sample.width, sample.height,
+                (unsigned long long)sample.bytes, sample.cx, sample.ms, (unsigned)sample.result);
+    }
+    return fclose(file) == 0;
+}
+
+static BOOL ReadSamples(const CHAR* path, std::vector<SAMPLE>* samples)
+{
+    FILE* file = fopen(path, "r");
+    if (file == NULL) {
+        return FALSE;
+    }
+
+    CHAR line[4096];
+    BOOL header = TRUE;
+    while (fgets(line, sizeof(line), file) != NULL) {
+        if (header) {
+            header = FALSE;
+            continue;
+        }
+        // the path is everything before the last seven tabs, it may hold tabs itself
+        std::string text(line);
+        SIZE_T tab = text.size();
+        for (UINT i = 0; i < 7 && tab != std::string::npos; i++) {
+            tab = text.rfind('\t', tab - 1);
+        }
+        if (tab == std::string::npos) {
+            continue;
+        }
+
+        SAMPLE sample;
+        sample.path = text.substr(0, tab);
+        CHAR format[64];
+        unsigned long long bytes;
+        unsigned result;
+        if (sscanf(line + tab + 1, "%63s %d %d %llu %u %lf %x", format, &sample.width, &sample.height, &bytes, &sample.cx, &sample.ms, &result) == 7) {
+            sample.format = format;
+            sample.bytes = bytes;
+            sample.result = (HRESULT)result;
+            samples->push_back(sample);
+        }
+    }
+    fclose(file);
+    return TRUE;
+}
+
+// Only files both runs measured are compared, so adding to the corpus between builds
+// doesn't skew the percentiles.
+static VOID PrintComparison(const std::vector<SAMPLE>& baseline, const std::vector<SAMPLE>& samples, UINT slowest)
+{
+    std::map<std::pair<std::string, UINT>, const SAMPLE*> before;
+    for (const SAMPLE& sample : baseline) {
+        before[std::make_pair(sample.path, sample.cx)] = &sample;
+    }
+
+    std::vector<SAMPLE> matchedBefore;
+    std::vector<SAMPLE> matchedAfter;
+    for (const SAMPLE& sample : samples) {
+        auto found = before.find(std::make_pair(sample.path, sample.cx));
+        if (found != before.end()) {
+            matchedBefore.push_back(*found->second);
+            matchedAfter.push_back(sample);
+        }
+    }
+    if (matchedAfter.empty()) {
+        printf("\nno files in common with the baseline\n");
+        return;
+    }
+
+    std::map<std::string, GROUP> groupsBefore = GroupSamples(matchedBefore);
+    std::map<std::string, GROUP> groupsAfter = GroupSamples(matchedAfter);
+    printf("\nagainst the baseline, %zu samples in common (ms, baseline -> this build):\n", matchedAfter.size());
+    printf("   cx format    size             p50                 p95                 p99\n");
+    for (const auto& entry : groupsAfter) {
+        const std::vector<double>& a = groupsBefore[entry.first].ms;
+        const std::vector<double>& b = entry.second.ms;
+        printf("%s", entry.first.c_str());
+        for (double percent : { 50.0, 95.0, 99.0 }) {
+            double was = GetPercentile(a, percent);
+            double now = GetPercentile(b, percent);
+            printf(" %7.2f>%7.2f %+4.0f%%", was, now, was > 0 ? (now / was - 1) * 100 : 0.0);
+        }
+        printf("\n");
+    }
+
+    std::vector<SIZE_T> order(matchedAfter.size());
+    for (SIZE_T i = 0; i < order.size(); i++) {
+        order[i] = i;
+    }
+    auto ratio = [&](SIZE_T i) { return matchedAfter[i].ms / max(matchedBefore[i].ms, 1e-6); };
+    std::sort(order.begin(), order.end(), [&](SIZE_T a, SIZE_T b) { return ratio(a) > ratio(b); });
+
+    printf("\nmost slowed down:\n");
+    for (SIZE_T i = 0; i < order.size() && i < slowest; i++) {
+        const SAMPLE& sample = matchedAfter[order[i]];
+        printf("%6.2fx %9.2f > %9.2f ms  cx %-5u %-9s %5dx%-5d %s\n", ratio(order[i]), matchedBefore[order[i]].ms, sample.ms, sample.cx,
+               sample.format.c_str(), sample.width, sample.height, sample.path.c_str());
+    }
+}
+
+// "32,96" into sizes, FALSE if it isn't a list of positive numbers
+static BOOL ParseSizes(const CHAR* text, UINT* sizes, UINT* count)
+{
+    *count = 0;
+    while (*text != '\0') {
+        CHAR* end;
+        long size = strtol(text, &end, 10);
+        if (end == text || size <= 0 || size > 0xFFFF || *count == MAX_SIZES || (*end != ',' && *end != '\0')) {
+            return FALSE;
+        }
+        sizes[(*count)++] = (UINT)size;
+        text = *end == ',' ? end + 1 : end;
+    }
+    return *count > 0;
+}
+
+int main(int argc, CHAR** argv)
+{
+    UINT sizes[MAX_SIZES];
+    UINT sizeCount = sizeof(g_defaultSizes) / sizeof(g_defaultSizes[0]);
+    memcpy(sizes, g_defaultSizes, sizeof(g_defaultSizes));
+    UINT repeats = DEFAULT_REPEATS;
+    UINT warmups = DEFAULT_WARMUPS;
+    UINT slowest = DEFAULT_SLOWEST;
+    INT threads = -1;
+    const CHAR* output = NULL;
+    const CHAR* baselinePath = NULL;
+    PAPA_THUMB_OPTIONS options = {};
+    BOOL usage = FALSE;
+    int opt;
+    while ((opt = getopt(argc, argv, "s:r:w:j:LSB:n:o:b:")) != -1) {
+        switch (opt) {
+        case 's':
+            usage |= !ParseSizes(optarg, sizes, &sizeCount);
+            break;
+        case 'r':
+            repeats = (UINT)atoi(optarg);
+            break;
+        case 'w':
+            warmups = (UINT)atoi(optarg);
+            break;
+        case 'j':
+            threads = atoi(optarg);
+            break;
+        case 'L':
+            options.linearLight = TRUE;
+            break;
+        case 'S':
+            options.streaming = TRUE;
+            break;
+        case 'B':
+            options.latencyBudget = (FLOAT)atof(optarg);
+            break;
+        case 'n':
+            slowest = (UINT)atoi(optarg);
+            break;
+        case 'o':
+            output = optarg;
+            break;
+        case 'b':
+            baselinePath = optarg;
+            break;
+        default:
+            usage = TRUE;
+            break;
+        }
+    }
+
+    if (usage || repeats == 0 || optind >= argc) {
+        fprintf(stderr, "usage: papa-bench [-s sizes] [-r repeats] [-w warmups] [-j threads] [-L] [-S] [-B ms] [-n slowest]\n"
+                        "                  [-o results.tsv] [-b baseline.tsv] paths...\n");
+        return 2;
+    }
+
+    std::vector<SAMPLE> baseline;
+    if (baselinePath != NULL && !ReadSamples(baselinePath, &baseline)) {
+        fprintf(stderr, "papa-bench: can't read %s\n", baselinePath);
+        return 1;
+    }
+
+    std::vector<std::string> files;
+    PapaCollectFiles(argv + optind, argc - optind, &files);
+    if (files.empty()) {
+        fprintf(stderr, "papa-bench: no .papa files found\n");
+        return 1;
+    }
+
+    PapaScheduler* scheduler = threads >= 0 ? new PapaScheduler((UINT)threads) : NULL;
+    options.scheduler = scheduler;
+
+    // one scratch for the run, as a provider that stays loaded keeps its buffers
+    PapaScratch scratch;
+    std::vector<SAMPLE> samples;
+    for (SIZE_T i = 0; i < files.size(); i++) {
+        MeasureFile(files[i], sizes, sizeCount, repeats, warmups, &options, &scratch, &samples);
+        fprintf(stderr, "\r%zu/%zu", i + 1, files.size());
+    }
+    fprintf(stderr, "\n");
+    delete scheduler;
+
+    UINT failed = 0;
+    for (const SAMPLE& sample : samples) {
+        failed += FAILED(sample.result) ? 1 : 0;
+    }
+
+    PrintReport(samples, slowest);
+    if (!baseline.empty()) {
+        PrintComparison(baseline, samples, slowest);
+    }
+    if (failed > 0) {
+        printf("\n%u samples failed to render, they are timed all the same\n", failed);
+    }
+
+    if (output != NULL && !WriteSamples(output, samples)) {
+        fprintf(stderr, "papa-bench: can't write %s\n", output);
+        return 1;
+    }
+    return 0;
+}
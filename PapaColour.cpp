@@ -0,0 +1,314 @@
+// The MIT License
+// 
+// Copyright (c) 2022     Marcus Der      marcusder@hotmail.com
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include "PapaColour.h"
+
+#ifdef PAPA_SSE2
+#include <emmintrin.h>
+#endif
+
+// weights are Q14 so that a weight times a 15 bit value, summed, stays inside 32 bits
+#define WEIGHT_BITS 14
+#define WEIGHT_ONE (1 << WEIGHT_BITS)
+
+struct COLOUR_TABLES_BUILDER : PAPA_COLOUR_TABLES
+{
+    COLOUR_TABLES_BUILDER()
+    {
+        for (UINT i = 0; i < 256; i++) {
+            double c = i / 255.0;
+            double linear = c <= 0.04045 ? c / 12.92 : pow((c + 0.055) / 1.055, 2.4);
+            srgbToLinear[i] = (USHORT)(linear * PAPA_LINEAR_ONE + 0.5);
+            alphaToLinear[i] = (USHORT)((i * PAPA_LINEAR_ONE + 127) / 255);
+        }
+
+        for (UINT i = 0; i <= PAPA_LINEAR_ONE; i++) {
+            double linear = (double)i / PAPA_LINEAR_ONE;
+            double c = linear <= 0.0031308 ? linear * 12.92 : 1.055 * pow(linear, 1.0 / 2.4) - 0.055;
+            linearToSrgb[i] = (BYTE)(c * 255.0 + 0.5);
+            linearToAlpha[i] = (BYTE)((i * 255 + PAPA_LINEAR_ONE / 2) / PAPA_LINEAR_ONE);
+        }
+    }
+};
+
+const PAPA_COLOUR_TABLES& PapaGetColourTables()
+{
+    static const COLOUR_TABLES_BUILDER tables;
+    return tables;
+}
+
+static VOID FreeAreaWeights(PAPA_AREA_WEIGHTS* w)
+{
+    free(w->first);
+    free(w->count);
+    free(w->weights);
+    w->first = NULL;
+    w->count = NULL;
+    w->weights = NULL;
+}
+
+static HRESULT BuildAreaWeights(LONG srcSize, LONG dstSize, PAPA_AREA_WEIGHTS* w)
+{
+    double scale = (double)srcSize / dstSize;
+    w->stride = (LONG)ceil(scale) + 2;
+    w->stride += w->stride & 1;
+    w->maxCount = 0;
+    w->first = (LONG*)malloc(dstSize * sizeof(LONG));
+    w->count = (LONG*)malloc(dstSize * sizeof(LONG));
+    w->weights = (SHORT*)calloc((SIZE_T)dstSize * w->stride, sizeof(SHORT));
+    if (w->first == NULL || w->count == NULL || w->weights == NULL) {
+        FreeAreaWeights(w);
+        return E_OUTOFMEMORY;
+    }
+
+    for (LONG i = 0; i < dstSize; i++) {
+        double left = i * scale;
+        double right = (i + 1) * scale;
+        LONG first = min((LONG)left, srcSize - 1);
+        LONG last = max(min((LONG)ceil(right), srcSize), first + 1);
+        SHORT* weights = w->weights + (SIZE_T)i * w->stride;
+
+        LONG total = 0;
+        LONG largest = 0;
+        for (LONG j = first; j < last; j++) {
+            double cover = min(right, (double)(j + 1)) - max(left, (double)j);
+            LONG weight = (LONG)(max(cover, 0.0) / (right - left) * WEIGHT_ONE + 0.5);
+            weights[j - first] = (SHORT)weight;
+            total += weight;
+            if (weight > weights[largest]) {
+                largest = j - first;
+            }
+        }
+        // rounding can leave the sum a little off, give the difference to the largest weight
+        weights[largest] = (SHORT)(weights[largest] + WEIGHT_ONE - total);
+
+        w->first[i] = first;
+        w->count[i] = last - first;
+        w->maxCount = max(w->maxCount, last - first);
+    }
+    return S_OK;
+}
+
+// src is a linear row padded with one spare pixel, dst gets dstWidth linear pixels
+static VOID FilterRowHorizontal(const USHORT* src, USHORT* dst, LONG dstWidth, const PAPA_AREA_WEIGHTS* w)
+{
+    for (LONG x = 0; x < dstWidth; x++) {
+        const USHORT* pixels = src + (SIZE_T)w->first[x] * 4;
+        const SHORT* weights = w->weights + (SIZE_T)x * w->stride;
+        LONG count = w->count[x];
+
+#ifdef PAPA_SSE2
+        __m128i acc = _mm_setzero_si128();
+        for (LONG k = 0; k < count; k += 2) {
+            __m128i pair = _mm_loadu_si128((const __m128i*)(pixels + k * 4));
+            __m128i interleaved = _mm_unpacklo_epi16(pair, _mm_srli_si128(pair, 8));
+            __m128i weight = _mm_set1_epi32((USHORT)weights[k] | ((LONG)weights[k + 1] << 16));
+            acc = _mm_add_epi32(acc, _mm_madd_epi16(interleaved, weight));
+        }
+        acc = _mm_srai_epi32(_mm_add_epi32(acc, _mm_set1_epi32(WEIGHT_ONE / 2)), WEIGHT_BITS);
+        _mm_storel_epi64((__m128i*)(dst + (SIZE_T)x * 4), _mm_packs_epi32(acc, acc));
+#else
+        LONG acc[4] = { 0, 0, 0, 0 };
+        for (LONG k = 0; k < count; k++) {
+            for (LONG c = 0; c < 4; c++) {
+                acc[c] += weights[k] * pixels[k * 4 + c];
+            }
+        }
+        for (LONG c = 0; c < 4; c++) {
+            dst[x * 4 + c] = (USHORT)((acc[c] + WEIGHT_ONE / 2) >> WEIGHT_BITS);
+        }
+#endif
+    }
+}
+
+// weighted sum of count rows of width linear pixels
+static VOID FilterRowsVertical(const USHORT* const* rows, const SHORT* weights, LONG count, USHORT* dst, LONG width)
+{
+    LONG x = 0;
+    LONG values = width * 4;
+
+#ifdef PAPA_SSE2
+    for (; x + 8 <= values; x += 8) {
+        __m128i accLo = _mm_setzero_si128();
+        __m128i accHi = _mm_setzero_si128();
+        for (LONG k = 0; k < count; k += 2) {
+            const USHORT* second = k + 1 < count ? rows[k + 1] : rows[k];
+            __m128i a = _mm_loadu_si128((const __m128i*)(rows[k] + x));
+            __m128i b = _mm_loadu_si128((const __m128i*)(second + x));
+            __m128i weight = _mm_set1_epi32((USHORT)weights[k] | ((LONG)weights[k + 1] << 16));
+            accLo = _mm_add_epi32(accLo, _mm_madd_epi16(_mm_unpacklo_epi16(a, b), weight));
+            accHi = _mm_add_epi32(accHi, _mm_madd_epi16(_mm_unpackhi_epi16(a, b), weight));
+        }
+        __m128i round = _mm_set1_epi32(WEIGHT_ONE / 2);
+        accLo = _mm_srai_epi32(_mm_add_epi32(accLo, round), WEIGHT_BITS);
+        accHi = _mm_srai_epi32(_mm_add_epi32(accHi, round), WEIGHT_BITS);
+        _mm_storeu_si128((__m128i*)(dst + x), _mm_packs_epi32(accLo, accHi));
+    }
+#endif
+
+    for (; x < values; x++) {
+        LONG acc = 0;
+        for (LONG k = 0; k < count; k++) {
+            acc += weights[k] * rows[k][x];
+        }
+        dst[x] = (USHORT)((acc + WEIGHT_ONE / 2) >> WEIGHT_BITS);
+    }
+}
+
+PapaLinearResampler::PapaLinearResampler()
+    : _wx(), _wy(), _linearRow(NULL), _ring(NULL), _outRow(NULL), _rows(NULL), _dst(NULL),
+      _srcWidth(0), _dstWidth(0), _dstHeight(0), _ringSize(0), _pushed(0), _written(0)
+{
+}
+
+PapaLinearResampler::~PapaLinearResampler()
+{
+    Release();
+}
+
+VOID PapaLinearResampler::Release()
+{
+    free(_linearRow);
+    free(_ring);
+    free(_outRow);
+    free((VOID*)_rows);
+    _linearRow = NULL;
+    _ring = NULL;
+    _outRow = NULL;
+    _rows = NULL;
+    FreeAreaWeights(&_wx);
+    FreeAreaWeights(&_wy);
+}
+
+HRESULT PapaLinearResampler::Begin(LONG srcWidth, LONG srcHeight, BYTE* dst, LONG dstWidth, LONG dstHeight)
+{
+    Release();
+    if (srcWidth <= 0 || srcHeight <= 0 || dstWidth <= 0 || dstHeight <= 0) {
+        return E_INVALIDARG;
+    }
+
+    HRESULT hr = BuildAreaWeights(srcWidth, dstWidth, &_wx);
+    if (SUCCEEDED(hr)) {
+        hr = BuildAreaWeights(srcHeight, dstHeight, &_wy);
+    }
+    if (FAILED(hr)) {
+        Release();
+        return hr;
+    }
+
+    _dst = dst;
+    _srcWidth = srcWidth;
+    _dstWidth = dstWidth;
+    _dstHeight = dstHeight;
+    _ringSize = _wy.maxCount;
+    _pushed = 0;
+    _written = 0;
+
+    SIZE_T dstRowValues = (SIZE_T)dstWidth * 4;
+    _linearRow = (USHORT*)calloc(((SIZE_T)srcWidth + 1) * 4, sizeof(USHORT));
+    _ring = (USHORT*)malloc(_ringSize * dstRowValues * sizeof(USHORT));
+    _outRow = (USHORT*)malloc(dstRowValues * sizeof(USHORT));
+    _rows = (const USHORT**)malloc(_wy.stride * sizeof(USHORT*));
+
+    if (_linearRow == NULL || _ring == NULL || _outRow == NULL || _rows == NULL) {
+        Release();
+        return E_OUTOFMEMORY;
+    }
+    return S_OK;
+}
+
+VOID PapaLinearResampler::PushRow(const BYTE* row)
+{
+    const PAPA_COLOUR_TABLES& tables = PapaGetColourTables();
+    SIZE_T dstRowValues = (SIZE_T)_dstWidth * 4;
+
+    for (LONG x = 0; x < _srcWidth * 4; x += 4) {
+        _linearRow[x] = tables.srgbToLinear[row[x]];
+        _linearRow[x + 1] = tables.srgbToLinear[row[x + 1]];
+        _linearRow[x + 2] = tables.srgbToLinear[row[x + 2]];
+        _linearRow[x + 3] = tables.alphaToLinear[row[x + 3]];
+    }
+    FilterRowHorizontal(_linearRow, _ring + (_pushed % _ringSize) * dstRowValues, _dstWidth, &_wx);
+    _pushed++;
+
+    // every output row whose source rows are now all in
+    for (; _written < _dstHeight && _wy.first[_written] + _wy.count[_written] <= _pushed; _written++) {
+        LONG first = _wy.first[_written];
+        LONG count = _wy.count[_written];
+
+        for (LONG k = 0; k < count; k++) {
+            _rows[k] = _ring + ((first + k) % _ringSize) * dstRowValues;
+        }
+        FilterRowsVertical(_rows, _wy.weights + (SIZE_T)_written * _wy.stride, count, _outRow, _dstWidth);
+
+        BYTE* out = _dst + (SIZE_T)_written * dstRowValues;
+        for (SIZE_T x = 0; x < dstRowValues; x += 4) {
+            out[x] = tables.linearToSrgb[_outRow[x]];
+            out[x + 1] = tables.linearToSrgb[_outRow[x + 1]];
+            out[x + 2] = tables.linearToSrgb[_outRow[x + 2]];
+            out[x + 3] = tables.linearToAlpha[_outRow[x + 3]];
+        }
+    }
+}
+
+HRESULT PapaResampleLinear(const BYTE* src, LONG srcWidth, LONG srcHeight, BYTE* dst, LONG dstWidth, LONG dstHeight)
+{
+    PapaLinearResampler resampler;
+    HRESULT hr = resampler.Begin(srcWidth, srcHeight, dst, dstWidth, dstHeight);
+    if (FAILED(hr)) {
+        return hr;
+    }
+
+    for (LONG y = 0; y < srcHeight; y++) {
+        resampler.PushRow(src + (SIZE_T)y * srcWidth * 4);
+    }
+    return S_OK;
+}
+
+VOID PapaBlendLinear(const BYTE* src, LONG srcWidth, LONG srcHeight, BYTE* dst, LONG dstWidth, LONG dstHeight, LONG dx, LONG dy)
+{
+    const PAPA_COLOUR_TABLES& tables = PapaGetColourTables();
+
+    dx = max(min(dx, dstWidth - srcWidth), 0);
+    dy = max(min(dy, dstHeight - srcHeight), 0);
+
+    LONG maxX = min(dx + srcWidth, dstWidth);
+    LONG maxY = min(dy + srcHeight, dstHeight);
+
+    for (LONG y = dy; y < maxY; y++) {
+        for (LONG x = dx; x < maxX; x++) {
+            const BYTE* s = src + ((x - dx) + (y - dy) * srcWidth) * 4;
+            BYTE* d = dst + (x + y * dstWidth) * 4;
+
+            ULONG srcAlpha = tables.alphaToLinear[s[3]];
+            ULONG inverse = PAPA_LINEAR_ONE - srcAlpha;
+            for (LONG c = 0; c < 3; c++) {
+                ULONG linear = (tables.srgbToLinear[s[c]] * srcAlpha + tables.srgbToLinear[d[c]] * inverse + PAPA_LINEAR_ONE / 2) / PAPA_LINEAR_ONE;
+                d[c] = tables.linearToSrgb[linear];
+            }
+            d[3] = tables.linearToAlpha[srcAlpha + (tables.alphaToLinear[d[3]] * inverse + PAPA_LINEAR_ONE / 2) / PAPA_LINEAR_ONE];
+        }
+    }
+}
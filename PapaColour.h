@@ -0,0 +1,92 @@
+// The MIT License
+// 
+// Copyright (c) 2022     Marcus Der      marcusder@hotmail.com
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#pragma once
+
+#include "PapaPlatform.h"
+
+// Linear light values are 15 bit (0 to PAPA_LINEAR_ONE) so that two of them, or a value and
+// a weight, fit the signed 16 bit lanes of a multiply-add.
+#define PAPA_LINEAR_ONE 32767
+
+struct PAPA_COLOUR_TABLES
+{
+    USHORT srgbToLinear[256];
+    USHORT alphaToLinear[256];
+    BYTE linearToSrgb[PAPA_LINEAR_ONE + 1];
+    BYTE linearToAlpha[PAPA_LINEAR_ONE + 1];
+};
+
+// built on first use
+const PAPA_COLOUR_TABLES& PapaGetColourTables();
+
+// per output pixel: the first source pixel, how many contribute and their Q14 weights,
+// padded to an even count so the SIMD loop can always take them in pairs
+struct PAPA_AREA_WEIGHTS
+{
+    LONG* first;
+    LONG* count;
+    SHORT* weights;
+    LONG stride;
+    LONG maxCount;
+};
+
+// Area-averaging resample of a 32bpp BGRA image, filtered in linear light using 16 bit fixed point.
+HRESULT PapaResampleLinear(const BYTE* src, LONG srcWidth, LONG srcHeight, BYTE* dst, LONG dstWidth, LONG dstHeight);
+
+// PapaResampleLinear fed one source row at a time, first to last. Each output row is written
+// as soon as the source rows under it are in, and only the horizontally filtered rows that
+// the next output row still needs are kept, so the source never has to exist all at once.
+class PapaLinearResampler
+{
+public:
+    PapaLinearResampler();
+    ~PapaLinearResampler();
+
+    // dst is dstWidth x dstHeight 32bpp and must outlive the pushes
+    HRESULT Begin(LONG srcWidth, LONG srcHeight, BYTE* dst, LONG dstWidth, LONG dstHeight);
+    // the next 32bpp source row, srcWidth pixels
+    VOID PushRow(const BYTE* row);
+
+private:
+    PapaLinearResampler(const PapaLinearResampler&);
+    PapaLinearResampler& operator=(const PapaLinearResampler&);
+
+    VOID Release();
+
+    PAPA_AREA_WEIGHTS _wx;
+    PAPA_AREA_WEIGHTS _wy;
+    USHORT* _linearRow;     // the row being pushed, in linear light
+    USHORT* _ring;          // horizontally filtered rows, indexed by source row modulo _ringSize
+    USHORT* _outRow;
+    const USHORT** _rows;
+    BYTE* _dst;
+    LONG _srcWidth;
+    LONG _dstWidth;
+    LONG _dstHeight;
+    LONG _ringSize;
+    LONG _pushed;           // source rows in so far
+    LONG _written;          // output rows out so far
+};
+
+// Source-over composite of src onto dst at (dx, dy) in linear light, clamped to fit like Blit.
+VOID PapaBlendLinear(const BYTE* src, LONG srcWidth, LONG srcHeight, BYTE* dst, LONG dstWidth, LONG dstHeight, LONG dx, LONG dy);
@@ -0,0 +1,297 @@
+// The MIT License
+// 
+// Copyright (c) 2022     Marcus Der      marcusder@hotmail.com
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+// papa-contact lays out every texture under the given paths as one grid image, for reviewing
+// whole mods at a glance. Tiles of a row band are decoded and scaled in parallel straight
+// into their cells, and each band is encoded and written while the next one renders, so
+// only two bands are ever in memory however many tiles the sheet has.
+//
+// Build with:
+//   g++ -std=c++17 -O2 -pthread -o papa-contact PapaContactSheet.cpp PapaFiles.cpp PapaCore.cpp PapaAdaptive.cpp PapaColour.cpp PapaEncoder.cpp PapaScheduler.cpp
+//
+//   papa-contact [-t tile] [-c columns] [-j threads] [-l level] -o sheet.png|sheet.qoi paths...
+//
+// Directories are searched recursively and tiles follow sorted path order. Files that fail
+// to decode are marked with a solid tile and listed on stderr.
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <atomic>
+#include <string>
+#include <thread>
+#include <vector>
+#include "PapaColour.h"
+#include "PapaCore.h"
+#include "PapaEncoder.h"
+#include "PapaFiles.h"
+#include <unistd.h> // getopt
+
+#define DEFAULT_TILE 128
+#define DEFAULT_PNG_LEVEL 1
+#define TILE_PADDING 2
+#define FAILED_TILE 0xFF800080  // BGRA purple
+#define SCRATCH_KEEP_BYTES (64 * 1024 * 1024)
+
+struct SHEET
+{
+    const std::vector<std::string>* files;
+    LONG tile;
+    UINT columns;
+    LONG width;             // columns * tile
+    BYTE* band;             // the band being rendered, tile rows of width * 4 bytes, top-down
+    UINT firstFile;         // file in the band's first cell
+    std::atomic<UINT> failed;
+};
+
+// one output stream for either format
+struct SHEET_WRITER
+{
+    BOOL qoi;
+    PapaPngWriter png;
+    PapaQoiWriter qoiWriter;
+
+    HRESULT WriteRow(const BYTE* row)
+    {
+        return qoi ? qoiWriter.WriteRow(row) : png.WriteRow(row);
+    }
+};
+
+struct BAND_WRITE
+{
+    SHEET_WRITER* writer;
+    const BYTE* band;
+    LONG rows;
+    LONG stride;
+    HRESULT result;
+};
+
+static VOID WriteBand(BAND_WRITE* write)
+{
+    write->result = S_OK;
+    for (LONG y = 0; y < write->rows && SUCCEEDED(write->result); y++) {
+        write->result = write->writer->WriteRow(write->band + (SIZE_T)y * write->stride);
+    }
+}
+
+static VOID RenderTileTask(VOID* context, UINT column)
+{
+    SHEET* sheet = (SHEET*)context;
+    LONG tile = sheet->tile;
+    SIZE_T stride = (SIZE_T)sheet->width * 4;
+    BYTE* cell = sheet->band + (SIZE_T)column * tile * 4;
+
+    for (LONG y = 0; y < tile; y++) {
+        memset(cell + y * stride, 0, (SIZE_T)tile * 4);
+    }
+
+    UINT index = sheet->firstFile + column;
+    if (index >= sheet->files->size()) { // the tail of the last band
+        return;
+    }
+
+    // each worker keeps its buffers warm from tile to tile
+    thread_local PapaScratch scratch;
+    thread_local std::vector<BYTE> fitted;
+
+    const CHAR* path = (*sheet->files)[index].c_str();
+    LONG inner = tile - 2 * TILE_PADDING;
+    PAPA_THUMB_OPTIONS options = {};
+    PAPA_SOURCE source;
+    PAPA_TEXTURE_INFO info;
+    LONG width = 0;
+    LONG height = 0;
+
+    HRESULT result = PapaOpenFileSource(path, &source);
+    if (SUCCEEDED(result)) {
+        result = PapaReadTextureInfo(&source, 0, &info);
+        if (SUCCEEDED(result) && (info.width == 0 || info.height == 0)) {
+            result = E_INVALIDARG;
+        }
+
+        if (SUCCEEDED(result)) {
+            // fit the longer side to the cell, centred
+            FLOAT scale = min((FLOAT)inner / info.width, (FLOAT)inner / info.height);
+            width = max((LONG)roundf(info.width * scale), 1);
+            height = max((LONG)roundf(info.height * scale), 1);
+            fitted.resize((SIZE_T)width * height * 4);
+
+            if (scale < 1) { // the usual case, scale as the strips decode and never hold the whole texture
+                PAPA_IMAGE image = { fitted.data(), width, height };
+                result = PapaDecodeScaled(&source, &info, &scratch, &image);
+                if (SUCCEEDED(result)) {
+                    PapaSwapBR(&image);
+                }
+            } else {
+                PAPA_IMAGE texture;
+                result = PapaLoadTexture(&source, &options, &scratch, &texture);
+                if (SUCCEEDED(result)) {
+                    result = PapaResampleLinear(texture.pixels, texture.width, texture.height, fitted.data(), width, height);
+                }
+            }
+        }
+        PapaCloseFileSource(&source);
+    }
+
+    if (SUCCEEDED(result)) {
+        BYTE* origin = cell + (SIZE_T)((tile - height) / 2) * stride + (SIZE_T)((tile - width) / 2) * 4;
+        for (LONG y = 0; y < height; y++) { // fitted is bottom-up, the band is top-down
+            memcpy(origin + y * stride, &fitted[(SIZE_T)(height - 1 - y) * width * 4], (SIZE_T)width * 4);
+        }
+    }
+    scratch.Trim(SCRATCH_KEEP_BYTES);
+
+    if (FAILED(result)) {
+        fprintf(stderr, "%s: failed (0x%08x)\n", path, (unsigned)result);
+        sheet->failed++;
+        for (LONG y = TILE_PADDING; y < tile - TILE_PADDING; y++) {
+            ULONG32* row = (ULONG32*)(cell + y * stride);
+            for (LONG x = TILE_PADDING; x < tile - TILE_PADDING; x++) {
+                row[x] = FAILED_TILE;
+            }
+        }
+    }
+}
+
+static BOOL EndsWith(const std::string& text, const CHAR* suffix)
+{
+    SIZE_T length = strlen(suffix);
+    return text.size() >= length && text.compare(text.size() - length, length, suffix) == 0;
+}
+
+int main(int argc, CHAR** argv)
+{
+    LONG tile = DEFAULT_TILE;
+    UINT columns = 0;
+    UINT threads = 0;
+    UINT level = DEFAULT_PNG_LEVEL;
+    std::string output;
+    int opt;
+    while ((opt = getopt(argc, argv, "t:c:j:l:o:")) != -1) {
+        switch (opt) {
+        case 't':
+            tile = atol(optarg);
+            break;
+        case 'c':
+            columns = (UINT)atoi(optarg);
+            break;
+        case 'j':
+            threads = (UINT)atoi(optarg);
+            break;
+        case 'l':
+            level = (UINT)atoi(optarg);
+            break;
+        case 'o':
+            output = optarg;
+            break;
+        default:
+            output.clear();
+            optind = argc;
+            break;
+        }
+    }
+
+    if (output.empty() || optind >= argc || tile <= 2 * TILE_PADDING || level > 3) {
+        fprintf(stderr, "usage: papa-contact [-t tile] [-c columns] [-j threads] [-l level] -o sheet.png|sheet.qoi paths...\n");
+        return 2;
+    }
+
+    std::vector<std::string> files;
+    PapaCollectFiles(argv + optind, argc - optind, &files);
+    if (files.empty()) {
+        fprintf(stderr, "papa-contact: no .papa files found\n");
+        return 1;
+    }
+
+    if (columns == 0) {
+        columns = (UINT)ceil(sqrt((double)files.size()));
+    }
+    UINT rows = (UINT)((files.size() + columns - 1) / columns);
+    ULONG64 width = (ULONG64)columns * tile;
+    ULONG64 height = (ULONG64)rows * tile;
+    if (width > 0x7FFFFFFF || height > 0x7FFFFFFF) {
+        fprintf(stderr, "papa-contact: a %llu x %llu sheet is too large\n", (unsigned long long)width, (unsigned long long)height);
+        return 1;
+    }
+
+    FILE* file = fopen(output.c_str(), "wb");
+    if (file == NULL) {
+        fprintf(stderr, "papa-contact: can't create %s\n", output.c_str());
+        return 1;
+    }
+
+    SHEET_WRITER* writer = new SHEET_WRITER();
+    writer->qoi = EndsWith(output, ".qoi");
+    HRESULT result = writer->qoi ? writer->qoiWriter.Begin(PapaWriteToFile, file, (ULONG)width, (ULONG)height)
+                                 : writer->png.Begin(PapaWriteToFile, file, (ULONG)width, (ULONG)height, level);
+
+    // one band renders while the other is written out
+    SIZE_T bandBytes = (SIZE_T)width * tile * 4;
+    std::vector<BYTE> bands[2] = { std::vector<BYTE>(bandBytes), std::vector<BYTE>(bandBytes) };
+    BAND_WRITE write = { writer, NULL, tile, (LONG)width * 4, S_OK };
+    std::thread writing;
+
+    SHEET sheet;
+    sheet.files = &files;
+    sheet.tile = tile;
+    sheet.columns = columns;
+    sheet.width = (LONG)width;
+    sheet.failed = 0;
+
+    PapaScheduler scheduler(threads);
+
+    for (UINT band = 0; band < rows && SUCCEEDED(result); band++) {
+        sheet.band = bands[band & 1].data();
+        sheet.firstFile = band * columns;
+        scheduler.ParallelFor(columns, RenderTileTask, &sheet);
+
+        if (writing.joinable()) {
+            writing.join();
+            result = write.result;
+        }
+        write.band = sheet.band;
+        writing = std::thread(WriteBand, &write);
+    }
+
+    if (writing.joinable()) {
+        writing.join();
+        if (SUCCEEDED(result)) {
+            result = write.result;
+        }
+    }
+    if (SUCCEEDED(result)) {
+        result = writer->qoi ? writer->qoiWriter.End() : writer->png.End();
+    }
+    delete writer;
+
+    if (fclose(file) != 0 && SUCCEEDED(result)) {
+        result = E_FAIL;
+    }
+    if (FAILED(result)) {
+        fprintf(stderr, "papa-contact: writing %s failed (0x%08x)\n", output.c_str(), (unsigned)result);
+        return 1;
+    }
+
+    fprintf(stderr, "%zu tiles, %u x %u, %u failed\n", files.size(), columns, rows, sheet.failed.load());
+    return sheet.failed > 0 ? 1 : 0;
+}
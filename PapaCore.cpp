@@ -0,0 +1,1427 @@
+// The MIT License
+// 
+// Copyright (c) 2022     Marcus Der      marcusder@hotmail.com
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#include <float.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <chrono>
+#include <map>
+#include <mutex>
+#include <vector>
+#include "ImgPapafile.c"
+#include "PapaAdaptive.h"
+#include "PapaColour.h"
+#include "PapaCore.h"
+#include "PapaResample.h"
+
+#ifdef PAPA_SSE2
+#include <emmintrin.h>
+#endif
+#ifdef PAPA_F16C
+#include <immintrin.h>
+#endif
+
+// rows handed to each task when a scheduler is available, decode strips stay a multiple of
+// the 4 row DXT block height
+#define DECODE_ROWS_PER_TASK 64
+
+// texture rows decoded at a time by PapaDecodeScaled, a whole number of DXT block rows
+#define STREAM_ROWS_PER_STRIP 16
+
+// float texels converted per batch, on the stack
+#define FLOAT_BATCH_PIXELS 64
+
+// badges up to this many pixels are kept in the shared cache, and at most this many sizes
+#define BADGE_CACHE_MAX_PIXELS (256 * 256)
+#define BADGE_CACHE_MAX_ENTRIES 64
+
+PapaScratch::PapaScratch()
+{
+    for (UINT i = 0; i < PAPA_SCRATCH_SLOTS; i++) {
+        _buffers[i] = NULL;
+        _sizes[i] = 0;
+    }
+}
+
+PapaScratch::~PapaScratch()
+{
+    for (UINT i = 0; i < PAPA_SCRATCH_SLOTS; i++) {
+        free(_buffers[i]);
+    }
+}
+
+BYTE* PapaScratch::Reserve(UINT slot, SIZE_T size)
+{
+    size = max(size, (SIZE_T)1); // formats without a payload still get a valid pointer
+    if (size <= _sizes[slot]) {
+        return _buffers[slot];
+    }
+
+    free(_buffers[slot]);
+    _buffers[slot] = (BYTE*)malloc(size);
+    _sizes[slot] = _buffers[slot] != NULL ? size : 0;
+    return _buffers[slot];
+}
+
+VOID PapaScratch::Trim(SIZE_T maxSize)
+{
+    for (UINT i = 0; i < PAPA_SCRATCH_SLOTS; i++) {
+        if (_sizes[i] > maxSize) {
+            free(_buffers[i]);
+            _buffers[i] = NULL;
+            _sizes[i] = 0;
+        }
+    }
+}
+
+static HRESULT ReadFileSource(VOID* context, ULONGLONG offset, VOID* buffer, ULONG size)
+{
+    FILE* file = (FILE*)context;
+#ifdef _WIN32
+    int seek = _fseeki64(file, (__int64)offset, SEEK_SET);
+#else
+    int seek = fseeko(file, (off_t)offset, SEEK_SET);
+#endif
+    if (seek != 0) {
+        return E_FAIL;
+    }
+    return fread(buffer, 1, size, file) == size ? S_OK : E_FAIL;
+}
+
+HRESULT PapaOpenFileSource(const CHAR* path, PAPA_SOURCE* source)
+{
+    FILE* file = NULL;
+#ifdef _WIN32
+    fopen_s(&file, path, "rb");
+#else
+    file = fopen(path, "rb");
+#endif
+    if (file == NULL) {
+        return E_FAIL;
+    }
+    source->read = ReadFileSource;
+    source->context = file;
+    return S_OK;
+}
+
+VOID PapaCloseFileSource(PAPA_SOURCE* source)
+{
+    if (source->context != NULL) {
+        fclose((FILE*)source->context);
+        source->context = NULL;
+    }
+}
+
+static VOID ParseTextureInfo(const BYTE* textureHeader, PAPA_TEXTURE_INFO* info)
+{
+    info->format = textureHeader[2];
+    info->mips = textureHeader[3];
+    memcpy(&info->width, textureHeader + 4, sizeof(info->width));
+    memcpy(&info->height, textureHeader + 6, sizeof(info->height));
+    memcpy(&info->dataSize, textureHeader + 8, sizeof(info->dataSize));
+    memcpy(&info->dataOffset, textureHeader + 16, sizeof(info->dataOffset));
+}
+
+HRESULT PapaReadTextureInfo(const PAPA_SOURCE* source, UINT index, PAPA_TEXTURE_INFO* info)
+{
+    BYTE header[PAPA_HEADER_SIZE];
+    if (FAILED(source->read(source->context, 0, header, PAPA_HEADER_SIZE))) {
+        return E_INVALIDARG;
+    }
+
+    // is the header valid?
+    if (memcmp(header, "apaP", 4) != 0) {
+        return E_INVALIDARG;
+    }
+
+    SHORT numTextures;
+    ULONGLONG textureOffset;
+    memcpy(&numTextures, header + 10, sizeof(numTextures));
+    memcpy(&textureOffset, header + 40, sizeof(textureOffset));
+
+    if (numTextures <= 0 || index >= (UINT)numTextures) {
+        return E_INVALIDARG;
+    }
+
+    BYTE textureHeader[PAPA_TEXTURE_INFO_SIZE];
+    if (FAILED(source->read(source->context, textureOffset + (ULONGLONG)index * PAPA_TEXTURE_INFO_SIZE, textureHeader, PAPA_TEXTURE_INFO_SIZE))) {
+        return E_INVALIDARG;
+    }
+
+    ParseTextureInfo(textureHeader, info);
+    return S_OK;
+}
+
+HRESULT PapaReadPreviewInfo(const PAPA_SOURCE* source, PAPA_TEXTURE_INFO* info)
+{
+    BYTE header[PAPA_HEADER_SIZE];
+    if (FAILED(source->read(source->context, 0, header, PAPA_HEADER_SIZE)) || memcmp(header, "apaP", 4) != 0) {
+        return E_INVALIDARG;
+    }
+
+    SHORT numTextures;
+    ULONGLONG textureOffset;
+    memcpy(&numTextures, header + 10, sizeof(numTextures));
+    memcpy(&textureOffset, header + 40, sizeof(textureOffset));
+    if (numTextures < 2) {
+        return S_FALSE;
+    }
+
+    BYTE first[PAPA_TEXTURE_INFO_SIZE];
+    BYTE last[PAPA_TEXTURE_INFO_SIZE];
+    if (FAILED(source->read(source->context, textureOffset, first, PAPA_TEXTURE_INFO_SIZE)) ||
+        FAILED(source->read(source->context, textureOffset + (ULONGLONG)(numTextures - 1) * PAPA_TEXTURE_INFO_SIZE, last, PAPA_TEXTURE_INFO_SIZE))) {
+        return E_INVALIDARG;
+    }
+    ParseTextureInfo(last, info);
+
+    BYTE tag[PAPA_PREVIEW_TAG_SIZE];
+    if (info->dataOffset < PAPA_PREVIEW_TAG_SIZE || FAILED(source->read(source->context, info->dataOffset - PAPA_PREVIEW_TAG_SIZE, tag, PAPA_PREVIEW_TAG_SIZE))) {
+        return S_FALSE;
+    }
+    if (memcmp(tag, PAPA_PREVIEW_MAGIC, 8) != 0 || memcmp(tag + 16, first, 16) != 0) {
+        return S_FALSE;
+    }
+
+    ULONGLONG dataSize = PapaTextureDataSize(info->format, info->width, info->height);
+    if (dataSize == 0 || info->dataSize < dataSize || info->dataSize > 0xFFFFFFFF) {
+        return S_FALSE;
+    }
+    return S_OK;
+}
+
+ULONGLONG PapaTextureDataSize(BYTE format, USHORT width, USHORT height)
+{
+    ULONGLONG pixels = (ULONGLONG)width * height;
+    ULONGLONG blocks = (ULONGLONG)((width + 3) / 4) * ((height + 3) / 4);
+
+    switch (format) {
+    case 1: // RGBA8888
+    case 2: // RGBX8888
+    case 3: // BGRA8888
+        return pixels * 4;
+    case 4: // DXT1
+        return blocks * 8;
+    case 6: // DXT5
+        return blocks * 16;
+    case 7: // R32F
+    case 11: // RG16F
+        return pixels * 4;
+    case 8: // RG32F
+    case 12: // RGBA16F
+        return pixels * 8;
+    case 9: // RGBA32F
+        return pixels * 16;
+    case 10: // R16F
+        return pixels * 2;
+    case 13: // R8
+        return pixels;
+    default:
+        return 0;
+    }
+}
+
+HRESULT PapaGetMipInfo(const PAPA_TEXTURE_INFO* info, UINT level, PAPA_TEXTURE_INFO* mip)
+{
+    if (level >= (UINT)max(info->mips & 0x0F, 1)) {
+        return E_INVALIDARG;
+    }
+
+    ULONGLONG offset = 0;
+    for (UINT i = 0; i < level; i++) {
+        offset += PapaTextureDataSize(info->format, (USHORT)max(info->width >> i, 1), (USHORT)max(info->height >> i, 1));
+    }
+
+    *mip = *info;
+    mip->width = (USHORT)max(info->width >> level, 1);
+    mip->height = (USHORT)max(info->height >> level, 1);
+    mip->dataOffset = info->dataOffset + offset;
+    mip->dataSize = PapaTextureDataSize(info->format, mip->width, mip->height);
+    if (level > 0 && (mip->dataSize == 0 || offset + mip->dataSize > info->dataSize)) {
+        return E_INVALIDARG;
+    }
+    if (level == 0) {
+        mip->dataSize = info->dataSize;
+    }
+    return S_OK;
+}
+
+static VOID DxtDecodeColourMap(const BYTE* data, UINT dataLoc, BYTE colours[4][3]) { // [[R,G,B] * 4]
+    UINT colour0 = (data[dataLoc + 0]) | (data[dataLoc + 1] << 8);
+    UINT colour1 = (data[dataLoc + 2]) | (data[dataLoc + 3] << 8);
+
+    colours[0][0] = (colour0 >> 8) & 0b11111000;
+    colours[0][1] = (colour0 >> 3) & 0b11111100;
+    colours[0][2] = (colour0 << 3) & 0b11111000;
+
+    colours[1][0] = (colour1 >> 8) & 0b11111000;
+    colours[1][1] = (colour1 >> 3) & 0b11111100;
+    colours[1][2] = (colour1 << 3) & 0b11111000;
+
+    if (colour0 > colour1) {
+        colours[2][0] = (BYTE)((2 * (ULONG64)colours[0][0] + (ULONG64)colours[1][0]) / 3.0);
+        colours[2][1] = (BYTE)((2 * (ULONG64)colours[0][1] + (ULONG64)colours[1][1]) / 3.0);
+        colours[2][2] = (BYTE)((2 * (ULONG64)colours[0][2] + (ULONG64)colours[1][2]) / 3.0);
+
+        colours[3][0] = (BYTE)(((ULONG64)colours[0][0] + 2 * (ULONG64)colours[1][0]) / 3.0);
+        colours[3][1] = (BYTE)(((ULONG64)colours[0][1] + 2 * (ULONG64)colours[1][1]) / 3.0);
+        colours[3][2] = (BYTE)(((ULONG64)colours[0][2] + 2 * (ULONG64)colours[1][2]) / 3.0);
+    }
+    else {
+        colours[2][0] = (BYTE)(((ULONG64)colours[0][0] + (ULONG64)colours[1][0]) / 2.0);
+        colours[2][1] = (BYTE)(((ULONG64)colours[0][1] + (ULONG64)colours[1][1]) / 2.0);
+        colours[2][2] = (BYTE)(((ULONG64)colours[0][2] + (ULONG64)colours[1][2]) / 2.0);
+
+        colours[3][0] = 0;
+        colours[3][1] = 0;
+        colours[3][2] = 0;
+
+    }
+}
+
+static VOID DxtDecodeAlphaMap(const BYTE* data, UINT dataLoc, BYTE alphaValues[16]) {
+    BYTE alphaMap[8];
+    alphaMap[0] = data[dataLoc + 0];
+    alphaMap[1] = data[dataLoc + 1];
+
+    if (alphaMap[0] > alphaMap[1]) {
+        for (UINT i = 1; i < 7; i++) {
+            alphaMap[i + 1] = (BYTE)(((ULONG64)(7 - i) * (ULONG64)alphaMap[0] + (ULONG64)i * (ULONG64)alphaMap[1]) / 7.0);
+        }
+    }
+    else {
+        for (UINT i = 1; i < 5; i++) {
+            alphaMap[i + 1] = (BYTE)(((5 - i) * (ULONG64)alphaMap[0] + i * (ULONG64)alphaMap[1]) / 5.0);
+        }
+        alphaMap[6] = 0;
+        alphaMap[7] = (BYTE)0xff;
+    }
+
+    ULONGLONG alphaBits = 0;
+
+    for (int i = 2; i < 8; i++) { // pack the rest of the data into a single long for easy access
+        alphaBits |= ((ULONGLONG) data[i + dataLoc]) << ((i - 2) * 8);
+    }
+
+    for (int i = 0; i < 16; i++) {
+        alphaValues[i] = alphaMap[alphaBits & 0b111];
+        alphaBits >>= 3;
+    }
+}
+
+// channels per texel of a float format and whether they are stored as halves
+static UINT GetFloatLayout(BYTE format, BOOL* half)
+{
+    *half = format >= 10;
+    switch (format) {
+    case 7: // R32F
+    case 10: // R16F
+        return 1;
+    case 8: // RG32F
+    case 11: // RG16F
+        return 2;
+    default: // RGBA32F, RGBA16F
+        return 4;
+    }
+}
+
+// Exact for every half, denormals, infinities and NaNs included: the bits shift into float
+// position and one multiply by 2^112 rebiases the exponent, normalising denormals on the way.
+static FLOAT HalfToFloat(USHORT half)
+{
+    ULONG32 expmant = half & 0x7FFF;
+    ULONG32 bits = expmant << 13;
+    FLOAT value;
+
+    if (expmant > 0x7BFF) { // infinity or NaN, all exponent bits set
+        bits |= 0xFFu << 23;
+        memcpy(&value, &bits, sizeof(value));
+    } else {
+        memcpy(&value, &bits, sizeof(value));
+        value *= 5.192296858534828e+33f;
+    }
+    return (half & 0x8000) ? -value : value;
+}
+
+#if defined(PAPA_SSE2) && !defined(PAPA_F16C)
+// HalfToFloat for four halves, one in the low 16 bits of each lane
+static inline __m128 HalfToFloat4(__m128i halves)
+{
+    __m128i expmant = _mm_and_si128(halves, _mm_set1_epi32(0x7FFF));
+    __m128i sign = _mm_slli_epi32(_mm_xor_si128(halves, expmant), 16);
+    __m128 scaled = _mm_mul_ps(_mm_castsi128_ps(_mm_slli_epi32(expmant, 13)), _mm_castsi128_ps(_mm_set1_epi32((254 - 15) << 23)));
+    __m128i infNan = _mm_and_si128(_mm_cmpgt_epi32(expmant, _mm_set1_epi32(0x7BFF)), _mm_set1_epi32(0xFF << 23));
+    return _mm_or_ps(scaled, _mm_castsi128_ps(_mm_or_si128(sign, infNan)));
+}
+#endif
+
+// count values of a float payload, 32 bit or half, widened to floats
+static VOID LoadFloats(const BYTE* src, UINT count, BOOL half, FLOAT* dst)
+{
+    if (!half) {
+        memcpy(dst, src, (SIZE_T)count * sizeof(FLOAT));
+        return;
+    }
+
+    UINT i = 0;
+#if defined(PAPA_F16C)
+    for (; i + 4 <= count; i += 4) {
+        _mm_storeu_ps(dst + i, _mm_cvtph_ps(_mm_loadl_epi64((const __m128i*)(src + i * 2))));
+    }
+#elif defined(PAPA_SSE2)
+    for (; i + 4 <= count; i += 4) {
+        __m128i halves = _mm_unpacklo_epi16(_mm_loadl_epi64((const __m128i*)(src + i * 2)), _mm_setzero_si128());
+        _mm_storeu_ps(dst + i, HalfToFloat4(halves));
+    }
+#endif
+    for (; i < count; i++) {
+        USHORT value;
+        memcpy(&value, src + i * 2, sizeof(value));
+        dst[i] = HalfToFloat(value);
+    }
+}
+
+// widens range by the finite values, leaving out alpha when there are 4 channels
+static VOID MeasureFloats(const FLOAT* values, UINT count, UINT channels, PAPA_FLOAT_RANGE* range)
+{
+    FLOAT low = range->low;
+    FLOAT high = range->high;
+    UINT i = 0;
+
+#ifdef PAPA_SSE2
+    __m128 lows = _mm_set1_ps(low);
+    __m128 highs = _mm_set1_ps(high);
+    __m128 colour = _mm_castsi128_ps(channels == 4 ? _mm_setr_epi32(-1, -1, -1, 0) : _mm_set1_epi32(-1));
+    __m128 magnitude = _mm_castsi128_ps(_mm_set1_epi32(0x7FFFFFFF));
+    __m128 largest = _mm_set1_ps(FLT_MAX);
+    __m128 smallest = _mm_set1_ps(-FLT_MAX);
+
+    for (; i + 4 <= count; i += 4) {
+        __m128 v = _mm_loadu_ps(values + i);
+        // lanes to skip become values that can't move the range, rather than blending with
+        // the running min and max, so the only dependency between iterations is min and max
+        __m128 use = _mm_and_ps(colour, _mm_cmple_ps(_mm_and_ps(v, magnitude), largest)); // false for NaN and infinity
+        __m128 used = _mm_and_ps(use, v);
+        lows = _mm_min_ps(lows, _mm_or_ps(used, _mm_andnot_ps(use, largest)));
+        highs = _mm_max_ps(highs, _mm_or_ps(used, _mm_andnot_ps(use, smallest)));
+    }
+
+    FLOAT lanes[2][4];
+    _mm_storeu_ps(lanes[0], lows);
+    _mm_storeu_ps(lanes[1], highs);
+    for (UINT k = 0; k < 4; k++) {
+        low = min(low, lanes[0][k]);
+        high = max(high, lanes[1][k]);
+    }
+#endif
+
+    for (; i < count; i++) {
+        FLOAT v = values[i];
+        if ((channels != 4 || (i & 3) != 3) && fabsf(v) <= FLT_MAX) {
+            low = min(low, v);
+            high = max(high, v);
+        }
+    }
+
+    range->low = low;
+    range->high = high;
+}
+
+#ifdef PAPA_SSE2
+static inline __m128i MapFloat4(__m128 values, __m128 low, __m128 scale)
+{
+    __m128 v = _mm_add_ps(_mm_mul_ps(_mm_sub_ps(values, low), scale), _mm_set1_ps(0.5f));
+    // clamp before converting, max gives 0 for NaN and the conversion can't overflow
+    v = _mm_min_ps(_mm_max_ps(v, _mm_setzero_ps()), _mm_set1_ps(255.0f));
+    return _mm_cvttps_epi32(v);
+}
+#endif
+
+// (value - low) * scale rounded and clamped to a byte, NaN to 0, with the low and scale of
+// each value repeating every 4
+static VOID MapFloats(const FLOAT* values, UINT count, const FLOAT lows[4], const FLOAT scales[4], BYTE* dst)
+{
+    UINT i = 0;
+
+#ifdef PAPA_SSE2
+    __m128 low = _mm_loadu_ps(lows);
+    __m128 scale = _mm_loadu_ps(scales);
+
+    for (; i + 16 <= count; i += 16) {
+        __m128i a = MapFloat4(_mm_loadu_ps(values + i), low, scale);
+        __m128i b = MapFloat4(_mm_loadu_ps(values + i + 4), low, scale);
+        __m128i c = MapFloat4(_mm_loadu_ps(values + i + 8), low, scale);
+        __m128i d = MapFloat4(_mm_loadu_ps(values + i + 12), low, scale);
+        _mm_storeu_si128((__m128i*)(dst + i), _mm_packus_epi16(_mm_packs_epi32(a, b), _mm_packs_epi32(c, d)));
+    }
+#endif
+
+    for (; i < count; i++) {
+        FLOAT v = (values[i] - lows[i & 3]) * scales[i & 3] + 0.5f;
+        dst[i] = v >= 255.0f ? 255 : v >= 1.0f ? (BYTE)v : 0;
+    }
+}
+
+VOID PapaMeasureFloatRange(const BYTE* data, USHORT width, USHORT height, BYTE format, PAPA_FLOAT_RANGE* range)
+{
+    if (!PapaIsFloatFormat(format)) {
+        return;
+    }
+
+    BOOL half;
+    UINT channels = GetFloatLayout(format, &half);
+    SIZE_T texelBytes = (SIZE_T)channels * (half ? 2 : 4);
+    SIZE_T count = (SIZE_T)width * height;
+    FLOAT values[FLOAT_BATCH_PIXELS * 4];
+
+    for (SIZE_T i = 0; i < count; i += FLOAT_BATCH_PIXELS) {
+        UINT batch = (UINT)min(count - i, (SIZE_T)FLOAT_BATCH_PIXELS) * channels;
+        LoadFloats(data + i * texelBytes, batch, half, values);
+        MeasureFloats(values, batch, channels, range);
+    }
+}
+
+static VOID DecodeFloatRows(const BYTE* data, USHORT width, USHORT height, BYTE format, BYTE* dst, UINT firstRow, UINT lastRow, const PAPA_FLOAT_RANGE* range)
+{
+    BOOL half;
+    UINT channels = GetFloatLayout(format, &half);
+    SIZE_T texelBytes = (SIZE_T)channels * (half ? 2 : 4);
+
+    // stretch the measured range over 0 to 255, or clamp 0 to 1 when there is no spread
+    FLOAT low = 0.0f;
+    FLOAT scale = 255.0f;
+    if (range != NULL && range->high > range->low) {
+        low = range->low;
+        scale = 255.0f / (range->high - range->low);
+    }
+    FLOAT lows[4] = { low, low, low, channels == 4 ? 0.0f : low };
+    FLOAT scales[4] = { scale, scale, scale, channels == 4 ? 255.0f : scale }; // alpha is already 0 to 1
+
+    FLOAT values[FLOAT_BATCH_PIXELS * 4];
+    BYTE mapped[FLOAT_BATCH_PIXELS * 4];
+
+    for (UINT y = firstRow; y < lastRow; y++) {
+        const BYTE* src = data + (SIZE_T)y * width * texelBytes;
+        BYTE* out = dst + (SIZE_T)(height - 1 - y) * width * 4;
+
+        for (UINT x = 0; x < width; x += FLOAT_BATCH_PIXELS) {
+            UINT pixels = min((UINT)width - x, (UINT)FLOAT_BATCH_PIXELS);
+            LoadFloats(src + x * texelBytes, pixels * channels, half, values);
+            BYTE* pixel = out + (SIZE_T)x * 4;
+
+            if (channels == 4) { // already RGBA
+                MapFloats(values, pixels * 4, lows, scales, pixel);
+                continue;
+            }
+
+            MapFloats(values, pixels * channels, lows, scales, mapped);
+            for (UINT i = 0; i < pixels; i++, pixel += 4) {
+                if (channels == 2) { // red and green as they are
+                    pixel[0] = mapped[i * 2];
+                    pixel[1] = mapped[i * 2 + 1];
+                    pixel[2] = 0;
+                } else { // a single channel is usually height, show it as grey
+                    pixel[0] = mapped[i];
+                    pixel[1] = mapped[i];
+                    pixel[2] = mapped[i];
+                }
+                pixel[3] = 255;
+            }
+        }
+    }
+}
+
+struct DECODE_JOB
+{
+    const BYTE* data;
+    USHORT width;
+    USHORT height;
+    BYTE format;
+    BYTE* dst;
+    const PAPA_FLOAT_RANGE* range;
+};
+
+static VOID DecodeTextureTask(VOID* context, UINT index) {
+    DECODE_JOB* job = (DECODE_JOB*)context;
+    UINT firstRow = index * DECODE_ROWS_PER_TASK;
+    UINT lastRow = min(firstRow + DECODE_ROWS_PER_TASK, (UINT)job->height);
+    PapaDecodeTextureRows(job->data, job->width, job->height, job->format, job->dst, firstRow, lastRow, job->range);
+}
+
+struct MEASURE_JOB
+{
+    const BYTE* data;
+    USHORT width;
+    USHORT height;
+    BYTE format;
+    PAPA_FLOAT_RANGE* ranges; // one per task, merged afterwards
+};
+
+static VOID MeasureFloatRangeTask(VOID* context, UINT index) {
+    MEASURE_JOB* job = (MEASURE_JOB*)context;
+    UINT firstRow = index * DECODE_ROWS_PER_TASK;
+    UINT rows = min((UINT)DECODE_ROWS_PER_TASK, job->height - firstRow);
+    PapaResetFloatRange(&job->ranges[index]);
+    PapaMeasureFloatRange(job->data + PapaTextureDataSize(job->format, job->width, (USHORT)firstRow), job->width, (USHORT)rows, job->format, &job->ranges[index]);
+}
+
+// the range of the whole payload, split across the scheduler when it is big enough
+static VOID MeasureTexture(const BYTE* data, USHORT width, USHORT height, BYTE format, PapaScheduler* scheduler, PAPA_FLOAT_RANGE* range) {
+    PapaResetFloatRange(range);
+    if (!PapaIsFloatFormat(format)) {
+        return;
+    }
+
+    UINT tasks = (height + DECODE_ROWS_PER_TASK - 1) / DECODE_ROWS_PER_TASK;
+    MEASURE_JOB job = { data, width, height, format, NULL };
+    if (scheduler != NULL && tasks > 1) {
+        job.ranges = (PAPA_FLOAT_RANGE*)malloc(tasks * sizeof(PAPA_FLOAT_RANGE));
+    }
+    if (job.ranges == NULL) {
+        PapaMeasureFloatRange(data, width, height, format, range);
+        return;
+    }
+
+    scheduler->ParallelFor(tasks, MeasureFloatRangeTask, &job);
+    for (UINT i = 0; i < tasks; i++) {
+        range->low = min(range->low, job.ranges[i].low);
+        range->high = max(range->high, job.ranges[i].high);
+    }
+    free(job.ranges);
+}
+
+VOID PapaDecodeTexture(const BYTE* data, USHORT width, USHORT height, BYTE format, BYTE* dst, PapaScheduler* scheduler) {
+    PAPA_FLOAT_RANGE range;
+    MeasureTexture(data, width, height, format, scheduler, &range);
+
+    if (scheduler == NULL || height <= DECODE_ROWS_PER_TASK) {
+        PapaDecodeTextureRows(data, width, height, format, dst, 0, height, &range);
+        return;
+    }
+
+    // split into strips of whole block rows that idle workers can steal
+    DECODE_JOB job = { data, width, height, format, dst, &range };
+    scheduler->ParallelFor((height + DECODE_ROWS_PER_TASK - 1) / DECODE_ROWS_PER_TASK, DecodeTextureTask, &job);
+}
+
+VOID PapaDecodeTextureRows(const BYTE* data, USHORT width, USHORT height, BYTE format, BYTE* dst, UINT firstRow, UINT lastRow, const PAPA_FLOAT_RANGE* range) {
+
+    int heightZero = height - 1;
+    UINT blocksPerRow = (width + 3) / 4;
+
+    if (format == 1) { // RGBA8888
+        for (UINT y = firstRow; y < lastRow; y++) {
+            for (UINT x = 0; x < width; x++) {
+                UINT i = (x + (heightZero - y) * width) * 4;
+                UINT i2 = (x + y * width) * 4;
+                dst[i] = data[i2];
+                dst[i + 1] = data[i2 + 1];
+                dst[i + 2] = data[i2 + 2];
+                dst[i + 3] = data[i2 + 3];
+            }
+        }
+    }
+    else if (format == 2) { // RGBX8888
+        for (UINT y = firstRow; y < lastRow; y++) {
+            for (UINT x = 0; x < width; x++) {
+                UINT i = (x + (heightZero - y) * width) * 4;
+                UINT i2 = (x + y * width) * 4;
+                dst[i] = data[i2];
+                dst[i + 1] = data[i2 + 1];
+                dst[i + 2] = data[i2 + 2];
+                dst[i + 3] = 255;
+            }
+        }
+    }
+    else if (format == 3) { // BGRA8888
+        for (UINT y = firstRow; y < lastRow; y++) {
+            for (UINT x = 0; x < width; x++) {
+                UINT i = (x + (heightZero - y) * width) * 4;
+                UINT i2 = (x + y * width) * 4;
+                dst[i] = data[i2 + 2];
+                dst[i + 1] = data[i2 + 1];
+                dst[i + 2] = data[i2];
+                dst[i + 3] = data[i2 + 3];
+            }
+        }
+    }
+    else if (format == 4) { // DXT1
+        UINT bufferLoc = (firstRow / 4) * blocksPerRow * 8;
+        BYTE colours[4][3];
+        for (UINT y = firstRow; y < lastRow; y += 4) {
+            for (UINT x = 0; x < width; x += 4) {
+
+                DxtDecodeColourMap(data, bufferLoc, colours);
+                bufferLoc += 4;
+
+                UINT bits = 0;
+                bits |= data[bufferLoc++] << 0;
+                bits |= data[bufferLoc++] << 8;
+                bits |= data[bufferLoc++] << 16;
+                bits |= data[bufferLoc++] << 24;
+
+                for (UINT yy = 0; yy < 4; yy++) {
+                    for (UINT xx = 0; xx < 4; xx++) { // copy our colour data into the array
+                        UINT colourIndex = bits & 0b11;
+                        if (yy + y < height && xx + x < width) {
+                            UINT idx = (xx + x + (heightZero - (yy + y)) * width) * 4;
+                            BYTE* col = colours[colourIndex];
+                            dst[idx] = col[0];
+                            dst[idx + 1] = col[1];
+                            dst[idx + 2] = col[2];
+                            dst[idx + 3] = 255;
+                        }
+                        bits >>= 2;
+                    }
+                }
+            }
+        }
+    }
+    else if (format == 6) { // DXT5
+        UINT bufferLoc = (firstRow / 4) * blocksPerRow * 16;
+        BYTE alphaValues[16];
+        BYTE colours[4][3];
+        for (UINT y = firstRow; y < lastRow; y += 4) {
+            for (UINT x = 0; x < width; x += 4) {
+
+                DxtDecodeAlphaMap(data, bufferLoc, alphaValues);
+                bufferLoc += 8;
+
+                DxtDecodeColourMap(data, bufferLoc, colours);
+                bufferLoc += 4;
+
+                UINT bits = 0;
+                bits |= data[bufferLoc++] << 0;
+                bits |= data[bufferLoc++] << 8;
+                bits |= data[bufferLoc++] << 16;
+                bits |= data[bufferLoc++] << 24;
+
+                for (UINT yy = 0; yy < 4; yy++) {
+                    for (UINT xx = 0; xx < 4; xx++) { // copy our colour data into the array
+                        UINT colourIndex = bits & 0b11;
+                        if (yy + y < height && xx + x < width) {
+                            UINT idx = (xx + x + (heightZero - (yy + y)) * width) * 4;
+                            BYTE* col = colours[colourIndex];
+                            dst[idx] = col[0];
+                            dst[idx + 1] = col[1];
+                            dst[idx + 2] = col[2];
+                            dst[idx + 3] = alphaValues[xx + yy * 4];
+                        }
+                        bits >>= 2;
+                    }
+                }
+            }
+        }
+    }
+    else if (PapaIsFloatFormat(format)) {
+        DecodeFloatRows(data, width, height, format, dst, firstRow, lastRow, range);
+    }
+    else if (format == 13) {
+        for (UINT y = firstRow; y < lastRow; y++) {
+            for (UINT x = 0; x < width; x++) {
+                UINT idx = (x + (heightZero - y) * width) * 4;
+                UINT idx2 = x + y * width;
+                dst[idx] = data[idx2]; // R
+                dst[idx + 1] = 0; // G
+                dst[idx + 2] = 0; // B
+                dst[idx + 3] = 0; // A
+            }
+        }
+    }
+    else {
+        for (UINT y = firstRow; y < lastRow; y++) {
+            for (UINT x = 0; x < width; x++) {
+                UINT idx = (x + (heightZero - y) * width) * 4;
+                dst[idx] = 1; // R
+                dst[idx + 1] = 0; // G
+                dst[idx + 2] = 0; // B
+                dst[idx + 3] = 255; // A
+            }
+        }
+    }
+}
+
+BOOL PapaClipRect(PAPA_RECT* rect, LONG width, LONG height)
+{
+    rect->left = max(rect->left, 0);
+    rect->top = max(rect->top, 0);
+    rect->right = min(rect->right, width);
+    rect->bottom = min(rect->bottom, height);
+    return !PapaRectIsEmpty(rect);
+}
+
+// Reads count runs of size bytes that start stride bytes apart into one packed buffer,
+// with a single read when the runs touch.
+static HRESULT ReadSpans(const PAPA_SOURCE* source, ULONGLONG offset, ULONGLONG stride, ULONG size, ULONG count, BYTE* dst)
+{
+    if (stride == size) {
+        return source->read(source->context, offset, dst, size * count);
+    }
+
+    for (ULONG i = 0; i < count; i++) {
+        HRESULT result = source->read(source->context, offset + stride * i, dst + (SIZE_T)size * i, size);
+        if (FAILED(result)) {
+            return result;
+        }
+    }
+    return S_OK;
+}
+
+HRESULT PapaDecodeRegion(const PAPA_SOURCE* source, const PAPA_TEXTURE_INFO* info, const PAPA_RECT* region, PapaScheduler* scheduler, PapaScratch* scratch, BYTE* dst)
+{
+    LONG width = region->right - region->left;
+    LONG height = region->bottom - region->top;
+
+    if (PapaRectIsEmpty(region) || region->left < 0 || region->top < 0 || region->right > info->width || region->bottom > info->height) {
+        return E_INVALIDARG;
+    }
+    if (info->dataSize < PapaTextureDataSize(info->format, info->width, info->height)) {
+        return E_INVALIDARG;
+    }
+
+    BYTE format = info->format;
+    HRESULT result;
+
+    if (format == 4 || format == 6) { // DXT1, DXT5
+        ULONG blockBytes = format == 4 ? 8 : 16;
+        LONG blocksPerRow = (info->width + 3) / 4;
+        LONG firstColumn = region->left / 4;
+        LONG lastColumn = (region->right + 3) / 4;
+        LONG firstRow = region->top / 4;
+        LONG lastRow = (region->bottom + 3) / 4;
+
+        // the blocks we read form a small texture of their own
+        ULONG spanBytes = (ULONG)(lastColumn - firstColumn) * blockBytes;
+        BYTE* data = scratch->Reserve(PAPA_SCRATCH_DATA, (SIZE_T)spanBytes * (lastRow - firstRow));
+        if (data == NULL) {
+            return E_OUTOFMEMORY;
+        }
+        result = ReadSpans(source, info->dataOffset + ((ULONGLONG)firstRow * blocksPerRow + firstColumn) * blockBytes,
+            (ULONGLONG)blocksPerRow * blockBytes, spanBytes, (ULONG)(lastRow - firstRow), data);
+        if (FAILED(result)) {
+            return E_INVALIDARG;
+        }
+
+        USHORT blocksWidth = (USHORT)(min(lastColumn * 4, (LONG)info->width) - firstColumn * 4);
+        USHORT blocksHeight = (USHORT)(min(lastRow * 4, (LONG)info->height) - firstRow * 4);
+        LONG offsetX = region->left - firstColumn * 4;
+        LONG offsetY = region->top - firstRow * 4;
+
+        if (offsetX == 0 && offsetY == 0 && blocksWidth == width && blocksHeight == height) {
+            PapaDecodeTexture(data, blocksWidth, blocksHeight, format, dst, scheduler);
+            return S_OK;
+        }
+
+        // off the block grid, decode whole blocks and crop
+        BYTE* blocks = scratch->Reserve(PAPA_SCRATCH_REGION, (SIZE_T)blocksWidth * blocksHeight * 4);
+        if (blocks == NULL) {
+            return E_OUTOFMEMORY;
+        }
+        PapaDecodeTexture(data, blocksWidth, blocksHeight, format, blocks, scheduler);
+
+        for (LONG y = 0; y < height; y++) { // both are bottom-up
+            memcpy(dst + (SIZE_T)(height - 1 - y) * width * 4, blocks + ((SIZE_T)(blocksHeight - 1 - (y + offsetY)) * blocksWidth + offsetX) * 4, (SIZE_T)width * 4);
+        }
+        return S_OK;
+    }
+
+    // uncompressed rows, or a format that reads no data at all
+    ULONG bytesPerPixel = (ULONG)PapaTextureDataSize(format, 1, 1);
+    ULONG rowBytes = (ULONG)width * bytesPerPixel;
+    BYTE* data = scratch->Reserve(PAPA_SCRATCH_DATA, (SIZE_T)rowBytes * height);
+    if (data == NULL) {
+        return E_OUTOFMEMORY;
+    }
+    if (bytesPerPixel > 0) {
+        result = ReadSpans(source, info->dataOffset + ((ULONGLONG)region->top * info->width + region->left) * bytesPerPixel,
+            (ULONGLONG)info->width * bytesPerPixel, rowBytes, (ULONG)height, data);
+        if (FAILED(result)) {
+            return E_INVALIDARG;
+        }
+    }
+
+    PapaDecodeTexture(data, (USHORT)width, (USHORT)height, format, dst, scheduler);
+    return S_OK;
+}
+
+VOID PapaGetSubsampledSize(BYTE format, USHORT width, USHORT height, UINT stride, USHORT* subWidth, USHORT* subHeight)
+{
+    if (stride <= 1) {
+        *subWidth = width;
+        *subHeight = height;
+    } else if (format == 4 || format == 6) { // DXT1, DXT5 keep whole blocks
+        *subWidth = (USHORT)(((width + 3) / 4 + stride - 1) / stride * 4);
+        *subHeight = (USHORT)(((height + 3) / 4 + stride - 1) / stride * 4);
+    } else {
+        *subWidth = (USHORT)((width + stride - 1) / stride);
+        *subHeight = (USHORT)((height + stride - 1) / stride);
+    }
+}
+
+HRESULT PapaDecodeSubsampled(const PAPA_SOURCE* source, const PAPA_TEXTURE_INFO* info, UINT stride, PapaScheduler* scheduler, PapaScratch* scratch, BYTE* dst)
+{
+    BYTE format = info->format;
+    // a unit is what gets picked or skipped, one block for the block formats and one texel otherwise
+    ULONG unitBytes = (ULONG)PapaTextureDataSize(format, 1, 1);
+
+    if (stride == 0 || unitBytes == 0 || info->dataSize < PapaTextureDataSize(format, info->width, info->height)) {
+        return E_INVALIDARG;
+    }
+
+    BOOL blocks = format == 4 || format == 6;
+    LONG unitsPerRow = blocks ? (info->width + 3) / 4 : info->width;
+    LONG unitRows = blocks ? (info->height + 3) / 4 : info->height;
+    LONG columns = (unitsPerRow + (LONG)stride - 1) / (LONG)stride;
+    LONG rows = (unitRows + (LONG)stride - 1) / (LONG)stride;
+    ULONG rowBytes = (ULONG)unitsPerRow * unitBytes;
+
+    BYTE* data = scratch->Reserve(PAPA_SCRATCH_DATA, (SIZE_T)columns * unitBytes * rows);
+    BYTE* row = scratch->Reserve(PAPA_SCRATCH_REGION, rowBytes);
+    if (data == NULL || row == NULL) {
+        return E_OUTOFMEMORY;
+    }
+
+    // the picked units form a small texture of their own
+    for (LONG y = 0; y < rows; y++) {
+        if (FAILED(source->read(source->context, info->dataOffset + (ULONGLONG)y * stride * rowBytes, row, rowBytes))) {
+            return E_INVALIDARG;
+        }
+        BYTE* out = data + (SIZE_T)y * columns * unitBytes;
+        for (LONG x = 0; x < columns; x++) {
+            memcpy(out + (SIZE_T)x * unitBytes, row + (SIZE_T)x * stride * unitBytes, unitBytes);
+        }
+    }
+
+    USHORT width;
+    USHORT height;
+    PapaGetSubsampledSize(format, info->width, info->height, stride, &width, &height);
+    PapaDecodeTexture(data, width, height, format, dst, scheduler);
+    return S_OK;
+}
+
+HRESULT PapaDecodeScaled(const PAPA_SOURCE* source, const PAPA_TEXTURE_INFO* info, PapaScratch* scratch, const PAPA_IMAGE* dst)
+{
+    LONG width = info->width;
+    LONG height = info->height;
+    BYTE format = info->format;
+
+    if (width == 0 || height == 0 || info->dataSize < PapaTextureDataSize(format, info->width, info->height)) {
+        return E_INVALIDARG;
+    }
+
+    PapaLinearResampler resampler;
+    HRESULT result = resampler.Begin(width, height, dst->pixels, dst->width, dst->height);
+    if (FAILED(result)) {
+        return result;
+    }
+
+    BYTE* data = scratch->Reserve(PAPA_SCRATCH_DATA, (SIZE_T)PapaTextureDataSize(format, info->width, STREAM_ROWS_PER_STRIP));
+    BYTE* strip = scratch->Reserve(PAPA_SCRATCH_DECODE, (SIZE_T)width * STREAM_ROWS_PER_STRIP * 4);
+    if (data == NULL || strip == NULL) {
+        return E_OUTOFMEMORY;
+    }
+
+    // float formats are normalised over the whole texture, which takes a pass of its own
+    PAPA_FLOAT_RANGE range;
+    PapaResetFloatRange(&range);
+    for (LONG first = 0; PapaIsFloatFormat(format) && first < height; first += STREAM_ROWS_PER_STRIP) {
+        USHORT rows = (USHORT)min(height - first, (LONG)STREAM_ROWS_PER_STRIP);
+        ULONGLONG offset = PapaTextureDataSize(format, info->width, (USHORT)first);
+        if (FAILED(source->read(source->context, info->dataOffset + offset, data, (ULONG)PapaTextureDataSize(format, info->width, rows)))) {
+            return E_INVALIDARG;
+        }
+        PapaMeasureFloatRange(data, info->width, rows, format, &range);
+    }
+
+    // rows go to the resampler bottom-up like everything else here, so start from the last strip
+    for (LONG first = (height - 1) / STREAM_ROWS_PER_STRIP * STREAM_ROWS_PER_STRIP; first >= 0; first -= STREAM_ROWS_PER_STRIP) {
+        USHORT rows = (USHORT)min(height - first, (LONG)STREAM_ROWS_PER_STRIP);
+        ULONGLONG offset = PapaTextureDataSize(format, info->width, (USHORT)first);
+        ULONG size = (ULONG)PapaTextureDataSize(format, info->width, rows);
+
+        if (size > 0 && FAILED(source->read(source->context, info->dataOffset + offset, data, size))) {
+            return E_INVALIDARG;
+        }
+
+        // the strip decodes as a short texture of its own, already flipped
+        PapaDecodeTextureRows(data, info->width, rows, format, strip, 0, rows, &range);
+        for (LONG y = 0; y < rows; y++) {
+            resampler.PushRow(strip + (SIZE_T)y * width * 4);
+        }
+    }
+    return S_OK;
+}
+
+VOID PapaRescaleBilinear(const PAPA_IMAGE* src, const PAPA_IMAGE* dst, PapaScheduler* scheduler) {
+    PapaResampleParallel<PapaBilinearFilter>(src, dst, scheduler);
+}
+
+VOID PapaRescaleBicubic(const PAPA_IMAGE* src, const PAPA_IMAGE* dst, PapaScheduler* scheduler) {
+    PapaResampleParallel<PapaBicubicFilter>(src, dst, scheduler);
+}
+
+VOID PapaRescaleNearestNeighbour(const PAPA_IMAGE* src, const PAPA_IMAGE* dst, PapaScheduler* scheduler) {
+    PapaResampleParallel<PapaNearestFilter>(src, dst, scheduler);
+}
+
+VOID PapaBlit(const PAPA_IMAGE* src, const PAPA_IMAGE* dst, LONG dx, LONG dy) {
+    const BYTE* srcPixels = src->pixels;
+    LONG srcWidth = src->width;
+    LONG srcHeight = src->height;
+
+    BYTE* dstPixels = dst->pixels;
+    LONG dstWidth = dst->width;
+    LONG dstHeight = dst->height;
+
+    // clamp the input to always be valid
+    dx = max(min(dx, dstWidth - srcWidth), 0);
+    dy = max(min(dy, dstHeight - srcHeight), 0);
+
+    LONG maxX = min(dx + srcWidth, dstWidth);
+    LONG maxY = min(dy + srcHeight, dstHeight);
+    
+    for (LONG y = dy; y < maxY; y++) {
+        for (LONG x = dx; x < maxX; x++) {
+            LONG sx = x - dx;
+            LONG sy = y - dy;
+            FLOAT srcAlpha = (FLOAT)(srcPixels[(sx + sy * srcWidth) * 4 + 3]) / 255.0f;
+            FLOAT dstAlpha = (FLOAT)(dstPixels[(x + y * dstWidth) * 4 + 3]) / 255.0f;
+
+            BYTE sred = srcPixels[(sx + sy * srcWidth) * 4];
+            BYTE sgreen = srcPixels[(sx + sy * srcWidth) * 4 + 1];
+            BYTE sblue = srcPixels[(sx + sy * srcWidth) * 4 + 2];
+
+            BYTE dred = dstPixels[(x + y * dstWidth) * 4];
+            BYTE dgreen = dstPixels[(x + y * dstWidth) * 4 + 1];
+            BYTE dblue = dstPixels[(x + y * dstWidth) * 4 + 2];
+
+            BYTE red = (BYTE)(sred * srcAlpha + dred * (1.0f - srcAlpha));
+            BYTE green = (BYTE)(sgreen * srcAlpha + dgreen * (1.0f - srcAlpha));
+            BYTE blue = (BYTE)(sblue * srcAlpha + dblue * (1.0f - srcAlpha));
+
+            BYTE alpha = (BYTE) ((srcAlpha + (dstAlpha * (1.0f - srcAlpha))) * 255.0f);
+
+            dstPixels[(x + y * dstWidth) * 4] = red;
+            dstPixels[(x + y * dstWidth) * 4 + 1] = green;
+            dstPixels[(x + y * dstWidth) * 4 + 2] = blue;
+            dstPixels[(x + y * dstWidth) * 4 + 3] = alpha;
+        }
+    }   
+}
+
+VOID PapaSwapBR(const PAPA_IMAGE* image) {
+    BYTE* pixels = image->pixels;
+    LONG width = image->width;
+    LONG height = image->height;
+
+    // swap R and B
+    for (LONG y = 0; y < height; y++) {
+        for (LONG x = 0; x < width; x++) {
+            LONG idx = (x + y * width) * 4;
+            BYTE t = pixels[idx];
+            pixels[idx] = pixels[idx + 2];
+            pixels[idx + 2] = t;
+        }
+    }
+}
+
+VOID PapaSwapTopBottom(const PAPA_IMAGE* image) {
+    ULONG32* pixelsInt = (ULONG32*)image->pixels;
+    LONG width = image->width;
+    LONG height = image->height;
+
+    for (LONG y = 0; y < height / 2; y++) {
+        for (LONG x = 0; x < width; x++) {
+            LONG idx = (x + y * width);
+            LONG idx2 = (x + (height - y - 1) * width);
+            ULONG32 t = pixelsInt[idx];
+            pixelsInt[idx] = pixelsInt[idx2];
+            pixelsInt[idx2] = t;
+        }
+    }
+}
+
+HRESULT PapaAllocImage(LONG width, LONG height, PAPA_IMAGE* image)
+{
+    image->pixels = (BYTE*)malloc((SIZE_T)width * (SIZE_T)height * 4);
+    image->width = width;
+    image->height = height;
+    return image->pixels != NULL ? S_OK : E_OUTOFMEMORY;
+}
+
+VOID PapaFreeImage(PAPA_IMAGE* image)
+{
+    free(image->pixels);
+    image->pixels = NULL;
+}
+
+// the unscaled badge, converted to BGRA and flipped once
+static const PAPA_IMAGE* GetBadgeSource()
+{
+    static BYTE pixels[13 * 16 * 4];
+    static PAPA_IMAGE badge = { NULL, (LONG)img_papafile.width, (LONG)img_papafile.height };
+    static std::once_flag once;
+
+    std::call_once(once, []() {
+        memcpy(pixels, img_papafile.pixel_data, sizeof(pixels));
+        badge.pixels = pixels;
+        PapaSwapBR(&badge);
+        PapaSwapTopBottom(&badge);
+    });
+    return &badge;
+}
+
+HRESULT PapaGetBadge(LONG width, LONG height, PapaScratch* scratch, PAPA_IMAGE* badge)
+{
+    static std::mutex lock;
+    static std::map<ULONG64, std::vector<BYTE>> cache;
+
+    const PAPA_IMAGE* source = GetBadgeSource();
+
+    // scale so that the icon image is a fraction of the larger component, clamped to fit if it exceeds bounds
+    FLOAT fraction = 5.0f;
+    FLOAT iconScalingFactorWidth = min(((FLOAT)width / (FLOAT)source->width) / fraction, (FLOAT)height / (FLOAT)source->height);
+    FLOAT iconScalingFactorHeight = min((FLOAT)width / (FLOAT)source->width, ((FLOAT)height / (FLOAT)source->height) / fraction);
+    FLOAT iconScalingFactor = max(iconScalingFactorWidth, iconScalingFactorHeight);
+    LONG badgeWidth = (LONG)roundf(source->width * iconScalingFactor);
+    LONG badgeHeight = (LONG)roundf(source->height * iconScalingFactor);
+    SIZE_T badgeBytes = (SIZE_T)badgeWidth * (SIZE_T)badgeHeight * 4;
+
+    if (badgeWidth <= 0 || badgeHeight <= 0) { // too small a thumbnail to carry one
+        badge->pixels = NULL;
+        badge->width = 0;
+        badge->height = 0;
+        return S_OK;
+    }
+
+    if ((SIZE_T)badgeWidth * (SIZE_T)badgeHeight > BADGE_CACHE_MAX_PIXELS) {
+        badge->pixels = scratch->Reserve(PAPA_SCRATCH_BADGE, badgeBytes);
+        badge->width = badgeWidth;
+        badge->height = badgeHeight;
+        if (badge->pixels == NULL) {
+            return E_OUTOFMEMORY;
+        }
+        PapaRescaleNearestNeighbour(source, badge, NULL);
+        return S_OK;
+    }
+
+    ULONG64 key = ((ULONG64)(ULONG)badgeWidth << 32) | (ULONG)badgeHeight;
+    std::lock_guard<std::mutex> guard(lock);
+
+    badge->width = badgeWidth;
+    badge->height = badgeHeight;
+
+    std::map<ULONG64, std::vector<BYTE>>::iterator found = cache.find(key);
+    if (found != cache.end()) {
+        badge->pixels = found->second.data();
+        return S_OK;
+    }
+
+    // entries are never evicted, so borrowers can keep using the pixels after the lock drops
+    if (cache.size() >= BADGE_CACHE_MAX_ENTRIES) {
+        badge->pixels = scratch->Reserve(PAPA_SCRATCH_BADGE, badgeBytes);
+    } else {
+        try {
+            std::vector<BYTE>& pixels = cache[key];
+            pixels.resize(badgeBytes);
+            badge->pixels = pixels.data();
+        } catch (const std::bad_alloc&) {
+            cache.erase(key);
+            badge->pixels = NULL;
+        }
+    }
+    if (badge->pixels == NULL) {
+        return E_OUTOFMEMORY;
+    }
+    PapaRescaleNearestNeighbour(source, badge, NULL);
+    return S_OK;
+}
+
+static HRESULT ReadFirstTexture(const PAPA_SOURCE* source, PAPA_TEXTURE_INFO* info)
+{
+    HRESULT result = PapaReadTextureInfo(source, 0, info);
+    if (FAILED(result)) {
+        return result;
+    }
+
+    // unlike the shell, a server can't trust the table not to point past the payload. formats
+    // without a known size have nothing to check that against and only decode to a placeholder
+    if (PapaTextureDataSize(info->format, 1, 1) == 0) {
+        return E_INVALIDARG;
+    }
+    if (info->width == 0 || info->height == 0 || info->dataSize < PapaTextureDataSize(info->format, info->width, info->height) || info->dataSize > 0xFFFFFFFF) {
+        return E_INVALIDARG;
+    }
+    return S_OK;
+}
+
+// PapaLoadTexture for a texture entry already read
+static HRESULT LoadTexture(const PAPA_SOURCE* source, const PAPA_TEXTURE_INFO& info, const PAPA_THUMB_OPTIONS* options, PapaScratch* scratch, PAPA_IMAGE* texture)
+{
+    if (!PapaRectIsEmpty(&options->region)) {
+        PAPA_RECT region = options->region;
+        if (!PapaClipRect(&region, info.width, info.height)) {
+            return E_INVALIDARG;
+        }
+        texture->width = region.right - region.left;
+        texture->height = region.bottom - region.top;
+        texture->pixels = scratch->Reserve(PAPA_SCRATCH_DECODE, (SIZE_T)texture->width * texture->height * 4);
+        if (texture->pixels == NULL) {
+            return E_OUTOFMEMORY;
+        }
+
+        HRESULT result = PapaDecodeRegion(source, &info, &region, options->scheduler, scratch, texture->pixels);
+        if (SUCCEEDED(result)) {
+            PapaSwapBR(texture);
+        }
+        return result;
+    }
+
+    BYTE* data = scratch->Reserve(PAPA_SCRATCH_DATA, (SIZE_T)info.dataSize);
+    texture->pixels = scratch->Reserve(PAPA_SCRATCH_DECODE, (SIZE_T)info.width * info.height * 4);
+    texture->width = info.width;
+    texture->height = info.height;
+    if (data == NULL || texture->pixels == NULL) {
+        return E_OUTOFMEMORY;
+    }
+
+    if (FAILED(source->read(source->context, info.dataOffset, data, (ULONG)info.dataSize))) {
+        return E_INVALIDARG;
+    }
+
+    PapaDecodeTexture(data, info.width, info.height, info.format, texture->pixels, options->scheduler);
+    PapaSwapBR(texture);
+    return S_OK;
+}
+
+HRESULT PapaLoadTexture(const PAPA_SOURCE* source, const PAPA_THUMB_OPTIONS* options, PapaScratch* scratch, PAPA_IMAGE* texture)
+{
+    PAPA_TEXTURE_INFO info;
+    HRESULT result = ReadFirstTexture(source, &info);
+    if (FAILED(result)) {
+        return result;
+    }
+    return LoadTexture(source, info, options, scratch, texture);
+}
+
+// badges a thumbnail made for a width x height texture, freeing it on failure
+static HRESULT AddBadge(PAPA_IMAGE* thumbnail, LONG width, LONG height, const PAPA_THUMB_OPTIONS* options, PapaScratch* scratch)
+{
+    PAPA_IMAGE badge;
+    HRESULT result = PapaGetBadge(width, height, scratch, &badge);
+    if (FAILED(result)) {
+        PapaFreeImage(thumbnail);
+        return result;
+    }
+
+    const LONG offset = 1;
+
+    if (options->linearLight) {
+        PapaBlendLinear(badge.pixels, badge.width, badge.height, thumbnail->pixels, thumbnail->width, thumbnail->height, thumbnail->width - badge.width - offset, offset);
+    } else {
+        PapaBlit(&badge, thumbnail, thumbnail->width - badge.width - offset, offset);
+    }
+    return S_OK;
+}
+
+// the size a width x height texture is scaled to for cx: cx on the short side, or with
+// options->longSide exactly that on the long side, where rounding cx can't always land
+static VOID GetThumbnailSize(LONG width, LONG height, UINT cx, const PAPA_THUMB_OPTIONS* options, LONG* thumbnailWidth, LONG* thumbnailHeight)
+{
+    FLOAT factor = options->longSide > 0 ? (FLOAT)options->longSide / (FLOAT)max(width, height) : (FLOAT)cx / (FLOAT)min(width, height);
+    *thumbnailWidth = max((LONG)roundf(width * factor), 1);
+    *thumbnailHeight = max((LONG)roundf(height * factor), 1);
+    if (options->longSide > 0) {
+        *(width >= height ? thumbnailWidth : thumbnailHeight) = (LONG)options->longSide;
+    }
+}
+
+HRESULT PapaFinishThumbnail(const PAPA_IMAGE* texture, UINT cx, const PAPA_THUMB_OPTIONS* options, PapaScratch* scratch, PAPA_IMAGE* thumbnail)
+{
+    LONG width = texture->width;
+    LONG height = texture->height;
+
+    // scale to desired size
+    LONG scaledWidth;
+    LONG scaledHeight;
+    GetThumbnailSize(width, height, cx, options, &scaledWidth, &scaledHeight);
+
+    HRESULT result;
+    if (scaledWidth > width || scaledHeight > height) { // upscale
+        result = PapaAllocImage(scaledWidth, scaledHeight, thumbnail);
+        if (SUCCEEDED(result)) {
+            PapaRescaleNearestNeighbour(texture, thumbnail, options->scheduler);
+        }
+    } else if ((scaledWidth < width || scaledHeight < height) && options->linearLight) { // downscale here, the shell would average gamma encoded values
+        result = PapaAllocImage(scaledWidth, scaledHeight, thumbnail);
+        if (SUCCEEDED(result)) {
+            result = PapaResampleLinear(texture->pixels, width, height, thumbnail->pixels, thumbnail->width, thumbnail->height);
+        }
+        width = thumbnail->width; // size the badge against what we hand back
+        height = thumbnail->height;
+    } else { // copy the data over
+        result = PapaAllocImage(width, height, thumbnail);
+        if (SUCCEEDED(result)) {
+            memcpy(thumbnail->pixels, texture->pixels, (SIZE_T)width * (SIZE_T)height * 4);
+        }
+    }
+
+    if (FAILED(result)) {
+        PapaFreeImage(thumbnail);
+        return result;
+    }
+    return AddBadge(thumbnail, width, height, options, scratch);
+}
+
+static double MillisecondsSince(std::chrono::steady_clock::time_point start)
+{
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+// PapaRenderThumbnail inside options->latencyBudget: decode and scale the way the latency
+// model plans, then tell it how long each took. Every plan hands back the same size.
+static HRESULT RenderBudgeted(const PAPA_SOURCE* source, const PAPA_TEXTURE_INFO& info, UINT cx, const PAPA_THUMB_OPTIONS* options, PapaScratch* scratch, PAPA_IMAGE* thumbnail)
+{
+    PapaLatencyModel* model = PapaGetLatencyModel();
+    UINT threads = options->scheduler != NULL ? options->scheduler->GetThreadCount() : 1;
+    PAPA_THUMB_PLAN plan = model->Plan(&info, cx, options->latencyBudget, threads);
+    PapaScheduler* scheduler = plan.parallel ? options->scheduler : NULL;
+
+    PAPA_TEXTURE_INFO mip;
+    HRESULT result = PapaGetMipInfo(&info, plan.mip, &mip);
+    if (FAILED(result)) {
+        return result;
+    }
+
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    PAPA_IMAGE texture;
+    if (plan.stride > 1) {
+        USHORT width;
+        USHORT height;
+        PapaGetSubsampledSize(mip.format, mip.width, mip.height, plan.stride, &width, &height);
+        texture.width = width;
+        texture.height = height;
+        texture.pixels = scratch->Reserve(PAPA_SCRATCH_DECODE, (SIZE_T)width * height * 4);
+        if (texture.pixels == NULL) {
+            return E_OUTOFMEMORY;
+        }
+        result = PapaDecodeSubsampled(source, &mip, plan.stride, scheduler, scratch, texture.pixels);
+        if (SUCCEEDED(result)) {
+            PapaSwapBR(&texture);
+        }
+    } else {
+        PAPA_THUMB_OPTIONS decode = *options;
+        decode.scheduler = scheduler;
+        result = LoadTexture(source, mip, &decode, scratch, &texture);
+    }
+    if (FAILED(result)) {
+        return result;
+    }
+    model->RecordDecode(mip.format, plan.parallel, (ULONGLONG)texture.width * texture.height, MillisecondsSince(start));
+
+    // sized against the full texture, whichever mip or stride stood in for it
+    LONG width;
+    LONG height;
+    GetThumbnailSize(info.width, info.height, cx, options, &width, &height);
+    result = PapaAllocImage(width, height, thumbnail);
+    if (FAILED(result)) {
+        return result;
+    }
+
+    start = std::chrono::steady_clock::now();
+    if (texture.width == thumbnail->width && texture.height == thumbnail->height) {
+        memcpy(thumbnail->pixels, texture.pixels, (SIZE_T)texture.width * texture.height * 4);
+    } else {
+        switch (plan.filter) {
+        case PAPA_FILTER_NEAREST:
+            result = PapaResampleParallel<PapaNearestFilter>(&texture, thumbnail, scheduler);
+            break;
+        case PAPA_FILTER_BILINEAR:
+            result = PapaResampleParallel<PapaBilinearFilter>(&texture, thumbnail, scheduler);
+            break;
+        case PAPA_FILTER_BICUBIC:
+            result = PapaResampleParallel<PapaBicubicFilter>(&texture, thumbnail, scheduler);
+            break;
+        case PAPA_FILTER_BOX:
+            result = PapaResampleParallel<PapaBoxFilter>(&texture, thumbnail, scheduler);
+            break;
+        default:
+            result = PapaResampleLinear(texture.pixels, texture.width, texture.height, thumbnail->pixels, thumbnail->width, thumbnail->height);
+            break;
+        }
+    }
+    if (FAILED(result)) {
+        PapaFreeImage(thumbnail);
+        return result;
+    }
+    ULONGLONG pixels = (ULONGLONG)thumbnail->width * thumbnail->height;
+    model->RecordScale(plan.filter, plan.parallel, PapaFilterReadsAllTexels(plan.filter) ? (ULONGLONG)texture.width * texture.height + pixels : pixels, MillisecondsSince(start));
+
+    return AddBadge(thumbnail, thumbnail->width, thumbnail->height, options, scratch);
+}
+
+HRESULT PapaRenderThumbnail(const PAPA_SOURCE* source, UINT cx, const PAPA_THUMB_OPTIONS* options, PapaScratch* scratch, PAPA_IMAGE* thumbnail)
+{
+    PAPA_TEXTURE_INFO info;
+    HRESULT result = ReadFirstTexture(source, &info);
+    if (FAILED(result)) {
+        return result;
+    }
+
+    // a region is in texture 0's pixels, so only whole texture thumbnails use the preview
+    PAPA_TEXTURE_INFO preview;
+    if (PapaRectIsEmpty(&options->region) && PapaReadPreviewInfo(source, &preview) == S_OK && PapaPreviewCovers(&preview, &info, cx)) {
+        info = preview;
+    }
+
+    if (options->latencyBudget > 0 && PapaRectIsEmpty(&options->region)) {
+        return RenderBudgeted(source, info, cx, options, scratch, thumbnail);
+    }
+
+    if (options->streaming && PapaRectIsEmpty(&options->region)) {
+        // only downscales stream, anything else is no bigger than the thumbnail already
+        LONG width;
+        LONG height;
+        GetThumbnailSize(info.width, info.height, cx, options, &width, &height);
+        if (width <= info.width && height <= info.height && (width < info.width || height < info.height)) {
+            result = PapaAllocImage(width, height, thumbnail);
+            if (SUCCEEDED(result)) {
+                result = PapaDecodeScaled(source, &info, scratch, thumbnail);
+            }
+            if (FAILED(result)) {
+                PapaFreeImage(thumbnail);
+                return result;
+            }
+            PapaSwapBR(thumbnail);
+            return AddBadge(thumbnail, thumbnail->width, thumbnail->height, options, scratch);
+        }
+    }
+
+    PAPA_IMAGE texture;
+    result = LoadTexture(source, info, options, scratch, &texture);
+    if (FAILED(result)) {
+        return result;
+    }
+    return PapaFinishThumbnail(&texture, cx, options, scratch, thumbnail);
+}
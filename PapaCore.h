@@ -0,0 +1,225 @@
+// The MIT License
+// 
+// Copyright (c) 2022     Marcus Der      marcusder@hotmail.com
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#pragma once
+
+#include <float.h>
+#include "PapaPlatform.h"
+#include "PapaScheduler.h"
+
+// The decode, scale and badge pipeline with no GDI or COM in it. CPapaThumbProvider wraps
+// its DIB sections in PAPA_IMAGE views and calls down into this, and the standalone tools
+// (daemon, batch converters) use it directly.
+
+// A rectangle of texels, top-down texture coordinates with right and bottom exclusive.
+struct PAPA_RECT
+{
+    LONG left;
+    LONG top;
+    LONG right;
+    LONG bottom;
+};
+
+// Optional settings for callers that drive the provider directly instead of through the shell.
+// A zeroed struct gives the default shell behaviour.
+struct PAPA_THUMB_OPTIONS
+{
+    PapaScheduler* scheduler;   // split decoding and scaling into tasks on this scheduler
+    BOOL linearLight;           // downscale to cx and composite in linear light rather than leaving it to the shell
+    PAPA_RECT region;           // thumbnail only this part of the texture, e.g. one atlas cell. empty for all of it
+    BOOL streaming;             // downscale as strips are decoded so the full size texture is never held, see PapaDecodeScaled
+    FLOAT latencyBudget;        // milliseconds to aim for per thumbnail, trading quality for time. 0 for none, see PapaAdaptive.h
+    UINT longSide;              // size the thumbnail to exactly this on its long side rather than cx on its short one. 0 for cx
+};
+
+// 32bpp pixels packed width * 4 bytes per row, rows in the same bottom-up order as a DIB section.
+struct PAPA_IMAGE
+{
+    BYTE* pixels;
+    LONG width;
+    LONG height;
+};
+
+// Reads size bytes at offset, anything short of all of them is a failure.
+typedef HRESULT(*PAPA_READ_PROC)(VOID* context, ULONGLONG offset, VOID* buffer, ULONG size);
+
+struct PAPA_SOURCE
+{
+    PAPA_READ_PROC read;
+    VOID* context;
+};
+
+// One entry of the texture table.
+struct PAPA_TEXTURE_INFO
+{
+    BYTE format;
+    BYTE mips;          // mip count in the low nibble, srgb flag in the high
+    USHORT width;
+    USHORT height;
+    ULONGLONG dataSize;
+    ULONGLONG dataOffset;
+};
+
+#define PAPA_HEADER_SIZE 0x68
+#define PAPA_TEXTURE_INFO_SIZE 24
+
+// scratch slots used by the render functions
+#define PAPA_SCRATCH_DATA 0     // the texture payload as read from the file
+#define PAPA_SCRATCH_DECODE 1   // the full size decode, or one strip of it when streaming
+#define PAPA_SCRATCH_BADGE 2    // badges too big for the shared cache
+#define PAPA_SCRATCH_REGION 3   // whole DXT blocks around a region that doesn't sit on block edges
+#define PAPA_SCRATCH_SLOTS 4
+
+// Grow-only buffers kept by a rendering thread so that once warm it stops going back to
+// the allocator for every file. Not thread safe, give each thread its own.
+class PapaScratch
+{
+public:
+    PapaScratch();
+    ~PapaScratch();
+
+    // NULL if the allocation fails, the previous contents are not kept
+    BYTE* Reserve(UINT slot, SIZE_T size);
+    // releases any slot that has grown past maxSize, e.g. after one huge texture
+    VOID Trim(SIZE_T maxSize);
+
+private:
+    BYTE* _buffers[PAPA_SCRATCH_SLOTS];
+    SIZE_T _sizes[PAPA_SCRATCH_SLOTS];
+};
+
+// PAPA_SOURCE over a file opened with fopen, one reader at a time.
+HRESULT PapaOpenFileSource(const CHAR* path, PAPA_SOURCE* source);
+VOID PapaCloseFileSource(PAPA_SOURCE* source);
+
+// validates the header and reads entry index of the texture table
+HRESULT PapaReadTextureInfo(const PAPA_SOURCE* source, UINT index, PAPA_TEXTURE_INFO* info);
+// bytes of payload a texture needs, 0 for formats that don't read any
+ULONGLONG PapaTextureDataSize(BYTE format, USHORT width, USHORT height);
+// Entry for mip level of info, the levels following each other in the payload from the
+// largest down. Fails past the last level or when the payload is too short to hold it.
+HRESULT PapaGetMipInfo(const PAPA_TEXTURE_INFO* info, UINT level, PAPA_TEXTURE_INFO* mip);
+
+// A preview is a small copy of texture 0 that papa-preview appends as the last entry of the
+// texture table. Its payload follows a PAPA_PREVIEW_TAG_SIZE tag: PAPA_PREVIEW_MAGIC, 8 bytes
+// reserved, then the first 16 bytes of texture 0's entry as they were when the preview was
+// made, so one left behind by an editor that changed texture 0 no longer matches.
+#define PAPA_PREVIEW_MAGIC "papaprev"
+#define PAPA_PREVIEW_TAG_SIZE 32
+
+// S_OK with the preview's entry when the file has one that matches texture 0, S_FALSE when
+// it has none
+HRESULT PapaReadPreviewInfo(const PAPA_SOURCE* source, PAPA_TEXTURE_INFO* info);
+
+// whether a preview can stand in for texture at cx: it must be the smaller of the two and
+// still have at least cx on its short side
+inline BOOL PapaPreviewCovers(const PAPA_TEXTURE_INFO* preview, const PAPA_TEXTURE_INFO* texture, UINT cx)
+{
+    return preview->width < texture->width && preview->height < texture->height && cx <= (UINT)(preview->width < preview->height ? preview->width : preview->height);
+}
+
+// R32F, RG32F, RGBA32F, R16F, RG16F and RGBA16F
+inline BOOL PapaIsFloatFormat(BYTE format)
+{
+    return format >= 7 && format <= 12;
+}
+
+// The lowest and highest finite colour values of a float texture, alpha aside. Float
+// formats are normalised so that this range fills 0 to 255: height maps and HDR lookups
+// have no fixed scale to clamp to.
+struct PAPA_FLOAT_RANGE
+{
+    FLOAT low;
+    FLOAT high;
+};
+
+inline VOID PapaResetFloatRange(PAPA_FLOAT_RANGE* range)
+{
+    range->low = FLT_MAX;
+    range->high = -FLT_MAX;
+}
+
+// widens range by the values in a float payload of width x height, nothing for other formats
+VOID PapaMeasureFloatRange(const BYTE* data, USHORT width, USHORT height, BYTE format, PAPA_FLOAT_RANGE* range);
+
+// Decodes a texture payload to RGBA rows, flipped bottom-up. Float formats are normalised
+// over the whole payload.
+VOID PapaDecodeTexture(const BYTE* data, USHORT width, USHORT height, BYTE format, BYTE* dst, PapaScheduler* scheduler);
+// rows [firstRow, lastRow), firstRow must be a multiple of 4 for the block formats. range is
+// the measure of the whole texture for float formats and is ignored by the rest.
+VOID PapaDecodeTextureRows(const BYTE* data, USHORT width, USHORT height, BYTE format, BYTE* dst, UINT firstRow, UINT lastRow, const PAPA_FLOAT_RANGE* range);
+
+inline BOOL PapaRectIsEmpty(const PAPA_RECT* rect)
+{
+    return rect->right <= rect->left || rect->bottom <= rect->top;
+}
+
+// clips rect to a width x height texture, FALSE if nothing is left
+BOOL PapaClipRect(PAPA_RECT* rect, LONG width, LONG height);
+
+// Decodes just region of a texture into (right - left) x (bottom - top) RGBA, bottom-up like
+// PapaDecodeTexture. Only the rows, or rows of DXT blocks, that cross the region are read,
+// and only the part of each that does, so the cost follows the region and not the texture.
+// region must already lie inside the texture.
+HRESULT PapaDecodeRegion(const PAPA_SOURCE* source, const PAPA_TEXTURE_INFO* info, const PAPA_RECT* region, PapaScheduler* scheduler, PapaScratch* scratch, BYTE* dst);
+
+// Decodes the whole texture a strip of block rows at a time straight into an area-averaging
+// linear light downscale to dst's size, RGBA and bottom-up like PapaDecodeTexture. Only one
+// strip of payload and pixels and the resampler's rows exist at once, so memory follows the
+// texture width and dst rather than the texture's area.
+HRESULT PapaDecodeScaled(const PAPA_SOURCE* source, const PAPA_TEXTURE_INFO* info, PapaScratch* scratch, const PAPA_IMAGE* dst);
+
+// Decodes every stride'th texel of each row and column, or for the block formats every
+// stride'th block whole, into a smaller RGBA image bottom-up like PapaDecodeTexture. Only the
+// rows picked are read. Its size comes from PapaGetSubsampledSize, and formats without a
+// payload can't be subsampled.
+VOID PapaGetSubsampledSize(BYTE format, USHORT width, USHORT height, UINT stride, USHORT* subWidth, USHORT* subHeight);
+HRESULT PapaDecodeSubsampled(const PAPA_SOURCE* source, const PAPA_TEXTURE_INFO* info, UINT stride, PapaScheduler* scheduler, PapaScratch* scratch, BYTE* dst);
+
+// With a scheduler the output rows are split across it, with output identical to the serial
+// pass. Outputs too small to gain from it run serially either way.
+VOID PapaRescaleNearestNeighbour(const PAPA_IMAGE* src, const PAPA_IMAGE* dst, PapaScheduler* scheduler);
+VOID PapaRescaleBilinear(const PAPA_IMAGE* src, const PAPA_IMAGE* dst, PapaScheduler* scheduler);
+VOID PapaRescaleBicubic(const PAPA_IMAGE* src, const PAPA_IMAGE* dst, PapaScheduler* scheduler);
+// source-over composite of src onto dst at (dx, dy), clamped to fit
+VOID PapaBlit(const PAPA_IMAGE* src, const PAPA_IMAGE* dst, LONG dx, LONG dy);
+VOID PapaSwapBR(const PAPA_IMAGE* image);
+VOID PapaSwapTopBottom(const PAPA_IMAGE* image);
+
+// The papafile badge, BGRA and bottom-up, sized for a thumbnail of width x height. Small
+// badges come from a cache shared by every thread, larger ones are built in scratch. Either
+// way the pixels are only borrowed.
+HRESULT PapaGetBadge(LONG width, LONG height, PapaScratch* scratch, PAPA_IMAGE* badge);
+
+// The first texture of the file decoded to BGRA, or just options->region of it when that is
+// set. The pixels live in PAPA_SCRATCH_DECODE.
+HRESULT PapaLoadTexture(const PAPA_SOURCE* source, const PAPA_THUMB_OPTIONS* options, PapaScratch* scratch, PAPA_IMAGE* texture);
+// Scales a loaded texture for cx and badges it the same way GetThumbnail does. The result
+// is malloc'd, release it with PapaFreeImage.
+HRESULT PapaFinishThumbnail(const PAPA_IMAGE* texture, UINT cx, const PAPA_THUMB_OPTIONS* options, PapaScratch* scratch, PAPA_IMAGE* thumbnail);
+// PapaLoadTexture followed by PapaFinishThumbnail, or with options->streaming a downscale
+// through PapaDecodeScaled that never loads the full texture. With options->latencyBudget
+// the way there is planned by PapaGetLatencyModel instead, unless a region is set.
+HRESULT PapaRenderThumbnail(const PAPA_SOURCE* source, UINT cx, const PAPA_THUMB_OPTIONS* options, PapaScratch* scratch, PAPA_IMAGE* thumbnail);
+
+HRESULT PapaAllocImage(LONG width, LONG height, PAPA_IMAGE* image);
+VOID PapaFreeImage(PAPA_IMAGE* image);
@@ -0,0 +1,583 @@
+// The MIT License
+// 
+// Copyright (c) 2022     Marcus Der      marcusder@hotmail.com
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+// papa-thumbd keeps the thumbnail pipeline resident behind a Unix domain socket, so tools
+// that render a lot of thumbnails stop paying for process startup and cold caches per file.
+// Scaled thumbnails, their encodings, the badge cache and each thread's scratch buffers all
+// stay warm between requests, and connections are served concurrently. Thumbnails are
+// rendered the way papa-thumbnailer renders them: embedded previews when they cover cx,
+// otherwise a streaming downscale in linear light, so a full size texture is never held.
+//
+// POSIX only, build with:
+//   g++ -std=c++17 -O2 -pthread -o papa-thumbd PapaDaemon.cpp PapaCore.cpp PapaAdaptive.cpp PapaColour.cpp PapaEncoder.cpp PapaScheduler.cpp
+//
+//   papa-thumbd [-s socket] [-j threads] [-m cacheMB]      serve until SIGINT or SIGTERM
+//   papa-thumbd -q [-s socket] cx raw|png|qoi path         fetch one thumbnail to stdout
+//
+// A request is one line, "<cx> <raw|png|qoi> <path>\n", and a connection may send any
+// number of them. Each is answered with a PAPA_DAEMON_REPLY followed by size bytes of
+// payload. raw is top-down BGRA, width * 4 bytes per row. Paths should be absolute, the
+// daemon's working directory is not the client's.
+
+#include <errno.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <algorithm>
+#include <iterator>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include "PapaCore.h"
+#include "PapaEncoder.h"
+
+#define DEFAULT_CACHE_MB 256
+#define MAX_REQUEST_LINE 4096
+#define SCRATCH_KEEP_BYTES (64 * 1024 * 1024)  // scratch slots bigger than this are released after a request
+#define PNG_LEVEL 1
+
+// sent in native byte order, the client is always on the same machine
+struct PAPA_DAEMON_REPLY
+{
+    LONG status;    // HRESULT
+    ULONG width;
+    ULONG height;
+    ULONG size;     // payload bytes that follow
+};
+
+enum OUTPUT_FORMAT
+{
+    FORMAT_RAW,
+    FORMAT_PNG,
+    FORMAT_QOI,
+};
+
+static const CHAR* g_formatNames[] = { "raw", "png", "qoi" };
+
+// what a cached entry was built from, any change to the file invalidates it
+struct FILE_STAMP
+{
+    LONG64 mtime;   // nanoseconds
+    LONG64 size;
+
+    bool operator==(const FILE_STAMP& other) const
+    {
+        return mtime == other.mtime && size == other.size;
+    }
+};
+
+// a badged thumbnail at some cx, before it is encoded
+struct SCALED
+{
+    std::vector<BYTE> pixels;   // BGRA, bottom-up
+    LONG width;
+    LONG height;
+};
+
+struct THUMBNAIL
+{
+    std::vector<BYTE> payload;  // encoded for the requested format
+    ULONG width;
+    ULONG height;
+};
+
+// LRU cache with a byte budget, shared by every connection. Values are handed out as
+// shared_ptr so a reply can finish sending an entry that another thread has just evicted.
+template <class T> class LruCache
+{
+public:
+    LruCache() : _budget(0), _used(0)
+    {
+    }
+
+    VOID SetBudget(SIZE_T budget)
+    {
+        _budget = budget;
+    }
+
+    std::shared_ptr<const T> Find(const std::string& key, const FILE_STAMP& stamp)
+    {
+        std::lock_guard<std::mutex> guard(_lock);
+        typename INDEX::iterator found = _index.find(key);
+        if (found == _index.end()) {
+            return NULL;
+        }
+        if (!(found->second->stamp == stamp)) { // stale, the file changed on disk
+            Remove(found->second);
+            return NULL;
+        }
+        _order.splice(_order.begin(), _order, found->second);
+        return found->second->value;
+    }
+
+    VOID Insert(const std::string& key, const FILE_STAMP& stamp, const std::shared_ptr<const T>& value, SIZE_T bytes)
+    {
+        if (bytes > _budget) {
+            return;
+        }
+
+        std::lock_guard<std::mutex> guard(_lock);
+        typename INDEX::iterator found = _index.find(key);
+        if (found != _index.end()) { // another connection rendered it at the same time
+            Remove(found->second);
+        }
+
+        while (_used + bytes > _budget) {
+            Remove(std::prev(_order.end()));
+        }
+
+        ENTRY entry = { key, stamp, value, bytes };
+        _order.push_front(entry);
+        _index[key] = _order.begin();
+        _used += bytes;
+    }
+
+private:
+    struct ENTRY
+    {
+        std::string key;
+        FILE_STAMP stamp;
+        std::shared_ptr<const T> value;
+        SIZE_T bytes;
+    };
+
+    typedef std::unordered_map<std::string, typename std::list<ENTRY>::iterator> INDEX;
+
+    VOID Remove(typename std::list<ENTRY>::iterator entry)
+    {
+        _used -= entry->bytes;
+        _index.erase(entry->key);
+        _order.erase(entry);
+    }
+
+    std::mutex _lock;
+    std::list<ENTRY> _order;    // most recently used first
+    INDEX _index;
+    SIZE_T _budget;
+    SIZE_T _used;
+};
+
+static LruCache<SCALED> g_scaled;
+static LruCache<THUMBNAIL> g_thumbnails;
+static PapaScheduler* g_scheduler;
+static std::mutex g_scratchLock;
+static std::vector<PapaScratch*> g_scratchPool; // idle scratch, warm from earlier requests
+static CHAR g_socketPath[sizeof(((sockaddr_un*)NULL)->sun_path)];
+
+static PapaScratch* AcquireScratch()
+{
+    std::lock_guard<std::mutex> guard(g_scratchLock);
+    if (g_scratchPool.empty()) {
+        return new PapaScratch();
+    }
+    PapaScratch* scratch = g_scratchPool.back();
+    g_scratchPool.pop_back();
+    return scratch;
+}
+
+static VOID ReleaseScratch(PapaScratch* scratch)
+{
+    scratch->Trim(SCRATCH_KEEP_BYTES);
+    std::lock_guard<std::mutex> guard(g_scratchLock);
+    g_scratchPool.push_back(scratch);
+}
+
+static HRESULT AppendToVector(VOID* context, const BYTE* data, SIZE_T size)
+{
+    std::vector<BYTE>* out = (std::vector<BYTE>*)context;
+    out->insert(out->end(), data, data + size);
+    return S_OK;
+}
+
+static HRESULT GetFileStamp(const CHAR* path, FILE_STAMP* stamp)
+{
+    struct stat info;
+    if (stat(path, &info) != 0 || !S_ISREG(info.st_mode)) {
+        return E_INVALIDARG;
+    }
+#ifdef __APPLE__
+    stamp->mtime = (LONG64)info.st_mtimespec.tv_sec * 1000000000 + info.st_mtimespec.tv_nsec;
+#else
+    stamp->mtime = (LONG64)info.st_mtim.tv_sec * 1000000000 + info.st_mtim.tv_nsec;
+#endif
+    stamp->size = (LONG64)info.st_size;
+    return S_OK;
+}
+
+// the thumbnail at cx, from the cache when the file hasn't changed since it was rendered,
+// whatever format it was asked for in then
+static HRESULT GetScaled(const CHAR* path, const FILE_STAMP& stamp, UINT cx, std::shared_ptr<const SCALED>* scaled)
+{
+    std::string key = std::to_string(cx) + " " + path;
+    *scaled = g_scaled.Find(key, stamp);
+    if (*scaled) {
+        return S_OK;
+    }
+
+    PAPA_SOURCE source;
+    HRESULT result = PapaOpenFileSource(path, &source);
+    if (FAILED(result)) {
+        return result;
+    }
+
+    PAPA_THUMB_OPTIONS options = {};
+    options.scheduler = g_scheduler;
+    options.linearLight = TRUE;
+    options.streaming = TRUE;
+    PapaScratch* scratch = AcquireScratch();
+    PAPA_IMAGE image;
+    result = PapaRenderThumbnail(&source, cx, &options, scratch, &image);
+    ReleaseScratch(scratch);
+    PapaCloseFileSource(&source);
+    if (FAILED(result)) {
+        return result;
+    }
+
+    std::shared_ptr<SCALED> rendered = std::make_shared<SCALED>();
+    SIZE_T bytes = (SIZE_T)image.width * image.height * 4;
+    rendered->pixels.assign(image.pixels, image.pixels + bytes);
+    rendered->width = image.width;
+    rendered->height = image.height;
+    PapaFreeImage(&image);
+    g_scaled.Insert(key, stamp, rendered, bytes + key.size());
+    *scaled = rendered;
+    return S_OK;
+}
+
+static HRESULT Encode(const PAPA_IMAGE* image, OUTPUT_FORMAT format, std::vector<BYTE>* payload)
+{
+    // start from the top row, the image is bottom-up
+    const BYTE* top = image->pixels + (SIZE_T)(image->height - 1) * image->width * 4;
+    LONG stride = -image->width * 4;
+
+    if (format == FORMAT_PNG) {
+        return PapaWritePng(top, image->width, image->height, stride, PNG_LEVEL, AppendToVector, payload);
+    }
+    if (format == FORMAT_QOI) {
+        return PapaWriteQoi(top, image->width, image->height, stride, AppendToVector, payload);
+    }
+
+    payload->resize((SIZE_T)image->width * image->height * 4);
+    for (LONG y = 0; y < image->height; y++) {
+        memcpy(&(*payload)[(SIZE_T)y * image->width * 4], top + (LONG64)y * stride, (SIZE_T)image->width * 4);
+    }
+    return S_OK;
+}
+
+static HRESULT GetThumbnail(const CHAR* path, UINT cx, OUTPUT_FORMAT format, std::shared_ptr<const THUMBNAIL>* thumbnail)
+{
+    FILE_STAMP stamp;
+    HRESULT result = GetFileStamp(path, &stamp);
+    if (FAILED(result)) {
+        return result;
+    }
+
+    std::string key = std::to_string(cx) + g_formatNames[format] + path;
+    *thumbnail = g_thumbnails.Find(key, stamp);
+    if (*thumbnail) {
+        return S_OK;
+    }
+
+    std::shared_ptr<const SCALED> scaled;
+    result = GetScaled(path, stamp, cx, &scaled);
+    if (FAILED(result)) {
+        return result;
+    }
+
+    std::shared_ptr<THUMBNAIL> rendered = std::make_shared<THUMBNAIL>();
+    rendered->width = (ULONG)scaled->width;
+    rendered->height = (ULONG)scaled->height;
+    PAPA_IMAGE image = { (BYTE*)scaled->pixels.data(), scaled->width, scaled->height };
+    result = Encode(&image, format, &rendered->payload);
+    if (FAILED(result)) {
+        return result;
+    }
+
+    g_thumbnails.Insert(key, stamp, rendered, rendered->payload.size() + key.size());
+    *thumbnail = rendered;
+    return S_OK;
+}
+
+static BOOL SendAll(int fd, const BYTE* data, SIZE_T size)
+{
+    while (size > 0) {
+        ssize_t sent = send(fd, data, size, MSG_NOSIGNAL);
+        if (sent < 0 && errno == EINTR) {
+            continue;
+        }
+        if (sent <= 0) {
+            return FALSE;
+        }
+        data += sent;
+        size -= (SIZE_T)sent;
+    }
+    return TRUE;
+}
+
+static BOOL RecvAll(int fd, BYTE* data, SIZE_T size)
+{
+    while (size > 0) {
+        ssize_t got = recv(fd, data, size, 0);
+        if (got < 0 && errno == EINTR) {
+            continue;
+        }
+        if (got <= 0) {
+            return FALSE;
+        }
+        data += got;
+        size -= (SIZE_T)got;
+    }
+    return TRUE;
+}
+
+// "<cx> <format> <path>", the path runs to the end of the line and may hold spaces
+static HRESULT ParseRequest(CHAR* line, UINT* cx, OUTPUT_FORMAT* format, const CHAR** path)
+{
+    CHAR* end;
+    ULONG size = strtoul(line, &end, 10);
+    if (end == line || *end != ' ' || size == 0 || size > 0xFFFF) {
+        return E_INVALIDARG;
+    }
+    *cx = (UINT)size;
+
+    CHAR* name = end + 1;
+    CHAR* space = strchr(name, ' ');
+    if (space == NULL || space[1] == '\0') {
+        return E_INVALIDARG;
+    }
+    *space = '\0';
+    *path = space + 1;
+
+    for (UINT i = 0; i < sizeof(g_formatNames) / sizeof(g_formatNames[0]); i++) {
+        if (strcmp(name, g_formatNames[i]) == 0) {
+            *format = (OUTPUT_FORMAT)i;
+            return S_OK;
+        }
+    }
+    return E_INVALIDARG;
+}
+
+static VOID ServeConnection(int fd)
+{
+    std::vector<CHAR> pending;
+    CHAR buffer[MAX_REQUEST_LINE];
+
+    for (;;) {
+        ssize_t got = recv(fd, buffer, sizeof(buffer), 0);
+        if (got < 0 && errno == EINTR) {
+            continue;
+        }
+        if (got <= 0) {
+            break;
+        }
+        pending.insert(pending.end(), buffer, buffer + got);
+
+        std::vector<CHAR>::iterator newline;
+        BOOL ok = TRUE;
+        while (ok && (newline = std::find(pending.begin(), pending.end(), '\n')) != pending.end()) {
+            std::string line(pending.begin(), newline);
+            pending.erase(pending.begin(), newline + 1);
+
+            UINT cx;
+            OUTPUT_FORMAT format;
+            const CHAR* path;
+            std::shared_ptr<const THUMBNAIL> thumbnail;
+            PAPA_DAEMON_REPLY reply = {};
+
+            reply.status = ParseRequest(&line[0], &cx, &format, &path);
+            if (SUCCEEDED(reply.status)) {
+                reply.status = GetThumbnail(path, cx, format, &thumbnail);
+            }
+            if (SUCCEEDED(reply.status)) {
+                reply.width = thumbnail->width;
+                reply.height = thumbnail->height;
+                reply.size = (ULONG)thumbnail->payload.size();
+            }
+
+            ok = SendAll(fd, (const BYTE*)&reply, sizeof(reply));
+            if (ok && reply.size > 0) {
+                ok = SendAll(fd, thumbnail->payload.data(), reply.size);
+            }
+        }
+
+        if (!ok || pending.size() > MAX_REQUEST_LINE) {
+            break;
+        }
+    }
+    close(fd);
+}
+
+static VOID HandleTerminate(int)
+{
+    unlink(g_socketPath);
+    _exit(0);
+}
+
+static int ConnectTo(const CHAR* path)
+{
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) {
+        return -1;
+    }
+    sockaddr_un address = {};
+    address.sun_family = AF_UNIX;
+    strncpy(address.sun_path, path, sizeof(address.sun_path) - 1);
+    if (connect(fd, (sockaddr*)&address, sizeof(address)) != 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+static int Serve(const CHAR* path, UINT threads, SIZE_T cacheBytes)
+{
+    // a socket file left behind by a daemon that died is fine to replace, a live one isn't
+    int existing = ConnectTo(path);
+    if (existing >= 0) {
+        close(existing);
+        fprintf(stderr, "papa-thumbd: already running on %s\n", path);
+        return 1;
+    }
+    unlink(path);
+
+    int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+    sockaddr_un address = {};
+    address.sun_family = AF_UNIX;
+    strncpy(address.sun_path, path, sizeof(address.sun_path) - 1);
+
+    umask(077); // only the owner may connect
+    if (listener < 0 || bind(listener, (sockaddr*)&address, sizeof(address)) != 0 || listen(listener, SOMAXCONN) != 0) {
+        fprintf(stderr, "papa-thumbd: can't listen on %s: %s\n", path, strerror(errno));
+        return 1;
+    }
+
+    strncpy(g_socketPath, path, sizeof(g_socketPath) - 1);
+    signal(SIGPIPE, SIG_IGN);
+    signal(SIGINT, HandleTerminate);
+    signal(SIGTERM, HandleTerminate);
+
+    // textures are the bigger win on a size change, thumbnails on a repeat
+    g_scaled.SetBudget(cacheBytes / 2);
+    g_thumbnails.SetBudget(cacheBytes / 2);
+    g_scheduler = new PapaScheduler(threads);
+
+    for (;;) {
+        int fd = accept(listener, NULL, NULL);
+        if (fd < 0) {
+            if (errno == EINTR || errno == ECONNABORTED) {
+                continue;
+            }
+            fprintf(stderr, "papa-thumbd: accept failed: %s\n", strerror(errno));
+            return 1;
+        }
+        std::thread(ServeConnection, fd).detach();
+    }
+}
+
+static int Query(const CHAR* path, int argc, CHAR** argv)
+{
+    if (argc != 3) {
+        fprintf(stderr, "usage: papa-thumbd -q [-s socket] cx raw|png|qoi path\n");
+        return 2;
+    }
+
+    int fd = ConnectTo(path);
+    if (fd < 0) {
+        fprintf(stderr, "papa-thumbd: can't connect to %s\n", path);
+        return 1;
+    }
+
+    std::string request = std::string(argv[0]) + " " + argv[1] + " " + argv[2] + "\n";
+    PAPA_DAEMON_REPLY reply;
+    if (!SendAll(fd, (const BYTE*)request.data(), request.size()) || !RecvAll(fd, (BYTE*)&reply, sizeof(reply))) {
+        fprintf(stderr, "papa-thumbd: connection lost\n");
+        close(fd);
+        return 1;
+    }
+
+    std::vector<BYTE> payload(reply.size);
+    BOOL ok = reply.size == 0 || RecvAll(fd, payload.data(), payload.size());
+    close(fd);
+    if (!ok || FAILED(reply.status)) {
+        fprintf(stderr, "papa-thumbd: %s failed (0x%08x)\n", argv[2], (unsigned)reply.status);
+        return 1;
+    }
+
+    fwrite(payload.data(), 1, payload.size(), stdout);
+    fprintf(stderr, "%ux%u\n", reply.width, reply.height);
+    return 0;
+}
+
+int main(int argc, CHAR** argv)
+{
+    std::string path;
+    const CHAR* runtime = getenv("XDG_RUNTIME_DIR");
+    if (runtime != NULL && runtime[0] != '\0') {
+        path = std::string(runtime) + "/papa-thumbd.sock";
+    } else {
+        path = "/tmp/papa-thumbd-" + std::to_string(getuid()) + ".sock";
+    }
+
+    BOOL query = FALSE;
+    UINT threads = 0;
+    SIZE_T cacheMB = DEFAULT_CACHE_MB;
+    int opt;
+    while ((opt = getopt(argc, argv, "qs:j:m:")) != -1) {
+        switch (opt) {
+        case 'q':
+            query = TRUE;
+            break;
+        case 's':
+            path = optarg;
+            break;
+        case 'j':
+            threads = (UINT)atoi(optarg);
+            break;
+        case 'm':
+            cacheMB = (SIZE_T)atol(optarg);
+            break;
+        default:
+            fprintf(stderr, "usage: papa-thumbd [-s socket] [-j threads] [-m cacheMB]\n"
+                            "       papa-thumbd -q [-s socket] cx raw|png|qoi path\n");
+            return 2;
+        }
+    }
+
+    if (path.size() >= sizeof(g_socketPath)) {
+        fprintf(stderr, "papa-thumbd: socket path too long\n");
+        return 2;
+    }
+
+    if (query) {
+        return Query(path.c_str(), argc - optind, argv + optind);
+    }
+    return Serve(path.c_str(), threads, cacheMB * 1024 * 1024);
+}
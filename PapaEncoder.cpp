@@ -0,0 +1,743 @@
+// The MIT License
+// 
+// Copyright (c) 2022     Marcus Der      marcusder@hotmail.com
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#include <stdlib.h>
+#include <string.h>
+#include "PapaEncoder.h"
+
+#define SINK_CAPACITY 65536
+
+#define DEFLATE_WINDOW 32768
+#define DEFLATE_BUFFER (2 * DEFLATE_WINDOW)
+#define DEFLATE_MIN_MATCH 3
+#define DEFLATE_MAX_MATCH 258
+#define DEFLATE_HASH_BITS 15
+#define DEFLATE_HASH_SIZE (1 << DEFLATE_HASH_BITS)
+#define DEFLATE_STORED_BLOCK 65535
+#define DEFLATE_END_OF_BLOCK 256
+
+HRESULT PapaWriteToFile(VOID* context, const BYTE* data, SIZE_T size)
+{
+    return fwrite(data, 1, size, (FILE*)context) == size ? S_OK : E_FAIL;
+}
+
+static VOID PutBigEndian(BYTE* dst, ULONG value)
+{
+    dst[0] = (BYTE)(value >> 24);
+    dst[1] = (BYTE)(value >> 16);
+    dst[2] = (BYTE)(value >> 8);
+    dst[3] = (BYTE)value;
+}
+
+PapaByteSink::PapaByteSink() : _used(0), _write(NULL), _context(NULL)
+{
+    _data = (BYTE*)malloc(SINK_CAPACITY);
+    _capacity = _data ? SINK_CAPACITY : 0;
+    _hr = _data ? S_OK : E_OUTOFMEMORY;
+}
+
+PapaByteSink::~PapaByteSink()
+{
+    free(_data);
+}
+
+VOID PapaByteSink::Reset(PAPA_WRITE_PROC write, VOID* context)
+{
+    if (_data == NULL) {
+        _data = (BYTE*)malloc(SINK_CAPACITY);
+        _capacity = _data ? SINK_CAPACITY : 0;
+    }
+    _write = write;
+    _context = context;
+    _used = 0;
+    _hr = _data ? S_OK : E_OUTOFMEMORY;
+}
+
+HRESULT PapaByteSink::Flush()
+{
+    if (FAILED(_hr)) {
+        return _hr;
+    }
+    if (_used) {
+        _hr = _write(_context, _data, _used);
+    }
+    if (SUCCEEDED(_hr)) {
+        _used = 0;
+    }
+    return _hr;
+}
+
+HRESULT PapaByteSink::Put(const BYTE* data, SIZE_T size)
+{
+    while (size && SUCCEEDED(_hr)) {
+        if (_used == _capacity && FAILED(Flush())) {
+            return _hr;
+        }
+        SIZE_T count = min(size, _capacity - _used);
+        memcpy(_data + _used, data, count);
+        _used += count;
+        data += count;
+        size -= count;
+    }
+    return _hr;
+}
+
+// bit reversed fixed Huffman codes, with the extra bits of lengths and distances already appended
+struct DEFLATE_TABLES
+{
+    USHORT literalCode[DEFLATE_END_OF_BLOCK + 1];
+    BYTE literalBits[DEFLATE_END_OF_BLOCK + 1];
+    ULONG lengthCode[DEFLATE_MAX_MATCH + 1];
+    BYTE lengthBits[DEFLATE_MAX_MATCH + 1];
+    BYTE distanceSymbol[512];
+    BYTE distanceCode[30];
+    ULONG32 crc[256];
+
+    static UINT Reverse(UINT code, UINT bits)
+    {
+        UINT result = 0;
+        for (UINT i = 0; i < bits; i++) {
+            result = (result << 1) | ((code >> i) & 1);
+        }
+        return result;
+    }
+
+    DEFLATE_TABLES()
+    {
+        static const USHORT lengthBase[29] = { 3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31, 35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258 };
+        static const BYTE lengthExtra[29] = { 0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0 };
+
+        for (UINT i = 0; i <= DEFLATE_END_OF_BLOCK; i++) {
+            if (i < 144) {
+                literalCode[i] = (USHORT)Reverse(0x30 + i, 8);
+                literalBits[i] = 8;
+            } else if (i < 256) {
+                literalCode[i] = (USHORT)Reverse(0x190 + i - 144, 9);
+                literalBits[i] = 9;
+            } else {
+                literalCode[i] = 0; // symbol 256 is 7 zero bits
+                literalBits[i] = 7;
+            }
+        }
+
+        for (UINT symbol = 0; symbol < 29; symbol++) {
+            UINT code = 257 + symbol; // 257 to 279 are 7 bits, 280 and up 8 bits
+            UINT bits = code < 280 ? 7 : 8;
+            UINT reversed = code < 280 ? Reverse(code - 256, 7) : Reverse(0xC0 + code - 280, 8);
+            UINT last = symbol == 28 ? 258 : min((UINT)(lengthBase[symbol] + (1 << lengthExtra[symbol]) - 1), 257u);
+            for (UINT length = lengthBase[symbol]; length <= last; length++) {
+                lengthCode[length] = reversed | ((length - lengthBase[symbol]) << bits);
+                lengthBits[length] = (BYTE)(bits + lengthExtra[symbol]);
+            }
+        }
+
+        // same layout as zlib: distance - 1 below 256 indexes directly, the rest by (distance - 1) >> 7
+        static const BYTE distanceExtra[30] = { 0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13 };
+        UINT distance = 0;
+        UINT symbol = 0;
+        memset(distanceSymbol, 0, sizeof(distanceSymbol));
+        for (; symbol < 16; symbol++) {
+            for (UINT n = 0; n < (1u << distanceExtra[symbol]); n++) {
+                distanceSymbol[distance++] = (BYTE)symbol;
+            }
+        }
+        distance >>= 7;
+        for (; symbol < 30; symbol++) {
+            for (UINT n = 0; n < (1u << (distanceExtra[symbol] - 7)); n++) {
+                distanceSymbol[256 + distance++] = (BYTE)symbol;
+            }
+        }
+
+        for (UINT i = 0; i < 30; i++) {
+            distanceCode[i] = (BYTE)Reverse(i, 5);
+        }
+
+        for (ULONG32 n = 0; n < 256; n++) {
+            ULONG32 c = n;
+            for (UINT k = 0; k < 8; k++) {
+                c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+            }
+            crc[n] = c;
+        }
+    }
+};
+
+static const DEFLATE_TABLES& GetDeflateTables()
+{
+    static const DEFLATE_TABLES tables;
+    return tables;
+}
+
+static const USHORT g_distanceBase[30] = { 1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193, 257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577 };
+static const BYTE g_distanceExtra[30] = { 0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13 };
+
+static ULONG32 Crc32(ULONG32 crc, const BYTE* data, SIZE_T size)
+{
+    const ULONG32* table = GetDeflateTables().crc;
+    crc = ~crc;
+    for (SIZE_T i = 0; i < size; i++) {
+        crc = table[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+    }
+    return ~crc;
+}
+
+PapaDeflater::PapaDeflater() : _level(0), _probes(0), _window(NULL), _head(NULL), _prev(NULL), _pos(0), _end(0), _bits(0), _bitCount(0), _adlerA(1), _adlerB(0)
+{
+}
+
+PapaDeflater::~PapaDeflater()
+{
+    free(_window);
+    free(_head);
+    free(_prev);
+}
+
+inline VOID PapaDeflater::PutBits(ULONG value, UINT count)
+{
+    _bits |= (ULONG64)value << _bitCount;
+    _bitCount += count;
+    if (_bitCount >= 32) {
+        _sink.PutByte((BYTE)_bits);
+        _sink.PutByte((BYTE)(_bits >> 8));
+        _sink.PutByte((BYTE)(_bits >> 16));
+        _sink.PutByte((BYTE)(_bits >> 24));
+        _bits >>= 32;
+        _bitCount -= 32;
+    }
+}
+
+VOID PapaDeflater::FlushBits()
+{
+    while (_bitCount > 0) {
+        _sink.PutByte((BYTE)_bits);
+        _bits >>= 8;
+        _bitCount = _bitCount > 8 ? _bitCount - 8 : 0;
+    }
+    _bits = 0;
+}
+
+HRESULT PapaDeflater::Begin(UINT level, PAPA_WRITE_PROC write, VOID* context)
+{
+    GetDeflateTables();
+
+    if (_window == NULL) {
+        _window = (BYTE*)malloc(DEFLATE_BUFFER);
+        _head = (LONG*)malloc(DEFLATE_HASH_SIZE * sizeof(LONG));
+        _prev = (LONG*)malloc(DEFLATE_WINDOW * sizeof(LONG));
+        if (_window == NULL || _head == NULL || _prev == NULL) {
+            free(_window);
+            free(_head);
+            free(_prev);
+            _window = NULL;
+            _head = NULL;
+            _prev = NULL;
+            return E_OUTOFMEMORY;
+        }
+    }
+
+    _level = min(level, 3u);
+    _probes = _level == 1 ? 1 : _level == 2 ? 8 : 32;
+    _pos = 0;
+    _end = 0;
+    _bits = 0;
+    _bitCount = 0;
+    _adlerA = 1;
+    _adlerB = 0;
+    memset(_head, 0xFF, DEFLATE_HASH_SIZE * sizeof(LONG));
+    memset(_prev, 0xFF, DEFLATE_WINDOW * sizeof(LONG));
+
+    _sink.Reset(write, context);
+    _sink.PutByte(0x78); // 32K window, deflate
+    _sink.PutByte(0x01);
+    if (_level > 0) {
+        PutBits(1 | (1 << 1), 3); // the only block: final, fixed Huffman
+    }
+    return _sink.GetResult();
+}
+
+VOID PapaDeflater::StoreBlock(BOOL final)
+{
+    PutBits(final ? 1 : 0, 3);
+    FlushBits();
+    _sink.PutByte((BYTE)_end);
+    _sink.PutByte((BYTE)(_end >> 8));
+    _sink.PutByte((BYTE)~_end);
+    _sink.PutByte((BYTE)(~_end >> 8));
+    _sink.Put(_window, _end);
+    _end = 0;
+}
+
+static inline UINT DeflateHash(const BYTE* p)
+{
+    return ((p[0] | (p[1] << 8) | (p[2] << 16)) * 2654435761u) >> (32 - DEFLATE_HASH_BITS);
+}
+
+VOID PapaDeflater::Compress(BOOL flush)
+{
+    const DEFLATE_TABLES& tables = GetDeflateTables();
+
+    // without flush, keep a full match worth of lookahead for when more input arrives
+    UINT limit = flush ? _end : (_end > DEFLATE_MAX_MATCH ? _end - DEFLATE_MAX_MATCH : 0);
+
+    while (_pos < limit) {
+        UINT avail = _end - _pos;
+        UINT bestLength = 0;
+        UINT bestDistance = 0;
+
+        if (avail >= DEFLATE_MIN_MATCH) {
+            BYTE* current = _window + _pos;
+            UINT maxLength = min(avail, (UINT)DEFLATE_MAX_MATCH);
+            UINT hash = DeflateHash(current);
+            LONG candidate = _head[hash];
+
+            for (UINT probe = 0; candidate >= 0 && probe < _probes; probe++) {
+                UINT distance = _pos - (UINT)candidate;
+                if (distance > DEFLATE_WINDOW) {
+                    break;
+                }
+
+                BYTE* match = _window + candidate;
+                if (match[bestLength] == current[bestLength]) {
+                    UINT length = 0;
+                    while (length < maxLength && match[length] == current[length]) {
+                        length++;
+                    }
+                    if (length > bestLength) {
+                        bestLength = length;
+                        bestDistance = distance;
+                        if (length == maxLength) {
+                            break;
+                        }
+                    }
+                }
+
+                // chains only ever point backwards, anything else is a slot reused by a newer position
+                LONG next = _prev[candidate & (DEFLATE_WINDOW - 1)];
+                if (next >= candidate) {
+                    break;
+                }
+                candidate = next;
+            }
+
+            _prev[_pos & (DEFLATE_WINDOW - 1)] = _head[hash];
+            _head[hash] = (LONG)_pos;
+        }
+
+        if (bestLength >= DEFLATE_MIN_MATCH) {
+            PutBits(tables.lengthCode[bestLength], tables.lengthBits[bestLength]);
+
+            UINT d = bestDistance - 1;
+            UINT symbol = d < 256 ? tables.distanceSymbol[d] : tables.distanceSymbol[256 + (d >> 7)];
+            PutBits(tables.distanceCode[symbol] | ((bestDistance - g_distanceBase[symbol]) << 5), 5 + g_distanceExtra[symbol]);
+
+            for (UINT i = 1; i < bestLength; i++) {
+                UINT position = _pos + i;
+                if (position + DEFLATE_MIN_MATCH <= _end) {
+                    UINT hash = DeflateHash(_window + position);
+                    _prev[position & (DEFLATE_WINDOW - 1)] = _head[hash];
+                    _head[hash] = (LONG)position;
+                }
+            }
+            _pos += bestLength;
+        } else {
+            BYTE literal = _window[_pos++];
+            PutBits(tables.literalCode[literal], tables.literalBits[literal]);
+        }
+    }
+}
+
+HRESULT PapaDeflater::Write(const BYTE* data, SIZE_T size)
+{
+    // adler32, deferring the modulo for as long as the sums can't overflow
+    const BYTE* adlerData = data;
+    SIZE_T adlerSize = size;
+    while (adlerSize) {
+        SIZE_T count = min(adlerSize, (SIZE_T)5552);
+        for (SIZE_T i = 0; i < count; i++) {
+            _adlerA += adlerData[i];
+            _adlerB += _adlerA;
+        }
+        _adlerA %= 65521;
+        _adlerB %= 65521;
+        adlerData += count;
+        adlerSize -= count;
+    }
+
+    while (size && SUCCEEDED(_sink.GetResult())) {
+        if (_level == 0) {
+            UINT count = (UINT)min(size, (SIZE_T)(DEFLATE_STORED_BLOCK - _end));
+            memcpy(_window + _end, data, count);
+            _end += count;
+            data += count;
+            size -= count;
+            if (_end == DEFLATE_STORED_BLOCK) {
+                StoreBlock(FALSE);
+            }
+            continue;
+        }
+
+        UINT count = (UINT)min(size, (SIZE_T)(DEFLATE_BUFFER - _end));
+        memcpy(_window + _end, data, count);
+        _end += count;
+        data += count;
+        size -= count;
+        Compress(FALSE);
+
+        if (_end == DEFLATE_BUFFER) {
+            // slide the window down, Compress always leaves _pos past the first half here
+            memmove(_window, _window + DEFLATE_WINDOW, _end - DEFLATE_WINDOW);
+            _pos -= DEFLATE_WINDOW;
+            _end -= DEFLATE_WINDOW;
+            for (UINT i = 0; i < DEFLATE_HASH_SIZE; i++) {
+                _head[i] = _head[i] >= DEFLATE_WINDOW ? _head[i] - DEFLATE_WINDOW : -1;
+            }
+            for (UINT i = 0; i < DEFLATE_WINDOW; i++) {
+                _prev[i] = _prev[i] >= DEFLATE_WINDOW ? _prev[i] - DEFLATE_WINDOW : -1;
+            }
+        }
+    }
+    return _sink.GetResult();
+}
+
+HRESULT PapaDeflater::End()
+{
+    if (_level == 0) {
+        StoreBlock(TRUE);
+    } else {
+        Compress(TRUE);
+        PutBits(GetDeflateTables().literalCode[DEFLATE_END_OF_BLOCK], GetDeflateTables().literalBits[DEFLATE_END_OF_BLOCK]);
+        FlushBits();
+    }
+
+    BYTE adler[4];
+    PutBigEndian(adler, (_adlerB << 16) | _adlerA);
+    _sink.Put(adler, 4);
+    return _sink.Flush();
+}
+
+PapaPngWriter::PapaPngWriter() : _write(NULL), _context(NULL), _width(0), _level(0), _idat(FALSE), _row(NULL), _prevRow(NULL), _filtered(NULL), _candidate(NULL)
+{
+}
+
+PapaPngWriter::~PapaPngWriter()
+{
+    free(_row);
+    free(_prevRow);
+    free(_filtered);
+    free(_candidate);
+}
+
+HRESULT PapaPngWriter::WriteChunk(const CHAR type[4], const BYTE* data, ULONG size)
+{
+    BYTE header[8];
+    PutBigEndian(header, size);
+    memcpy(header + 4, type, 4);
+
+    BYTE crc[4];
+    PutBigEndian(crc, Crc32(Crc32(0, header + 4, 4), data, size));
+
+    HRESULT hr = _write(_context, header, 8);
+    if (SUCCEEDED(hr) && size) {
+        hr = _write(_context, data, size);
+    }
+    if (SUCCEEDED(hr)) {
+        hr = _write(_context, crc, 4);
+    }
+    return hr;
+}
+
+HRESULT PapaPngWriter::WriteIdat(VOID* context, const BYTE* data, SIZE_T size)
+{
+    PapaPngWriter* writer = (PapaPngWriter*)context;
+    writer->_idat = TRUE;
+    return writer->WriteChunk("IDAT", data, (ULONG)size);
+}
+
+HRESULT PapaPngWriter::Begin(PAPA_WRITE_PROC write, VOID* context, ULONG width, ULONG height, UINT level)
+{
+    if (width == 0 || height == 0 || width > 0x3FFFFFFF / 4) {
+        return E_INVALIDARG;
+    }
+
+    free(_row);
+    free(_prevRow);
+    free(_filtered);
+    free(_candidate);
+    SIZE_T rowSize = (SIZE_T)width * 4;
+    _row = (BYTE*)malloc(rowSize);
+    _prevRow = (BYTE*)calloc(rowSize, 1);
+    _filtered = (BYTE*)malloc(rowSize + 1);
+    _candidate = (BYTE*)malloc(rowSize + 1);
+    if (_row == NULL || _prevRow == NULL || _filtered == NULL || _candidate == NULL) {
+        return E_OUTOFMEMORY;
+    }
+
+    _write = write;
+    _context = context;
+    _width = width;
+    _level = level;
+    _idat = FALSE;
+
+    static const BYTE signature[8] = { 137, 80, 78, 71, 13, 10, 26, 10 };
+    HRESULT hr = _write(_context, signature, 8);
+    if (FAILED(hr)) {
+        return hr;
+    }
+
+    BYTE ihdr[13];
+    PutBigEndian(ihdr, width);
+    PutBigEndian(ihdr + 4, height);
+    ihdr[8] = 8;    // bits per channel
+    ihdr[9] = 6;    // RGBA
+    ihdr[10] = 0;   // deflate
+    ihdr[11] = 0;   // adaptive filtering
+    ihdr[12] = 0;   // not interlaced
+    hr = WriteChunk("IHDR", ihdr, 13);
+    if (FAILED(hr)) {
+        return hr;
+    }
+
+    return _deflater.Begin(level, WriteIdat, this);
+}
+
+HRESULT PapaPngWriter::WriteText(const CHAR* keyword, const CHAR* text)
+{
+    SIZE_T keywordLength = strlen(keyword);
+    SIZE_T textLength = strlen(text);
+    if (keywordLength == 0 || keywordLength > 79 || textLength > 0xFFFF) {
+        return E_INVALIDARG;
+    }
+
+    // until the deflater's sink first flushes, the zlib header and any rows are still held
+    // in it and this chunk lands ahead of the first IDAT. after that it would split them
+    if (_write == NULL || _idat) {
+        return E_UNEXPECTED;
+    }
+    BYTE* chunk = (BYTE*)malloc(keywordLength + 1 + textLength);
+    if (chunk == NULL) {
+        return E_OUTOFMEMORY;
+    }
+    memcpy(chunk, keyword, keywordLength + 1); // keyword and its separating zero
+    memcpy(chunk + keywordLength + 1, text, textLength);
+    HRESULT hr = WriteChunk("tEXt", chunk, (ULONG)(keywordLength + 1 + textLength));
+    free(chunk);
+    return hr;
+}
+
+static inline BYTE Paeth(BYTE a, BYTE b, BYTE c)
+{
+    INT p = a + b - c;
+    INT pa = abs(p - a);
+    INT pb = abs(p - b);
+    INT pc = abs(p - c);
+    if (pa <= pb && pa <= pc) {
+        return a;
+    }
+    return pb <= pc ? b : c;
+}
+
+// applies one PNG filter and returns the sum of the residuals as signed bytes, the usual
+// heuristic for which filter will compress best
+static ULONG FilterRow(BYTE type, const BYTE* row, const BYTE* prev, SIZE_T size, BYTE* out)
+{
+    ULONG score = 0;
+    out[0] = type;
+    out++;
+
+    for (SIZE_T i = 0; i < size; i++) {
+        BYTE left = i >= 4 ? row[i - 4] : 0;
+        BYTE upLeft = i >= 4 ? prev[i - 4] : 0;
+        BYTE predicted = type == 1 ? left : type == 2 ? prev[i] : type == 4 ? Paeth(left, prev[i], upLeft) : 0;
+        BYTE value = (BYTE)(row[i] - predicted);
+        out[i] = value;
+        score += (ULONG)abs((signed char)value);
+    }
+    return score;
+}
+
+HRESULT PapaPngWriter::WriteRow(const BYTE* bgra)
+{
+    SIZE_T rowSize = (SIZE_T)_width * 4;
+    for (SIZE_T i = 0; i < rowSize; i += 4) {
+        _row[i] = bgra[i + 2];
+        _row[i + 1] = bgra[i + 1];
+        _row[i + 2] = bgra[i];
+        _row[i + 3] = bgra[i + 3];
+    }
+
+    if (_level == 0) {
+        _filtered[0] = 0;
+        memcpy(_filtered + 1, _row, rowSize);
+    } else if (_level == 1) {
+        FilterRow(1, _row, _prevRow, rowSize, _filtered);
+    } else {
+        ULONG best = FilterRow(1, _row, _prevRow, rowSize, _filtered);
+        static const BYTE others[2] = { 2, 4 }; // Up, Paeth
+        for (UINT i = 0; i < 2; i++) {
+            ULONG score = FilterRow(others[i], _row, _prevRow, rowSize, _candidate);
+            if (score < best) {
+                best = score;
+                BYTE* t = _filtered;
+                _filtered = _candidate;
+                _candidate = t;
+            }
+        }
+    }
+
+    BYTE* t = _prevRow;
+    _prevRow = _row;
+    _row = t;
+
+    return _deflater.Write(_filtered, rowSize + 1);
+}
+
+HRESULT PapaPngWriter::End()
+{
+    HRESULT hr = _deflater.End();
+    if (SUCCEEDED(hr)) {
+        hr = WriteChunk("IEND", NULL, 0);
+    }
+    return hr;
+}
+
+#define QOI_OP_INDEX 0x00
+#define QOI_OP_DIFF 0x40
+#define QOI_OP_LUMA 0x80
+#define QOI_OP_RUN 0xC0
+#define QOI_OP_RGB 0xFE
+#define QOI_OP_RGBA 0xFF
+
+PapaQoiWriter::PapaQoiWriter() : _width(0), _previous(0), _run(0)
+{
+    memset(_index, 0, sizeof(_index));
+}
+
+HRESULT PapaQoiWriter::Begin(PAPA_WRITE_PROC write, VOID* context, ULONG width, ULONG height)
+{
+    if (width == 0 || height == 0) {
+        return E_INVALIDARG;
+    }
+
+    _sink.Reset(write, context);
+    _width = width;
+    _previous = 0xFF000000;
+    _run = 0;
+    memset(_index, 0, sizeof(_index));
+
+    BYTE header[14] = { 'q', 'o', 'i', 'f' };
+    PutBigEndian(header + 4, width);
+    PutBigEndian(header + 8, height);
+    header[12] = 4; // RGBA
+    header[13] = 0; // sRGB with linear alpha
+    return _sink.Put(header, sizeof(header));
+}
+
+HRESULT PapaQoiWriter::WriteRow(const BYTE* bgra)
+{
+    for (ULONG x = 0; x < _width; x++, bgra += 4) {
+        BYTE r = bgra[2];
+        BYTE g = bgra[1];
+        BYTE b = bgra[0];
+        BYTE a = bgra[3];
+        ULONG32 pixel = r | (g << 8) | (b << 16) | ((ULONG32)a << 24);
+
+        if (pixel == _previous) {
+            if (++_run == 62) {
+                _sink.PutByte((BYTE)(QOI_OP_RUN | (_run - 1)));
+                _run = 0;
+            }
+            continue;
+        }
+
+        if (_run) {
+            _sink.PutByte((BYTE)(QOI_OP_RUN | (_run - 1)));
+            _run = 0;
+        }
+
+        UINT hash = (r * 3 + g * 5 + b * 7 + a * 11) & 63;
+        if (_index[hash] == pixel) {
+            _sink.PutByte((BYTE)(QOI_OP_INDEX | hash));
+        } else {
+            _index[hash] = pixel;
+
+            if (a == (BYTE)(_previous >> 24)) {
+                signed char dr = (signed char)(r - (BYTE)_previous);
+                signed char dg = (signed char)(g - (BYTE)(_previous >> 8));
+                signed char db = (signed char)(b - (BYTE)(_previous >> 16));
+                INT drg = dr - dg;
+                INT dbg = db - dg;
+
+                if (dr > -3 && dr < 2 && dg > -3 && dg < 2 && db > -3 && db < 2) {
+                    _sink.PutByte((BYTE)(QOI_OP_DIFF | ((dr + 2) << 4) | ((dg + 2) << 2) | (db + 2)));
+                } else if (drg > -9 && drg < 8 && dg > -33 && dg < 32 && dbg > -9 && dbg < 8) {
+                    _sink.PutByte((BYTE)(QOI_OP_LUMA | (dg + 32)));
+                    _sink.PutByte((BYTE)(((drg + 8) << 4) | (dbg + 8)));
+                } else {
+                    _sink.PutByte(QOI_OP_RGB);
+                    _sink.PutByte(r);
+                    _sink.PutByte(g);
+                    _sink.PutByte(b);
+                }
+            } else {
+                _sink.PutByte(QOI_OP_RGBA);
+                _sink.PutByte(r);
+                _sink.PutByte(g);
+                _sink.PutByte(b);
+                _sink.PutByte(a);
+            }
+        }
+        _previous = pixel;
+    }
+    return _sink.GetResult();
+}
+
+HRESULT PapaQoiWriter::End()
+{
+    if (_run) {
+        _sink.PutByte((BYTE)(QOI_OP_RUN | (_run - 1)));
+        _run = 0;
+    }
+
+    static const BYTE padding[8] = { 0, 0, 0, 0, 0, 0, 0, 1 };
+    _sink.Put(padding, sizeof(padding));
+    return _sink.Flush();
+}
+
+HRESULT PapaWritePng(const BYTE* pixels, ULONG width, ULONG height, LONG stride, UINT level, PAPA_WRITE_PROC write, VOID* context)
+{
+    PapaPngWriter writer;
+    HRESULT hr = writer.Begin(write, context, width, height, level);
+    for (ULONG y = 0; y < height && SUCCEEDED(hr); y++) {
+        hr = writer.WriteRow(pixels + (LONG64)y * stride);
+    }
+    return SUCCEEDED(hr) ? writer.End() : hr;
+}
+
+HRESULT PapaWriteQoi(const BYTE* pixels, ULONG width, ULONG height, LONG stride, PAPA_WRITE_PROC write, VOID* context)
+{
+    PapaQoiWriter writer;
+    HRESULT hr = writer.Begin(write, context, width, height);
+    for (ULONG y = 0; y < height && SUCCEEDED(hr); y++) {
+        hr = writer.WriteRow(pixels + (LONG64)y * stride);
+    }
+    return SUCCEEDED(hr) ? writer.End() : hr;
+}
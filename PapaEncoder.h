@@ -0,0 +1,156 @@
+// The MIT License
+// 
+// Copyright (c) 2022     Marcus Der      marcusder@hotmail.com
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#pragma once
+
+#include <stdio.h>
+#include "PapaPlatform.h"
+
+// Output encoders for finished thumbnails. All of them take 32bpp BGRA rows, the layout
+// GetThumbnail hands back, and accept the image one row at a time from top to bottom so
+// a producer can stream rows out as soon as they are ready.
+
+// Receives encoded bytes, a failure aborts the encode.
+typedef HRESULT(*PAPA_WRITE_PROC)(VOID* context, const BYTE* data, SIZE_T size);
+
+// PAPA_WRITE_PROC for a FILE* opened in binary mode.
+HRESULT PapaWriteToFile(VOID* context, const BYTE* data, SIZE_T size);
+
+// Collects small writes and hands them to a PAPA_WRITE_PROC in large blocks. The first
+// failure sticks, every later call returns it and the bytes given after it are dropped.
+class PapaByteSink
+{
+public:
+    PapaByteSink();
+    ~PapaByteSink();
+
+    VOID Reset(PAPA_WRITE_PROC write, VOID* context);
+    HRESULT Put(const BYTE* data, SIZE_T size);
+    HRESULT Flush();
+
+    inline VOID PutByte(BYTE value)
+    {
+        if (_used == _capacity && FAILED(Flush())) {
+            return;
+        }
+        _data[_used++] = value;
+    }
+
+    HRESULT GetResult() const
+    {
+        return _hr;
+    }
+
+private:
+    BYTE* _data;
+    SIZE_T _used;
+    SIZE_T _capacity;
+    PAPA_WRITE_PROC _write;
+    VOID* _context;
+    HRESULT _hr;
+};
+
+// Streaming zlib compressor built for speed rather than ratio. Level 0 only stores, level 1
+// and up emit a single fixed-Huffman block from a hash-chain matcher that looks at more
+// candidates as the level goes up (1 to 3).
+class PapaDeflater
+{
+public:
+    PapaDeflater();
+    ~PapaDeflater();
+
+    HRESULT Begin(UINT level, PAPA_WRITE_PROC write, VOID* context);
+    HRESULT Write(const BYTE* data, SIZE_T size);
+    HRESULT End();
+
+private:
+    VOID Compress(BOOL flush);
+    VOID StoreBlock(BOOL final);
+    inline VOID PutBits(ULONG value, UINT count);
+    VOID FlushBits();
+
+    PapaByteSink _sink;
+    UINT _level;
+    UINT _probes;
+    BYTE* _window;
+    LONG* _head;
+    LONG* _prev;
+    UINT _pos;          // next byte of _window to compress
+    UINT _end;          // bytes of _window filled
+    ULONG64 _bits;
+    UINT _bitCount;
+    ULONG _adlerA;
+    ULONG _adlerB;
+};
+
+class PapaPngWriter
+{
+public:
+    PapaPngWriter();
+    ~PapaPngWriter();
+
+    // level 0 stores, 1 uses the Sub filter and the quickest matcher, 2 and 3 pick the best
+    // of Sub, Up and Paeth per row and search harder
+    HRESULT Begin(PAPA_WRITE_PROC write, VOID* context, ULONG width, ULONG height, UINT level);
+    // a tEXt chunk, Latin-1 keyword and text. Only between Begin and the first row, once any
+    // image data has gone out it fails with E_UNEXPECTED
+    HRESULT WriteText(const CHAR* keyword, const CHAR* text);
+    HRESULT WriteRow(const BYTE* bgra);
+    HRESULT End();
+
+private:
+    static HRESULT WriteIdat(VOID* context, const BYTE* data, SIZE_T size);
+    HRESULT WriteChunk(const CHAR type[4], const BYTE* data, ULONG size);
+
+    PapaDeflater _deflater;
+    PAPA_WRITE_PROC _write;
+    VOID* _context;
+    ULONG _width;
+    UINT _level;
+    BOOL _idat;         // an IDAT chunk has been written, so no more text can go ahead of it
+    BYTE* _row;         // current row as RGBA
+    BYTE* _prevRow;     // previous row as RGBA, zero for the first row
+    BYTE* _filtered;    // filter type byte followed by the filtered row
+    BYTE* _candidate;
+};
+
+class PapaQoiWriter
+{
+public:
+    PapaQoiWriter();
+
+    HRESULT Begin(PAPA_WRITE_PROC write, VOID* context, ULONG width, ULONG height);
+    HRESULT WriteRow(const BYTE* bgra);
+    HRESULT End();
+
+private:
+    PapaByteSink _sink;
+    ULONG _width;
+    ULONG32 _index[64];
+    ULONG32 _previous;  // RGBA packed little endian, R in the low byte
+    UINT _run;
+};
+
+// Whole image helpers. stride is the byte offset between rows, pass the last row and a
+// negative stride to write a bottom-up DIB the right way up.
+HRESULT PapaWritePng(const BYTE* pixels, ULONG width, ULONG height, LONG stride, UINT level, PAPA_WRITE_PROC write, VOID* context);
+HRESULT PapaWriteQoi(const BYTE* pixels, ULONG width, ULONG height, LONG stride, PAPA_WRITE_PROC write, VOID* context);
@@ -0,0 +1,68 @@
+// The MIT License
+// 
+// Copyright (c) 2022     Marcus Der      marcusder@hotmail.com
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#include <ctype.h>
+#include <stdio.h>
+#include <algorithm>
+#include <filesystem>
+#include "PapaFiles.h"
+
+static BOOL IsPapaFile(const std::filesystem::path& path)
+{
+    std::string extension = path.extension().string();
+    std::transform(extension.begin(), extension.end(), extension.begin(), [](CHAR c) { return (CHAR)tolower((UCHAR)c); });
+    return extension == ".papa";
+}
+
+HRESULT PapaCollectFiles(CHAR** paths, INT count, std::vector<std::string>* files)
+{
+    HRESULT result = S_OK;
+
+    for (INT i = 0; i < count; i++) {
+        std::error_code error;
+        std::filesystem::path path(paths[i]);
+
+        if (!std::filesystem::is_directory(path, error)) {
+            if (std::filesystem::exists(path, error)) {
+                files->push_back(path.string());
+            } else {
+                fprintf(stderr, "%s: not found\n", paths[i]);
+                result = S_FALSE;
+            }
+            continue;
+        }
+
+        std::filesystem::recursive_directory_iterator it(path, std::filesystem::directory_options::skip_permission_denied, error);
+        for (; !error && it != std::filesystem::recursive_directory_iterator(); it.increment(error)) {
+            if (it->is_regular_file(error) && IsPapaFile(it->path())) {
+                files->push_back(it->path().string());
+            }
+        }
+        if (error) {
+            fprintf(stderr, "%s: %s\n", paths[i], error.message().c_str());
+            result = S_FALSE;
+        }
+    }
+
+    std::sort(files->begin(), files->end());
+    return result;
+}
@@ -0,0 +1,112 @@
+// The MIT License
+// 
+// Copyright (c) 2022     Marcus Der      marcusder@hotmail.com
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#pragma once
+
+// The pixel code that doesn't talk to the shell is also built off-Windows (batch tools,
+// servers). This supplies the handful of Win32 types and HRESULTs it uses there.
+
+#ifdef _WIN32
+
+#include <Windows.h>
+
+#else
+
+#include <stddef.h>
+#include <stdint.h>
+#include <type_traits>
+
+typedef uint8_t BYTE;
+typedef char CHAR;
+typedef unsigned char UCHAR;
+typedef int16_t SHORT;
+typedef uint16_t USHORT;
+typedef uint16_t WORD;
+typedef int INT;
+typedef unsigned int UINT;
+typedef int32_t LONG;
+typedef uint32_t ULONG;
+typedef uint32_t ULONG32;
+typedef uint32_t DWORD;
+typedef int64_t LONG64;
+typedef uint64_t ULONG64;
+typedef int64_t LONGLONG;
+typedef uint64_t ULONGLONG;
+typedef float FLOAT;
+typedef int BOOL;
+typedef void VOID;
+typedef void* LPVOID;
+typedef size_t SIZE_T;
+typedef int32_t HRESULT;
+
+#ifndef TRUE
+#define TRUE 1
+#endif
+#ifndef FALSE
+#define FALSE 0
+#endif
+
+#define S_OK            ((HRESULT)0)
+#define S_FALSE         ((HRESULT)1)
+#define E_NOTIMPL       ((HRESULT)0x80004001L)
+#define E_NOINTERFACE   ((HRESULT)0x80004002L)
+#define E_POINTER       ((HRESULT)0x80004003L)
+#define E_ABORT         ((HRESULT)0x80004004L)
+#define E_FAIL          ((HRESULT)0x80004005L)
+#define E_UNEXPECTED    ((HRESULT)0x8000FFFFL)
+#define E_ACCESSDENIED  ((HRESULT)0x80070005L)
+#define E_OUTOFMEMORY   ((HRESULT)0x8007000EL)
+#define E_INVALIDARG    ((HRESULT)0x80070057L)
+
+#define SUCCEEDED(hr)   (((HRESULT)(hr)) >= 0)
+#define FAILED(hr)      (((HRESULT)(hr)) < 0)
+
+// stand-ins for the windef.h min and max macros, with the same promotion rules
+template <class A, class B> inline auto min(A a, B b) -> typename std::decay<decltype(a < b ? a : b)>::type
+{
+    return a < b ? a : b;
+}
+
+template <class A, class B> inline auto max(A a, B b) -> typename std::decay<decltype(a > b ? a : b)>::type
+{
+    return a > b ? a : b;
+}
+
+#endif
+
+// SSE2 is part of every x64 target and the default for x86 builds
+#if defined(_M_X64) || defined(_M_IX86) || defined(__SSE2__)
+#define PAPA_SSE2 1
+#endif
+
+// F16C half conversion needs an AVX target (/arch:AVX, -mf16c), without one halves are
+// widened with SSE2 integer ops instead
+#if defined(__F16C__) || (defined(_MSC_VER) && defined(__AVX__))
+#define PAPA_F16C 1
+#endif
+
+// for kernels that must inline into their loop even when the compiler thinks them too big
+#ifdef _MSC_VER
+#define PAPA_FORCEINLINE __forceinline
+#else
+#define PAPA_FORCEINLINE inline __attribute__((always_inline))
+#endif
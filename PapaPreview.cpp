@@ -0,0 +1,466 @@
+// The MIT License
+// 
+// Copyright (c) 2022     Marcus Der      marcusder@hotmail.com
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+// papa-preview appends a small copy of each texture to its file as an extra texture entry,
+// tagged as described at PAPA_PREVIEW_MAGIC. GetThumbnail and PapaRenderThumbnail use it
+// instead of texture 0 whenever it is big enough for the size asked, which turns a thumbnail
+// of a multi-megabyte texture into a read of a few KB. Texture 0 and everything else in the
+// file stay where they were, the texture table is rewritten at the end of the file with the
+// preview as its last entry.
+//
+// POSIX only, build with:
+//   g++ -std=c++17 -O2 -pthread -o papa-preview PapaPreview.cpp PapaFiles.cpp PapaCore.cpp PapaAdaptive.cpp PapaColour.cpp PapaScheduler.cpp
+//
+//   papa-preview [-s size] [-r] [-j threads] paths...    add or refresh previews
+//   papa-preview -d [-j threads] paths...                 remove them again
+//
+//   -s  the preview's long side, 256 by default. Textures no bigger than that get none
+//   -r  store RGBA8888 rather than DXT1, or DXT5 for textures with alpha
+//
+// The preview is scaled in linear light. Running it again replaces a preview only when it is
+// stale or a different size, each replacement leaves the old one's bytes behind unused.
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <atomic>
+#include <string>
+#include <vector>
+#include "PapaCore.h"
+#include "PapaFiles.h"
+#include <unistd.h> // getopt
+
+#define DEFAULT_PREVIEW_SIZE 256
+#define TABLE_ALIGNMENT 16
+#define SCRATCH_KEEP_BYTES (64 * 1024 * 1024)
+
+#define FORMAT_RGBA8888 1
+#define FORMAT_DXT1 4
+#define FORMAT_DXT5 6
+
+struct PREVIEW_JOB
+{
+    const std::vector<std::string>* files;
+    LONG size;
+    BOOL rgba;
+    BOOL remove;
+    std::atomic<UINT> written;
+    std::atomic<UINT> current;
+    std::atomic<UINT> failed;
+};
+
+// the raw header and texture table, and where the preview sits in the table if there is one
+struct PAPA_LAYOUT
+{
+    BYTE header[PAPA_HEADER_SIZE];
+    std::vector<BYTE> table;
+    SHORT numTextures;
+    BOOL hasPreview;    // the last entry is a preview, current or not
+};
+
+static HRESULT ReadLayout(const PAPA_SOURCE* source, PAPA_LAYOUT* layout)
+{
+    if (FAILED(source->read(source->context, 0, layout->header, PAPA_HEADER_SIZE)) || memcmp(layout->header, "apaP", 4) != 0) {
+        return E_INVALIDARG;
+    }
+
+    ULONGLONG textureOffset;
+    memcpy(&layout->numTextures, layout->header + 10, sizeof(layout->numTextures));
+    memcpy(&textureOffset, layout->header + 40, sizeof(textureOffset));
+    if (layout->numTextures <= 0) {
+        return E_INVALIDARG;
+    }
+
+    layout->table.resize((SIZE_T)layout->numTextures * PAPA_TEXTURE_INFO_SIZE);
+    if (FAILED(source->read(source->context, textureOffset, &layout->table[0], (ULONG)layout->table.size()))) {
+        return E_INVALIDARG;
+    }
+
+    layout->hasPreview = FALSE;
+    if (layout->numTextures > 1) {
+        ULONGLONG dataOffset;
+        memcpy(&dataOffset, &layout->table[layout->table.size() - PAPA_TEXTURE_INFO_SIZE + 16], sizeof(dataOffset));
+        BYTE magic[8];
+        layout->hasPreview = dataOffset >= PAPA_PREVIEW_TAG_SIZE && SUCCEEDED(source->read(source->context, dataOffset - PAPA_PREVIEW_TAG_SIZE, magic, 8)) &&
+                             memcmp(magic, PAPA_PREVIEW_MAGIC, 8) == 0;
+    }
+    return S_OK;
+}
+
+static USHORT To565(const BYTE* rgb)
+{
+    return (USHORT)(((rgb[0] >> 3) << 11) | ((rgb[1] >> 2) << 5) | (rgb[2] >> 3));
+}
+
+// the four colours a block decodes to, expanded the way PapaDecodeTexture does it
+static VOID GetPalette(USHORT colour0, USHORT colour1, LONG palette[4][3])
+{
+    const USHORT colours[2] = { colour0, colour1 };
+    for (UINT i = 0; i < 2; i++) {
+        palette[i][0] = (colours[i] >> 8) & 0xF8;
+        palette[i][1] = (colours[i] >> 3) & 0xFC;
+        palette[i][2] = (colours[i] << 3) & 0xF8;
+    }
+    for (UINT c = 0; c < 3; c++) {
+        palette[2][c] = (2 * palette[0][c] + palette[1][c]) / 3;
+        palette[3][c] = (palette[0][c] + 2 * palette[1][c]) / 3;
+    }
+}
+
+// Bounding box endpoints inset by a sixteenth, then the nearest of the four colours for each
+// texel. Always four colour mode, the preview's alpha goes in DXT5's alpha block.
+static VOID EncodeColourBlock(const BYTE block[16][4], BYTE* out)
+{
+    BYTE low[3] = { 255, 255, 255 };
+    BYTE high[3] = { 0, 0, 0 };
+    for (UINT i = 0; i < 16; i++) {
+        for (UINT c = 0; c < 3; c++) {
+            low[c] = min(low[c], block[i][c]);
+            high[c] = max(high[c], block[i][c]);
+        }
+    }
+    for (UINT c = 0; c < 3; c++) {
+        BYTE inset = (BYTE)((high[c] - low[c]) >> 4);
+        low[c] = (BYTE)(low[c] + inset);
+        high[c] = (BYTE)(high[c] - inset);
+    }
+
+    USHORT colour0 = To565(high);
+    USHORT colour1 = To565(low);
+    if (colour0 < colour1) {
+        USHORT swap = colour0;
+        colour0 = colour1;
+        colour1 = swap;
+    }
+
+    ULONG indices = 0;
+    if (colour0 != colour1) {
+        LONG palette[4][3];
+        GetPalette(colour0, colour1, palette);
+        for (UINT i = 0; i < 16; i++) {
+            LONG best = 0x7FFFFFFF;
+            ULONG index = 0;
+            for (ULONG p = 0; p < 4; p++) {
+                LONG distance = 0;
+                for (UINT c = 0; c < 3; c++) {
+                    LONG d = block[i][c] - palette[p][c];
+                    distance += d * d;
+                }
+                if (distance < best) {
+                    best = distance;
+                    index = p;
+                }
+            }
+            indices |= index << (2 * i);
+        }
+    }
+
+    out[0] = (BYTE)colour0;
+    out[1] = (BYTE)(colour0 >> 8);
+    out[2] = (BYTE)colour1;
+    out[3] = (BYTE)(colour1 >> 8);
+    for (UINT i = 0; i < 4; i++) {
+        out[4 + i] = (BYTE)(indices >> (8 * i));
+    }
+}
+
+// eight alpha mode between the block's extremes, nearest value for each texel
+static VOID EncodeAlphaBlock(const BYTE block[16][4], BYTE* out)
+{
+    BYTE low = 255;
+    BYTE high = 0;
+    for (UINT i = 0; i < 16; i++) {
+        low = min(low, block[i][3]);
+        high = max(high, block[i][3]);
+    }
+
+    ULONGLONG indices = 0;
+    if (high != low) {
+        LONG values[8] = { high, low };
+        for (LONG i = 1; i < 7; i++) {
+            values[i + 1] = ((7 - i) * high + i * low) / 7;
+        }
+        for (UINT i = 0; i < 16; i++) {
+            LONG best = 256;
+            ULONGLONG index = 0;
+            for (ULONGLONG v = 0; v < 8; v++) {
+                LONG distance = abs(block[i][3] - values[v]);
+                if (distance < best) {
+                    best = distance;
+                    index = v;
+                }
+            }
+            indices |= index << (3 * i);
+        }
+    }
+
+    out[0] = high;
+    out[1] = low;
+    for (UINT i = 0; i < 6; i++) {
+        out[2 + i] = (BYTE)(indices >> (8 * i));
+    }
+}
+
+// the preview's payload from RGBA pixels, bottom-up as PapaDecodeScaled leaves them
+static VOID EncodePreview(const PAPA_IMAGE* image, BYTE format, std::vector<BYTE>* payload)
+{
+    LONG width = image->width;
+    LONG height = image->height;
+    payload->resize((SIZE_T)PapaTextureDataSize(format, (USHORT)width, (USHORT)height));
+
+    // papa rows run top-down
+    if (format == FORMAT_RGBA8888) {
+        for (LONG y = 0; y < height; y++) {
+            memcpy(&(*payload)[(SIZE_T)y * width * 4], image->pixels + (SIZE_T)(height - 1 - y) * width * 4, (SIZE_T)width * 4);
+        }
+        return;
+    }
+
+    BYTE* out = &(*payload)[0];
+    for (LONG by = 0; by < height; by += 4) {
+        for (LONG bx = 0; bx < width; bx += 4) {
+            // texels past the edge repeat the last row and column
+            BYTE block[16][4];
+            for (LONG y = 0; y < 4; y++) {
+                LONG row = height - 1 - min(by + y, height - 1);
+                for (LONG x = 0; x < 4; x++) {
+                    memcpy(block[y * 4 + x], image->pixels + ((SIZE_T)row * width + min(bx + x, width - 1)) * 4, 4);
+                }
+            }
+            if (format == FORMAT_DXT5) {
+                EncodeAlphaBlock(block, out);
+                out += 8;
+            }
+            EncodeColourBlock(block, out);
+            out += 8;
+        }
+    }
+}
+
+static BOOL HasAlpha(const PAPA_IMAGE* image)
+{
+    SIZE_T count = (SIZE_T)image->width * image->height;
+    for (SIZE_T i = 0; i < count; i++) {
+        if (image->pixels[i * 4 + 3] != 255) {
+            return TRUE;
+        }
+    }
+    return FALSE;
+}
+
+static BOOL WriteAt(FILE* file, ULONGLONG offset, const VOID* data, SIZE_T size)
+{
+    return fseeko(file, (off_t)offset, SEEK_SET) == 0 && fwrite(data, 1, size, file) == size;
+}
+
+// Writes a new texture table holding the first count entries of layout's, plus preview and
+// its payload when there is one, at the end of the file. The header is updated last, so a
+// failure part way leaves the file as it was apart from some unused bytes at the end.
+static HRESULT WriteTable(const CHAR* path, const PAPA_LAYOUT* layout, SHORT count, const BYTE* preview, const std::vector<BYTE>& payload)
+{
+    FILE* file = fopen(path, "r+b");
+    if (file == NULL) {
+        return E_ACCESSDENIED;
+    }
+
+    std::vector<BYTE> header(layout->header, layout->header + PAPA_HEADER_SIZE);
+    SHORT numTextures = (SHORT)(count + (preview != NULL ? 1 : 0));
+    memcpy(&header[10], &numTextures, sizeof(numTextures));
+
+    BOOL written = fseeko(file, 0, SEEK_END) == 0;
+    ULONGLONG end = written ? (ULONGLONG)ftello(file) : 0;
+    ULONGLONG tableOffset = (end + TABLE_ALIGNMENT - 1) & ~(ULONGLONG)(TABLE_ALIGNMENT - 1);
+
+    if (preview != NULL) {
+        // table, then the tag, then the payload on a 16 byte boundary
+        std::vector<BYTE> tail((SIZE_T)(tableOffset - end));
+        tail.insert(tail.end(), layout->table.begin(), layout->table.begin() + (SIZE_T)count * PAPA_TEXTURE_INFO_SIZE);
+        SIZE_T entry = tail.size();
+        tail.insert(tail.end(), preview, preview + PAPA_TEXTURE_INFO_SIZE);
+        tail.resize((SIZE_T)(((end + tail.size() + TABLE_ALIGNMENT - 1) & ~(ULONGLONG)(TABLE_ALIGNMENT - 1)) - end));
+
+        BYTE tag[PAPA_PREVIEW_TAG_SIZE] = {};
+        memcpy(tag, PAPA_PREVIEW_MAGIC, 8);
+        memcpy(tag + 16, &layout->table[0], 16);
+        tail.insert(tail.end(), tag, tag + PAPA_PREVIEW_TAG_SIZE);
+
+        ULONGLONG dataOffset = end + tail.size();
+        memcpy(&tail[entry + 16], &dataOffset, sizeof(dataOffset));
+        tail.insert(tail.end(), payload.begin(), payload.end());
+
+        written = written && WriteAt(file, end, &tail[0], tail.size());
+        memcpy(&header[40], &tableOffset, sizeof(tableOffset));
+    }
+    // dropping the last entry needs no new table, only the count
+
+    written = written && fflush(file) == 0 && WriteAt(file, 0, &header[0], header.size());
+    if (fclose(file) != 0) {
+        written = FALSE;
+    }
+    return written ? S_OK : E_FAIL;
+}
+
+// S_OK when the file changed, S_FALSE when it already had what was asked for
+static HRESULT UpdateFile(const CHAR* path, const PREVIEW_JOB* job, PapaScratch* scratch)
+{
+    PAPA_SOURCE source;
+    HRESULT result = PapaOpenFileSource(path, &source);
+    if (FAILED(result)) {
+        return result;
+    }
+
+    PAPA_LAYOUT layout;
+    PAPA_TEXTURE_INFO info;
+    result = ReadLayout(&source, &layout);
+    if (SUCCEEDED(result)) {
+        result = PapaReadTextureInfo(&source, 0, &info);
+    }
+    if (FAILED(result) || layout.numTextures == 0x7FFF) {
+        PapaCloseFileSource(&source);
+        return FAILED(result) ? result : E_INVALIDARG;
+    }
+    SHORT keep = (SHORT)(layout.numTextures - (layout.hasPreview ? 1 : 0));
+
+    LONG longer = max(info.width, info.height);
+    if (job->remove || longer <= job->size) {
+        PapaCloseFileSource(&source);
+        return layout.hasPreview ? WriteTable(path, &layout, keep, NULL, std::vector<BYTE>()) : S_FALSE;
+    }
+
+    PAPA_IMAGE image;
+    result = PapaAllocImage(max((LONG)roundf((FLOAT)info.width * job->size / longer), 1), max((LONG)roundf((FLOAT)info.height * job->size / longer), 1), &image);
+    if (FAILED(result)) {
+        PapaCloseFileSource(&source);
+        return result;
+    }
+
+    PAPA_TEXTURE_INFO existing;
+    if (layout.hasPreview && PapaReadPreviewInfo(&source, &existing) == S_OK && existing.width == image.width && existing.height == image.height &&
+        (existing.format == FORMAT_RGBA8888) == (job->rgba != FALSE)) {
+        PapaCloseFileSource(&source);
+        PapaFreeImage(&image);
+        return S_FALSE;
+    }
+
+    result = PapaDecodeScaled(&source, &info, scratch, &image);
+    PapaCloseFileSource(&source);
+
+    if (SUCCEEDED(result)) {
+        BYTE format = job->rgba ? FORMAT_RGBA8888 : HasAlpha(&image) ? FORMAT_DXT5 : FORMAT_DXT1;
+        std::vector<BYTE> payload;
+        EncodePreview(&image, format, &payload);
+
+        // unnamed, one mip, texture 0's srgb flag
+        BYTE entry[PAPA_TEXTURE_INFO_SIZE] = {};
+        SHORT nameIndex = -1;
+        USHORT width = (USHORT)image.width;
+        USHORT height = (USHORT)image.height;
+        ULONGLONG dataSize = payload.size();
+        memcpy(entry, &nameIndex, sizeof(nameIndex));
+        entry[2] = format;
+        entry[3] = (BYTE)((info.mips & 0xF0) | 1);
+        memcpy(entry + 4, &width, sizeof(width));
+        memcpy(entry + 6, &height, sizeof(height));
+        memcpy(entry + 8, &dataSize, sizeof(dataSize));
+        result = WriteTable(path, &layout, keep, entry, payload);
+    }
+    PapaFreeImage(&image);
+    return result;
+}
+
+static VOID PreviewTask(VOID* context, UINT index)
+{
+    PREVIEW_JOB* job = (PREVIEW_JOB*)context;
+    thread_local PapaScratch scratch;
+
+    const CHAR* path = (*job->files)[index].c_str();
+    HRESULT result = UpdateFile(path, job, &scratch);
+    scratch.Trim(SCRATCH_KEEP_BYTES);
+
+    if (FAILED(result)) {
+        fprintf(stderr, "%s: failed (0x%08x)\n", path, (unsigned)result);
+        job->failed++;
+    } else if (result == S_FALSE) {
+        job->current++;
+    } else {
+        job->written++;
+    }
+}
+
+int main(int argc, CHAR** argv)
+{
+    LONG size = DEFAULT_PREVIEW_SIZE;
+    UINT threads = 0;
+    BOOL rgba = FALSE;
+    BOOL remove = FALSE;
+    BOOL usage = FALSE;
+    int opt;
+    while ((opt = getopt(argc, argv, "s:rdj:")) != -1) {
+        switch (opt) {
+        case 's':
+            size = atol(optarg);
+            break;
+        case 'r':
+            rgba = TRUE;
+            break;
+        case 'd':
+            remove = TRUE;
+            break;
+        case 'j':
+            threads = (UINT)atoi(optarg);
+            break;
+        default:
+            usage = TRUE;
+            break;
+        }
+    }
+
+    if (usage || size < 1 || size > 4096 || optind >= argc) {
+        fprintf(stderr, "usage: papa-preview [-s size] [-r] [-j threads] paths...\n"
+                        "       papa-preview -d [-j threads] paths...\n");
+        return 2;
+    }
+
+    std::vector<std::string> files;
+    PapaCollectFiles(argv + optind, argc - optind, &files);
+    if (files.empty()) {
+        fprintf(stderr, "papa-preview: no .papa files found\n");
+        return 1;
+    }
+
+    PREVIEW_JOB job;
+    job.files = &files;
+    job.size = size;
+    job.rgba = rgba;
+    job.remove = remove;
+    job.written = 0;
+    job.current = 0;
+    job.failed = 0;
+
+    PapaScheduler scheduler(threads);
+    scheduler.ParallelFor((UINT)files.size(), PreviewTask, &job);
+
+    fprintf(stderr, "%zu files, %u %s, %u unchanged, %u failed\n", files.size(), job.written.load(), remove ? "removed" : "written", job.current.load(),
+            job.failed.load());
+    return job.failed > 0 ? 1 : 0;
+}
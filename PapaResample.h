@@ -0,0 +1,547 @@
+// The MIT License
+// 
+// Copyright (c) 2022     Marcus Der      marcusder@hotmail.com
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#pragma once
+
+#include <stdlib.h>
+#include <string.h>
+#include <atomic>
+#include "PapaCore.h"
+
+#ifdef PAPA_SSE2
+#include <emmintrin.h>
+#endif
+
+// below this many output pixels a rescale runs on the calling thread, the tasks would cost
+// more than they save
+#define PAPA_PARALLEL_SCALE_MIN_PIXELS (128 * 128)
+// roughly how many output pixels each task is given
+#define PAPA_PARALLEL_SCALE_TASK_PIXELS (64 * 256)
+
+// Resampling filters as policy types over PAPA_IMAGE views. PapaResampleRows is instantiated
+// once per filter, so the kernel inlines into its own loop instead of going through a
+// function pointer per image or per pixel, and the image sizes are read once per call.
+//
+// A filter is constructed for one src -> dst pair and provides
+//   VOID BeginRow(LONG y)      per-row setup for output row y
+//   ULONG32 Sample(LONG x)     the 32bpp output pixel at column x of that row
+// A filter may also provide
+//   VOID SampleRow(LONG y, ULONG32* row, LONG width)
+// to fill a whole output row at once, for kernels that work on several pixels at a time, and
+// is then hooked up with a PapaFilterRow overload below.
+// Adding a filter means writing one of these, the loops and the stepped downscale come free.
+
+// Source columns come from a table built once per pass, with the same float mapping a per
+// pixel divide would give. Scaling up, consecutive output rows often land on the same source
+// row, and those are copied whole from the row before.
+class PapaNearestFilter
+{
+public:
+    PapaNearestFilter(const PAPA_IMAGE* src, const PAPA_IMAGE* dst)
+        : _pixels((const ULONG32*)src->pixels), _srcWidth(src->width), _srcHeight(src->height),
+          _dstHeight((FLOAT)dst->height), _row(NULL), _lastRow(NULL), _lastOutput(NULL)
+    {
+        _columns = (LONG*)malloc((SIZE_T)max(dst->width, (LONG)1) * sizeof(LONG));
+        if (_columns != NULL) {
+            for (LONG x = 0; x < dst->width; x++) {
+                _columns[x] = (LONG)(x / (FLOAT)dst->width * (FLOAT)src->width);
+            }
+        }
+    }
+
+    ~PapaNearestFilter()
+    {
+        free(_columns);
+    }
+
+    BOOL IsValid() const
+    {
+        return _columns != NULL;
+    }
+
+    PAPA_FORCEINLINE VOID BeginRow(LONG y)
+    {
+        LONG gyi = (LONG)(y / _dstHeight * (FLOAT)_srcHeight);
+        _row = _pixels + (SIZE_T)gyi * _srcWidth;
+    }
+
+    PAPA_FORCEINLINE ULONG32 Sample(LONG x) const
+    {
+        return _row[_columns[x]];
+    }
+
+    // rows must come in order, the copy reuses the last row written
+    VOID SampleRow(LONG y, ULONG32* row, LONG width)
+    {
+        BeginRow(y);
+        if (_row == _lastRow) {
+            memcpy(row, _lastOutput, (SIZE_T)width * 4);
+        } else {
+            for (LONG x = 0; x < width; x++) {
+                row[x] = _row[_columns[x]];
+            }
+        }
+        _lastRow = _row;
+        _lastOutput = row;
+    }
+
+private:
+    PapaNearestFilter(const PapaNearestFilter&);
+    PapaNearestFilter& operator=(const PapaNearestFilter&);
+
+    const ULONG32* _pixels;
+    LONG _srcWidth;
+    LONG _srcHeight;
+    FLOAT _dstHeight;
+    LONG* _columns;     // source column of each output column
+    const ULONG32* _row;
+    const ULONG32* _lastRow;
+    const ULONG32* _lastOutput;
+};
+
+// bilinear weights are Q8, so a weight times a channel, summed over two pixels and rounded,
+// stays inside an unsigned 16 bit lane
+#define PAPA_BILINEAR_BITS 8
+#define PAPA_BILINEAR_ONE (1 << PAPA_BILINEAR_BITS)
+
+// Bilinear interpolation with the sample positions of
+// https://rosettacode.org/wiki/Bilinear_interpolation#C
+// done separably in fixed point. BeginRow blends the two source rows once into a buffer, then
+// each output pixel is a blend of two neighbours in it, with the columns and weights taken
+// from tables built once per pass. SampleRow does four output pixels at a time with SSE2.
+class PapaBilinearFilter
+{
+public:
+    PapaBilinearFilter(const PAPA_IMAGE* src, const PAPA_IMAGE* dst)
+        : _pixels((const ULONG32*)src->pixels), _srcWidth(src->width), _srcHeight(src->height), _dstHeight((FLOAT)dst->height)
+    {
+        SIZE_T columns = (SIZE_T)max(dst->width, (LONG)1);
+        _columns = (LONG*)malloc(columns * sizeof(LONG));
+        _weights = (USHORT*)malloc(columns * 8 * sizeof(USHORT));
+        _blended = (ULONG32*)malloc(((SIZE_T)src->width + 1) * sizeof(ULONG32));
+        if (IsValid()) {
+            for (LONG x = 0; x < dst->width; x++) {
+                FLOAT gx = x / (FLOAT)dst->width * (src->width - 0.5f);
+                _columns[x] = (LONG)gx;
+                USHORT weight = (USHORT)((gx - _columns[x]) * PAPA_BILINEAR_ONE + 0.5f);
+                // four lanes for the left pixel then four for the right, ready to multiply
+                for (LONG i = 0; i < 4; i++) {
+                    _weights[(SIZE_T)x * 8 + i] = (USHORT)(PAPA_BILINEAR_ONE - weight);
+                    _weights[(SIZE_T)x * 8 + 4 + i] = weight;
+                }
+            }
+        }
+    }
+
+    ~PapaBilinearFilter()
+    {
+        free(_columns);
+        free(_weights);
+        free(_blended);
+    }
+
+    BOOL IsValid() const
+    {
+        return _columns != NULL && _weights != NULL && _blended != NULL;
+    }
+
+    PAPA_FORCEINLINE VOID BeginRow(LONG y)
+    {
+        FLOAT gy = y / _dstHeight * (_srcHeight - 0.5f);
+        LONG gyi = (LONG)gy;
+        ULONG weight = (ULONG)((gy - gyi) * PAPA_BILINEAR_ONE + 0.5f);
+        const ULONG32* row0 = _pixels + (SIZE_T)gyi * _srcWidth;
+        const ULONG32* row1 = _pixels + (SIZE_T)min(gyi + 1, _srcHeight - 1) * _srcWidth;
+        BlendRows(row0, row1, _blended, _srcWidth, weight);
+        _blended[_srcWidth] = _blended[_srcWidth - 1]; // the last column has nothing to its right
+    }
+
+    PAPA_FORCEINLINE ULONG32 Sample(LONG x) const
+    {
+        const ULONG32* pair = _blended + _columns[x];
+        return BlendPixels(pair[0], pair[1], _weights[(SIZE_T)x * 8 + 4]);
+    }
+
+    VOID SampleRow(LONG y, ULONG32* row, LONG width)
+    {
+        BeginRow(y);
+        LONG x = 0;
+#ifdef PAPA_SSE2
+        const __m128i zero = _mm_setzero_si128();
+        const __m128i round = _mm_set1_epi16(PAPA_BILINEAR_ONE / 2);
+        for (; x + 4 <= width; x += 4) {
+            __m128i blend[4];
+            for (LONG i = 0; i < 4; i++) {
+                // a pixel and its right neighbour widened to 16 bits, times their weights
+                __m128i pair = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i*)(_blended + _columns[x + i])), zero);
+                blend[i] = _mm_mullo_epi16(pair, _mm_loadu_si128((const __m128i*)(_weights + (SIZE_T)(x + i) * 8)));
+            }
+            // add the right halves onto the left, two output pixels per register
+            __m128i first = _mm_add_epi16(_mm_unpacklo_epi64(blend[0], blend[1]), _mm_unpackhi_epi64(blend[0], blend[1]));
+            __m128i second = _mm_add_epi16(_mm_unpacklo_epi64(blend[2], blend[3]), _mm_unpackhi_epi64(blend[2], blend[3]));
+            first = _mm_srli_epi16(_mm_add_epi16(first, round), PAPA_BILINEAR_BITS);
+            second = _mm_srli_epi16(_mm_add_epi16(second, round), PAPA_BILINEAR_BITS);
+            _mm_storeu_si128((__m128i*)(row + x), _mm_packus_epi16(first, second));
+        }
+#endif
+        for (; x < width; x++) {
+            row[x] = Sample(x);
+        }
+    }
+
+private:
+    PapaBilinearFilter(const PapaBilinearFilter&);
+    PapaBilinearFilter& operator=(const PapaBilinearFilter&);
+
+    // a * (1 - weight) + b * weight per channel, rounded, weight in Q8
+    static PAPA_FORCEINLINE ULONG32 BlendPixels(ULONG32 a, ULONG32 b, ULONG weight)
+    {
+        ULONG32 result = 0;
+        for (LONG i = 0; i < 4; i++) {
+            ULONG channel = ((a >> (8 * i)) & 0xFF) * (PAPA_BILINEAR_ONE - weight) + ((b >> (8 * i)) & 0xFF) * weight;
+            result |= ((channel + PAPA_BILINEAR_ONE / 2) >> PAPA_BILINEAR_BITS) << (8 * i);
+        }
+        return result;
+    }
+
+    static VOID BlendRows(const ULONG32* a, const ULONG32* b, ULONG32* out, LONG count, ULONG weight)
+    {
+        LONG i = 0;
+#ifdef PAPA_SSE2
+        const __m128i zero = _mm_setzero_si128();
+        const __m128i weightA = _mm_set1_epi16((SHORT)(PAPA_BILINEAR_ONE - weight));
+        const __m128i weightB = _mm_set1_epi16((SHORT)weight);
+        const __m128i round = _mm_set1_epi16(PAPA_BILINEAR_ONE / 2);
+        for (; i + 4 <= count; i += 4) {
+            __m128i pixelsA = _mm_loadu_si128((const __m128i*)(a + i));
+            __m128i pixelsB = _mm_loadu_si128((const __m128i*)(b + i));
+            __m128i low = _mm_add_epi16(_mm_mullo_epi16(_mm_unpacklo_epi8(pixelsA, zero), weightA), _mm_mullo_epi16(_mm_unpacklo_epi8(pixelsB, zero), weightB));
+            __m128i high = _mm_add_epi16(_mm_mullo_epi16(_mm_unpackhi_epi8(pixelsA, zero), weightA), _mm_mullo_epi16(_mm_unpackhi_epi8(pixelsB, zero), weightB));
+            low = _mm_srli_epi16(_mm_add_epi16(low, round), PAPA_BILINEAR_BITS);
+            high = _mm_srli_epi16(_mm_add_epi16(high, round), PAPA_BILINEAR_BITS);
+            _mm_storeu_si128((__m128i*)(out + i), _mm_packus_epi16(low, high));
+        }
+#endif
+        for (; i < count; i++) {
+            out[i] = BlendPixels(a[i], b[i], weight);
+        }
+    }
+
+    const ULONG32* _pixels;
+    LONG _srcWidth;
+    LONG _srcHeight;
+    FLOAT _dstHeight;
+    LONG* _columns;     // left source column of each output column
+    USHORT* _weights;   // eight lanes per output column, see the constructor
+    ULONG32* _blended;  // the current row blended vertically, plus a copy of its last pixel
+};
+
+// https://stackoverflow.com/q/15176972
+class PapaBicubicFilter
+{
+public:
+    PapaBicubicFilter(const PAPA_IMAGE* src, const PAPA_IMAGE* dst)
+        : _pixels((const ULONG32*)src->pixels), _srcWidth(src->width), _srcHeight(src->height), _xRatio((FLOAT)src->width / dst->width), _yRatio((FLOAT)src->height / dst->height), _yy(0), _dy(0), _dy2(0), _dy3(0)
+    {
+    }
+
+    PAPA_FORCEINLINE VOID BeginRow(LONG y)
+    {
+        _yy = (LONG)(_yRatio * y);
+        _dy = _yRatio * y - _yy;
+        _dy2 = _dy * _dy;
+        _dy3 = _dy2 * _dy;
+    }
+
+    PAPA_FORCEINLINE ULONG32 Sample(LONG x) const
+    {
+        LONG xx = (LONG)(_xRatio * x);
+        FLOAT dx = _xRatio * x - xx;
+        FLOAT dx2 = dx * dx;
+        FLOAT dx3 = dx2 * dx;
+
+        // the 4x4 neighbourhood once for all channels, zero outside the image
+        ULONG32 block[4][4];
+        for (LONG i = 0; i < 4; i++) {
+            LONG sy = _yy - 1 + i;
+            for (LONG j = 0; j < 4; j++) {
+                LONG sx = xx - 1 + j;
+                block[i][j] = sx >= 0 && sx < _srcWidth && sy >= 0 && sy < _srcHeight ? _pixels[sx + (SIZE_T)sy * _srcWidth] : 0;
+            }
+        }
+
+        FLOAT temp[4];
+        ULONG32 result = 0;
+
+        for (LONG channel = 0; channel < 4; channel++) {
+            LONG shift = 8 * channel;
+            FLOAT a0, a1, a2, a3, d1, d2, d3;
+            for (LONG i = 0; i < 4; i++) {
+                a0 = (FLOAT)((block[i][1] >> shift) & 0xFF);
+
+                d1 = (FLOAT)((block[i][0] >> shift) & 0xFF) - a0;
+                d2 = (FLOAT)((block[i][2] >> shift) & 0xFF) - a0;
+                d3 = (FLOAT)((block[i][3] >> shift) & 0xFF) - a0;
+
+                a1 = (FLOAT)(-(1.0f / 3.0f) * d1 + d2 - (1.0f / 6.0f) * d3);
+                a2 = (FLOAT)(0.5f * d1 + 0.5f * d2);
+                a3 = (FLOAT)(-(1.0f / 6.0f) * d1 - 0.5f * d2 + (1.0f / 6.0f) * d3);
+
+                temp[i] = (FLOAT)(a0 + a1 * dx + a2 * dx2 + a3 * dx3);
+            }
+            a0 = temp[1];
+            d1 = temp[0] - a0;
+            d2 = temp[2] - a0;
+            d3 = temp[3] - a0;
+
+            a1 = (FLOAT)(-(1.0f / 3.0f) * d1 + d2 - (1.0f / 6.0f) * d3);
+            a2 = (FLOAT)(0.5f * d1 + 0.5f * d2);
+            a3 = (FLOAT)(-(1.0f / 6.0f) * d1 - 0.5f * d2 + (1.0f / 6.0f) * d3);
+
+            FLOAT res = (a0 + a1 * _dy + a2 * _dy2 + a3 * _dy3);
+            result |= (ULONG32)ClampByte(res) << shift;
+        }
+        return result;
+    }
+
+private:
+    static inline BYTE ClampByte(FLOAT b)
+    {
+        return b >= 255 ? 255 : b <= 0 ? 0 : (BYTE)b;
+    }
+
+    const ULONG32* _pixels;
+    LONG _srcWidth;
+    LONG _srcHeight;
+    FLOAT _xRatio;
+    FLOAT _yRatio;
+    LONG _yy;
+    FLOAT _dy;
+    FLOAT _dy2;
+    FLOAT _dy3;
+};
+
+// Plain average of the source pixels under each output pixel, in gamma space, with integer
+// footprints. Gives the nearest pixel when upscaling.
+class PapaBoxFilter
+{
+public:
+    PapaBoxFilter(const PAPA_IMAGE* src, const PAPA_IMAGE* dst)
+        : _pixels((const ULONG32*)src->pixels), _srcWidth(src->width), _srcHeight(src->height), _dstHeight(dst->height), _row(NULL), _rows(0)
+    {
+        _columns = (LONG*)malloc(((SIZE_T)dst->width + 1) * sizeof(LONG));
+        if (_columns != NULL) {
+            for (LONG x = 0; x <= dst->width; x++) {
+                _columns[x] = (LONG)((LONG64)x * src->width / dst->width);
+            }
+        }
+    }
+
+    ~PapaBoxFilter()
+    {
+        free(_columns);
+    }
+
+    BOOL IsValid() const
+    {
+        return _columns != NULL;
+    }
+
+    PAPA_FORCEINLINE VOID BeginRow(LONG y)
+    {
+        LONG first = (LONG)((LONG64)y * _srcHeight / _dstHeight);
+        LONG last = (LONG)((LONG64)(y + 1) * _srcHeight / _dstHeight);
+        _rows = max(last - first, 1);
+        _row = _pixels + (SIZE_T)first * _srcWidth;
+    }
+
+    PAPA_FORCEINLINE ULONG32 Sample(LONG x) const
+    {
+        LONG first = _columns[x];
+        LONG count = max(_columns[x + 1] - first, 1);
+        ULONG total[4] = { 0, 0, 0, 0 };
+
+        for (LONG y = 0; y < _rows; y++) {
+            const ULONG32* row = _row + (SIZE_T)y * _srcWidth + first;
+            for (LONG i = 0; i < count; i++) {
+                ULONG32 pixel = row[i];
+                total[0] += pixel & 0xFF;
+                total[1] += (pixel >> 8) & 0xFF;
+                total[2] += (pixel >> 16) & 0xFF;
+                total[3] += pixel >> 24;
+            }
+        }
+
+        ULONG area = (ULONG)(_rows * count);
+        ULONG32 result = 0;
+        for (LONG i = 0; i < 4; i++) {
+            result |= ((total[i] + area / 2) / area) << (8 * i);
+        }
+        return result;
+    }
+
+private:
+    PapaBoxFilter(const PapaBoxFilter&);
+    PapaBoxFilter& operator=(const PapaBoxFilter&);
+
+    const ULONG32* _pixels;
+    LONG _srcWidth;
+    LONG _srcHeight;
+    LONG _dstHeight;
+    LONG* _columns;     // first source column of each output column, plus the end
+    const ULONG32* _row;
+    LONG _rows;
+};
+
+// validity check for filters that allocate, the rest always are
+template <class Filter> inline BOOL PapaFilterIsValid(const Filter&)
+{
+    return TRUE;
+}
+
+inline BOOL PapaFilterIsValid(const PapaBoxFilter& filter)
+{
+    return filter.IsValid();
+}
+
+inline BOOL PapaFilterIsValid(const PapaNearestFilter& filter)
+{
+    return filter.IsValid();
+}
+
+inline BOOL PapaFilterIsValid(const PapaBilinearFilter& filter)
+{
+    return filter.IsValid();
+}
+
+// output row y, a pixel at a time unless the filter has a row kernel
+template <class Filter> PAPA_FORCEINLINE VOID PapaFilterRow(Filter& filter, LONG y, ULONG32* row, LONG width)
+{
+    filter.BeginRow(y);
+    for (LONG x = 0; x < width; x++) {
+        row[x] = filter.Sample(x);
+    }
+}
+
+inline VOID PapaFilterRow(PapaNearestFilter& filter, LONG y, ULONG32* row, LONG width)
+{
+    filter.SampleRow(y, row, width);
+}
+
+inline VOID PapaFilterRow(PapaBilinearFilter& filter, LONG y, ULONG32* row, LONG width)
+{
+    filter.SampleRow(y, row, width);
+}
+
+// output rows [firstRow, lastRow) of src resampled to dst's size
+template <class Filter> HRESULT PapaResampleRows(const PAPA_IMAGE* src, const PAPA_IMAGE* dst, LONG firstRow, LONG lastRow)
+{
+    Filter filter(src, dst);
+    if (!PapaFilterIsValid(filter)) {
+        return E_OUTOFMEMORY;
+    }
+
+    ULONG32* pixels = (ULONG32*)dst->pixels;
+    LONG width = dst->width;
+    for (LONG y = firstRow; y < lastRow; y++) {
+        PapaFilterRow(filter, y, pixels + (SIZE_T)y * width, width);
+    }
+    return S_OK;
+}
+
+template <class Filter> HRESULT PapaResample(const PAPA_IMAGE* src, const PAPA_IMAGE* dst)
+{
+    return PapaResampleRows<Filter>(src, dst, 0, dst->height);
+}
+
+template <class Filter> struct PAPA_RESAMPLE_JOB
+{
+    const PAPA_IMAGE* src;
+    const PAPA_IMAGE* dst;
+    LONG rowsPerTask;
+    std::atomic<HRESULT> result;
+
+    static VOID Task(VOID* context, UINT index)
+    {
+        PAPA_RESAMPLE_JOB* job = (PAPA_RESAMPLE_JOB*)context;
+        LONG firstRow = (LONG)index * job->rowsPerTask;
+        HRESULT result = PapaResampleRows<Filter>(job->src, job->dst, firstRow, min(firstRow + job->rowsPerTask, job->dst->height));
+        if (FAILED(result)) {
+            job->result.store(result);
+        }
+    }
+};
+
+// PapaResample with the output rows split into bands across scheduler. Every output row is
+// computed from its own y alone, so the result is the same bit for bit as the serial pass
+// whatever the split. Small outputs, or no scheduler, stay on the calling thread.
+template <class Filter> HRESULT PapaResampleParallel(const PAPA_IMAGE* src, const PAPA_IMAGE* dst, PapaScheduler* scheduler)
+{
+    if (scheduler == NULL || (LONG64)dst->width * dst->height < PAPA_PARALLEL_SCALE_MIN_PIXELS) {
+        return PapaResample<Filter>(src, dst);
+    }
+
+    PAPA_RESAMPLE_JOB<Filter> job;
+    job.src = src;
+    job.dst = dst;
+    job.rowsPerTask = max(PAPA_PARALLEL_SCALE_TASK_PIXELS / dst->width, (LONG)1);
+    job.result.store(S_OK);
+    scheduler->ParallelFor((UINT)((dst->height + job.rowsPerTask - 1) / job.rowsPerTask), PAPA_RESAMPLE_JOB<Filter>::Task, &job);
+    return job.result.load();
+}
+
+// Downscales by at most half per pass until the next pass reaches dst, which keeps filters
+// with a small footprint from skipping source pixels. Scaling up, or by less than half, is a
+// single pass. Each pass is split across scheduler when there is one.
+template <class Filter> HRESULT PapaResampleStepped(const PAPA_IMAGE* src, const PAPA_IMAGE* dst, PapaScheduler* scheduler)
+{
+    LONG width = src->width > dst->width ? max(dst->width, src->width / 2) : dst->width;
+    LONG height = src->height > dst->height ? max(dst->height, src->height / 2) : dst->height;
+
+    if (width == dst->width && height == dst->height) {
+        return PapaResampleParallel<Filter>(src, dst, scheduler);
+    }
+
+    // ping-pong between two buffers, each big enough for the first step
+    SIZE_T stepBytes = (SIZE_T)width * height * 4;
+    BYTE* buffers[2] = { (BYTE*)malloc(stepBytes), (BYTE*)malloc(stepBytes) };
+    HRESULT result = buffers[0] != NULL && buffers[1] != NULL ? S_OK : E_OUTOFMEMORY;
+
+    PAPA_IMAGE current = *src;
+    for (UINT step = 0; SUCCEEDED(result); step++) {
+        if (width == dst->width && height == dst->height) {
+            result = PapaResampleParallel<Filter>(&current, dst, scheduler);
+            break;
+        }
+
+        PAPA_IMAGE next = { buffers[step & 1], width, height };
+        result = PapaResampleParallel<Filter>(&current, &next, scheduler);
+        current = next;
+
+        width = current.width > dst->width ? max(dst->width, current.width / 2) : dst->width;
+        height = current.height > dst->height ? max(dst->height, current.height / 2) : dst->height;
+    }
+
+    free(buffers[0]);
+    free(buffers[1]);
+    return result;
+}
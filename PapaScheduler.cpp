@@ -0,0 +1,237 @@
+// The MIT License
+// 
+// Copyright (c) 2022     Marcus Der      marcusder@hotmail.com
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#include "PapaScheduler.h"
+
+// which scheduler (if any) the current thread works for, and the index of its own queue
+static thread_local PapaScheduler* t_scheduler = NULL;
+static thread_local UINT t_queue = 0;
+
+PapaScheduler::PapaScheduler(UINT threadCount) : _queued(0), _submitted(0), _waiters(0), _stopping(FALSE)
+{
+    if (threadCount == 0) {
+        threadCount = std::thread::hardware_concurrency();
+    }
+    _threadCount = max(threadCount, 1u);
+
+    _queues = new WORKER_QUEUE[_threadCount + 1];
+    _threads = new std::thread[_threadCount];
+    for (UINT i = 0; i < _threadCount; i++) {
+        _threads[i] = std::thread(&PapaScheduler::WorkerMain, this, i);
+    }
+}
+
+PapaScheduler::~PapaScheduler()
+{
+    {
+        std::lock_guard<std::mutex> guard(_idleLock);
+        _stopping = TRUE;
+    }
+    _idle.notify_all();
+
+    for (UINT i = 0; i < _threadCount; i++) {
+        _threads[i].join();
+    }
+    delete[] _threads;
+    delete[] _queues;
+}
+
+UINT PapaScheduler::CurrentQueue() const
+{
+    return t_scheduler == this ? t_queue : _threadCount;
+}
+
+VOID PapaScheduler::Submit(PapaTaskGroup* group, PAPA_TASK_PROC proc, VOID* context, UINT index)
+{
+    PAPA_TASK task = { proc, context, index, group };
+    group->_pending.fetch_add(1, std::memory_order_relaxed);
+
+    WORKER_QUEUE& queue = _queues[CurrentQueue()];
+    {
+        std::lock_guard<std::mutex> guard(queue.lock);
+        queue.tasks.push_back(task);
+    }
+    _queued.fetch_add(1, std::memory_order_release);
+
+    // taking the idle lock orders this against a worker or waiter that is about to go to
+    // sleep. waiters have a condition of their own, so this wake always reaches a worker
+    BOOL waiters;
+    {
+        std::lock_guard<std::mutex> guard(_idleLock);
+        _submitted++;
+        waiters = _waiters != 0;
+    }
+    _idle.notify_one();
+    if (waiters) {
+        _progress.notify_all();
+    }
+}
+
+BOOL PapaScheduler::PopTask(UINT index, BOOL back, PAPA_TASK* task)
+{
+    WORKER_QUEUE& queue = _queues[index];
+    std::lock_guard<std::mutex> guard(queue.lock);
+    if (queue.tasks.empty()) {
+        return FALSE;
+    }
+
+    if (back) {
+        *task = queue.tasks.back();
+        queue.tasks.pop_back();
+    } else {
+        *task = queue.tasks.front();
+        queue.tasks.pop_front();
+    }
+    _queued.fetch_sub(1, std::memory_order_relaxed);
+    return TRUE;
+}
+
+VOID PapaScheduler::RunTask(PAPA_TASK* task)
+{
+    task->proc(task->context, task->index);
+
+    if (task->group->_pending.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+        // last task of the group, wake anyone waiting on it
+        {
+            std::lock_guard<std::mutex> guard(_idleLock);
+        }
+        _progress.notify_all();
+    }
+}
+
+BOOL PapaScheduler::TryRunTask(UINT self)
+{
+    PAPA_TASK task;
+
+    // newest local work first (it is the most likely to still be in cache), then the
+    // injection queue, and finally the oldest work of the other workers
+    if (self < _threadCount && PopTask(self, TRUE, &task)) {
+        RunTask(&task);
+        return TRUE;
+    }
+
+    if (PopTask(_threadCount, FALSE, &task)) {
+        RunTask(&task);
+        return TRUE;
+    }
+
+    for (UINT i = 1; i <= _threadCount; i++) {
+        UINT victim = (self + i) % _threadCount;
+        if (victim != self && PopTask(victim, FALSE, &task)) {
+            RunTask(&task);
+            return TRUE;
+        }
+    }
+    return FALSE;
+}
+
+VOID PapaScheduler::WorkerMain(UINT index)
+{
+    t_scheduler = this;
+    t_queue = index;
+
+    for (;;) {
+        if (TryRunTask(index)) {
+            continue;
+        }
+
+        std::unique_lock<std::mutex> lock(_idleLock);
+        _idle.wait(lock, [this] { return _stopping || _queued.load(std::memory_order_acquire) > 0; });
+        if (_stopping && _queued.load(std::memory_order_acquire) == 0) {
+            break;
+        }
+    }
+}
+
+BOOL PapaScheduler::PopGroupTask(UINT index, PapaTaskGroup* group, BOOL back, PAPA_TASK* task)
+{
+    WORKER_QUEUE& queue = _queues[index];
+    std::lock_guard<std::mutex> guard(queue.lock);
+
+    size_t count = queue.tasks.size();
+    for (size_t i = 0; i < count; i++) {
+        size_t at = back ? count - 1 - i : i;
+        if (queue.tasks[at].group == group) {
+            *task = queue.tasks[at];
+            queue.tasks.erase(queue.tasks.begin() + at);
+            _queued.fetch_sub(1, std::memory_order_relaxed);
+            return TRUE;
+        }
+    }
+    return FALSE;
+}
+
+BOOL PapaScheduler::TryRunGroupTask(UINT self, PapaTaskGroup* group)
+{
+    PAPA_TASK task;
+
+    // only the group's own tasks, newest first from our own queue and then the oldest of
+    // everyone else's. picking up unrelated work here would nest whole files on this stack
+    // without bound
+    if (PopGroupTask(self, group, TRUE, &task)) {
+        RunTask(&task);
+        return TRUE;
+    }
+
+    for (UINT i = 1; i <= _threadCount; i++) {
+        UINT victim = (self + i) % (_threadCount + 1);
+        if (PopGroupTask(victim, group, FALSE, &task)) {
+            RunTask(&task);
+            return TRUE;
+        }
+    }
+    return FALSE;
+}
+
+VOID PapaScheduler::Wait(PapaTaskGroup* group)
+{
+    UINT self = CurrentQueue();
+
+    while (!group->IsDone()) {
+        ULONG submitted;
+        {
+            std::lock_guard<std::mutex> guard(_idleLock);
+            submitted = _submitted;
+        }
+
+        // callers outside the pool help too, with the tasks they put in the injection queue
+        if (TryRunGroupTask(self, group)) {
+            continue;
+        }
+
+        // everything left in the group is running on other threads. sleep until it drains,
+        // or until something new is queued in case a task added to the group
+        std::unique_lock<std::mutex> lock(_idleLock);
+        _waiters++;
+        _progress.wait(lock, [this, group, submitted] { return group->IsDone() || _submitted != submitted; });
+        _waiters--;
+    }
+}
+
+VOID PapaScheduler::ParallelFor(UINT count, PAPA_TASK_PROC proc, VOID* context)
+{
+    PapaTaskGroup group;
+    for (UINT i = 0; i < count; i++) {
+        Submit(&group, proc, context, i);
+    }
+    Wait(&group);
+}
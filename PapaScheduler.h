@@ -0,0 +1,107 @@
+// The MIT License
+// 
+// Copyright (c) 2022     Marcus Der      marcusder@hotmail.com
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include "PapaPlatform.h"
+
+// A small work-stealing scheduler used to spread thumbnail work over every core.
+// Each worker owns a deque: it pushes and pops its own tasks from the back, while idle
+// workers steal from the front of someone else's. Tasks submitted from outside the pool
+// go to a shared injection queue. Waiting on a group never blocks a worker outright, the
+// waiter keeps running that group's own queued tasks until it drains, so tasks may freely
+// spawn and wait on subtasks without the waiter picking up unrelated work. Threads outside
+// the pool help with their own groups the same way.
+
+typedef VOID(*PAPA_TASK_PROC)(VOID* context, UINT index);
+
+class PapaTaskGroup
+{
+public:
+    PapaTaskGroup() : _pending(0)
+    {
+    }
+
+    BOOL IsDone() const
+    {
+        return _pending.load(std::memory_order_acquire) == 0;
+    }
+
+private:
+    friend class PapaScheduler;
+    std::atomic<LONG> _pending;
+};
+
+struct PAPA_TASK
+{
+    PAPA_TASK_PROC proc;
+    VOID* context;
+    UINT index;
+    PapaTaskGroup* group;
+};
+
+class PapaScheduler
+{
+public:
+    PapaScheduler(UINT threadCount = 0); // 0 uses one worker per hardware thread
+    ~PapaScheduler();
+
+    VOID Submit(PapaTaskGroup* group, PAPA_TASK_PROC proc, VOID* context, UINT index);
+    VOID Wait(PapaTaskGroup* group);
+    VOID ParallelFor(UINT count, PAPA_TASK_PROC proc, VOID* context);
+
+    UINT GetThreadCount() const
+    {
+        return _threadCount;
+    }
+
+private:
+    struct WORKER_QUEUE
+    {
+        std::mutex lock;
+        std::deque<PAPA_TASK> tasks;
+    };
+
+    VOID WorkerMain(UINT index);
+    BOOL TryRunTask(UINT self);
+    BOOL TryRunGroupTask(UINT self, PapaTaskGroup* group);
+    BOOL PopTask(UINT queue, BOOL back, PAPA_TASK* task);
+    BOOL PopGroupTask(UINT queue, PapaTaskGroup* group, BOOL back, PAPA_TASK* task);
+    VOID RunTask(PAPA_TASK* task);
+    UINT CurrentQueue() const;
+
+    UINT _threadCount;
+    WORKER_QUEUE* _queues;  // one per worker, plus the injection queue at _threadCount
+    std::thread* _threads;
+    std::atomic<LONG> _queued;
+    std::mutex _idleLock;
+    std::condition_variable _idle;      // idle workers sleep here until something is queued
+    std::condition_variable _progress;  // group waiters sleep here until a task is queued or a group drains
+    ULONG _submitted;                   // bumped under _idleLock for every task, so waiters can tell
+    UINT _waiters;                      // threads asleep on _progress
+    BOOL _stopping;
+};
@@ -0,0 +1,105 @@
+// The MIT License
+// 
+// Copyright (c) 2022     Marcus Der      marcusder@hotmail.com
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#pragma once
+
+#include <shlwapi.h>
+#include <thumbcache.h> // For IThumbnailProvider.
+#include <Windows.h>
+#include "PapaCore.h"
+
+// this thumbnail provider implements IInitializeWithStream to enable being hosted
+// in an isolated process for robustness
+
+class CPapaThumbProvider : public IInitializeWithStream,
+                             public IThumbnailProvider
+{
+public:
+    CPapaThumbProvider() : _cRef(1), _pStream(NULL), _options()
+    {
+    }
+
+    virtual ~CPapaThumbProvider()
+    {
+        if (_pStream)
+        {
+            _pStream->Release();
+        }
+    }
+
+    // IUnknown
+    IFACEMETHODIMP QueryInterface(REFIID riid, void **ppv)
+    {
+        static const QITAB qit[] =
+        {
+            QITABENT(CPapaThumbProvider, IInitializeWithStream),
+            QITABENT(CPapaThumbProvider, IThumbnailProvider),
+            { 0 },
+        };
+        return QISearch(this, qit, riid, ppv);
+    }
+
+    IFACEMETHODIMP_(ULONG) AddRef()
+    {
+        return InterlockedIncrement(&_cRef);
+    }
+
+    IFACEMETHODIMP_(ULONG) Release()
+    {
+        ULONG cRef = InterlockedDecrement(&_cRef);
+        if (!cRef)
+        {
+            delete this;
+        }
+        return cRef;
+    }
+
+    // IInitializeWithStream
+    IFACEMETHODIMP Initialize(IStream *pStream, DWORD grfMode);
+
+    // IThumbnailProvider
+    IFACEMETHODIMP GetThumbnail(UINT cx, HBITMAP *phbmp, WTS_ALPHATYPE *pdwAlpha);
+
+    VOID SetOptions(const PAPA_THUMB_OPTIONS* options)
+    {
+        _options = *options;
+    }
+
+private:
+
+    long _cRef;
+    IStream *_pStream;     // provided during initialization.
+    PAPA_THUMB_OPTIONS _options;
+    VOID DecodeTexture(BYTE*, USHORT, USHORT, BYTE, BYTE*);
+    HRESULT RescaleImageBilinear(HBITMAP*, HBITMAP*);
+    HRESULT RescaleImageBicubic(HBITMAP*, HBITMAP*);
+    HRESULT RescaleImageNearestNeighbour(HBITMAP*, HBITMAP*);
+    HRESULT RescaleImageLinear(HBITMAP*, HBITMAP*);
+    template <class Filter> HRESULT RescaleImageStepped(HBITMAP*, HBITMAP*);
+    VOID Blit(HBITMAP*, HBITMAP*, LONG, LONG);
+    VOID SwapBR(HBITMAP*);
+    VOID SwapTopBottom(HBITMAP*);
+    PAPA_IMAGE GetImage(HBITMAP*);
+    HBITMAP CreateBitmapData(BITMAPINFO*, BYTE**, LONG, LONG);
+    HRESULT GetThumbnailBudgeted(UINT, HBITMAP*, WTS_ALPHATYPE*);
+
+};
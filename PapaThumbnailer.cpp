@@ -0,0 +1,536 @@
+// The MIT License
+// 
+// Copyright (c) 2022     Marcus Der      marcusder@hotmail.com
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+// papa-thumbnailer gives .papa textures thumbnails on Linux desktops. With -s it runs as the
+// freedesktop.org thumbnailer file managers call (see papa.thumbnailer), with -c it fills
+// the desktop cache for whole trees ahead of time. Both read and write the shared cache in
+// $XDG_CACHE_HOME/thumbnails themselves, following the Thumbnail Managing Standard: an
+// entry whose Thumb::URI and Thumb::MTime still match the file is reused, anything else is
+// rendered and stored, so every file manager gets hits from whatever rendered first.
+//
+// POSIX only, build with:
+//   g++ -std=c++17 -O2 -pthread -o papa-thumbnailer PapaThumbnailer.cpp PapaFiles.cpp PapaCore.cpp PapaAdaptive.cpp PapaColour.cpp PapaEncoder.cpp PapaScheduler.cpp
+//
+//   papa-thumbnailer -s size input output                  one thumbnail fitting size x size
+//   papa-thumbnailer -c [-s size] [-j threads] paths...    pre-generate the cache, 256 by default
+//
+// The cache is only touched for the standard sizes, 128, 256, 512 and 1024. Install
+// papa.thumbnailer in /usr/share/thumbnailers and papa-mime.xml with xdg-mime so that
+// .papa files have a MIME type for it to hang on.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <atomic>
+#include <string>
+#include <vector>
+#include "PapaCore.h"
+#include "PapaEncoder.h"
+#include "PapaFiles.h"
+
+#define DEFAULT_CACHE_SIZE 256
+#define PNG_LEVEL 2
+#define MIME_TYPE "application/x-papa"
+#define SCRATCH_KEEP_BYTES (64 * 1024 * 1024)
+
+struct CACHE_SIZE
+{
+    const CHAR* directory;
+    LONG size;
+};
+
+static const CACHE_SIZE g_cacheSizes[] = { { "normal", 128 }, { "large", 256 }, { "x-large", 512 }, { "xx-large", 1024 } };
+
+// the file as the standard identifies it
+struct SOURCE_FILE
+{
+    std::string uri;
+    std::string mtime;  // whole seconds, as Thumb::MTime holds it
+    std::string size;
+};
+
+static const CHAR* GetCacheDirectory(LONG size)
+{
+    for (SIZE_T i = 0; i < sizeof(g_cacheSizes) / sizeof(g_cacheSizes[0]); i++) {
+        if (g_cacheSizes[i].size == size) {
+            return g_cacheSizes[i].directory;
+        }
+    }
+    return NULL;
+}
+
+// $XDG_CACHE_HOME/thumbnails, empty if there is nowhere to put it
+static std::string GetCacheRoot()
+{
+    const CHAR* cache = getenv("XDG_CACHE_HOME");
+    if (cache != NULL && cache[0] == '/') {
+        return std::string(cache) + "/thumbnails";
+    }
+    const CHAR* home = getenv("HOME");
+    if (home != NULL && home[0] == '/') {
+        return std::string(home) + "/.cache/thumbnails";
+    }
+    return std::string();
+}
+
+// file:// URI of an absolute path, escaping everything but the characters GLib leaves alone
+// in paths so the hash matches the one file managers compute
+static std::string GetFileUri(const CHAR* path)
+{
+    static const CHAR hex[] = "0123456789ABCDEF";
+    std::string uri = "file://";
+    for (const BYTE* p = (const BYTE*)path; *p; p++) {
+        BYTE c = *p;
+        if ((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || strchr("/-._~!$&'()*+,=:@", c) != NULL) {
+            uri += (CHAR)c;
+        } else {
+            uri += '%';
+            uri += hex[c >> 4];
+            uri += hex[c & 15];
+        }
+    }
+    return uri;
+}
+
+// RFC 1321, only ever used on short URIs
+static std::string GetMd5Hex(const std::string& text)
+{
+    static const ULONG32 k[64] = {
+        0xd76aa478, 0xe8c7b756, 0x242070db, 0xc1bdceee, 0xf57c0faf, 0x4787c62a, 0xa8304613, 0xfd469501,
+        0x698098d8, 0x8b44f7af, 0xffff5bb1, 0x895cd7be, 0x6b901122, 0xfd987193, 0xa679438e, 0x49b40821,
+        0xf61e2562, 0xc040b340, 0x265e5a51, 0xe9b6c7aa, 0xd62f105d, 0x02441453, 0xd8a1e681, 0xe7d3fbc8,
+        0x21e1cde6, 0xc33707d6, 0xf4d50d87, 0x455a14ed, 0xa9e3e905, 0xfcefa3f8, 0x676f02d9, 0x8d2a4c8a,
+        0xfffa3942, 0x8771f681, 0x6d9d6122, 0xfde5380c, 0xa4beea44, 0x4bdecfa9, 0xf6bb4b60, 0xbebfbc70,
+        0x289b7ec6, 0xeaa127fa, 0xd4ef3085, 0x04881d05, 0xd9d4d039, 0xe6db99e5, 0x1fa27cf8, 0xc4ac5665,
+        0xf4292244, 0x432aff97, 0xab9423a7, 0xfc93a039, 0x655b59c3, 0x8f0ccc92, 0xffeff47d, 0x85845dd1,
+        0x6fa87e4f, 0xfe2ce6e0, 0xa3014314, 0x4e0811a1, 0xf7537e82, 0xbd3af235, 0x2ad7d2bb, 0xeb86d391,
+    };
+    static const BYTE shifts[16] = { 7, 12, 17, 22, 5, 9, 14, 20, 4, 11, 16, 23, 6, 10, 15, 21 };
+
+    // pad with a one bit, zeros and the bit length to a multiple of 64 bytes
+    std::vector<BYTE> message(text.begin(), text.end());
+    ULONG64 bits = (ULONG64)text.size() * 8;
+    message.push_back(0x80);
+    while (message.size() % 64 != 56) {
+        message.push_back(0);
+    }
+    for (UINT i = 0; i < 8; i++) {
+        message.push_back((BYTE)(bits >> (8 * i)));
+    }
+
+    ULONG32 state[4] = { 0x67452301, 0xefcdab89, 0x98badcfe, 0x10325476 };
+    for (SIZE_T block = 0; block < message.size(); block += 64) {
+        ULONG32 m[16];
+        for (UINT i = 0; i < 16; i++) {
+            const BYTE* p = &message[block + i * 4];
+            m[i] = (ULONG32)p[0] | ((ULONG32)p[1] << 8) | ((ULONG32)p[2] << 16) | ((ULONG32)p[3] << 24);
+        }
+
+        ULONG32 a = state[0], b = state[1], c = state[2], d = state[3];
+        for (UINT i = 0; i < 64; i++) {
+            ULONG32 f;
+            UINT g;
+            if (i < 16) {
+                f = (b & c) | (~b & d);
+                g = i;
+            } else if (i < 32) {
+                f = (d & b) | (~d & c);
+                g = (5 * i + 1) % 16;
+            } else if (i < 48) {
+                f = b ^ c ^ d;
+                g = (3 * i + 5) % 16;
+            } else {
+                f = c ^ (b | ~d);
+                g = (7 * i) % 16;
+            }
+            ULONG32 rotated = a + f + k[i] + m[g];
+            UINT shift = shifts[(i / 16) * 4 + i % 4];
+            a = d;
+            d = c;
+            c = b;
+            b += (rotated << shift) | (rotated >> (32 - shift));
+        }
+        state[0] += a;
+        state[1] += b;
+        state[2] += c;
+        state[3] += d;
+    }
+
+    static const CHAR hex[] = "0123456789abcdef";
+    std::string digest;
+    for (UINT i = 0; i < 16; i++) {
+        BYTE value = (BYTE)(state[i / 4] >> (8 * (i % 4)));
+        digest += hex[value >> 4];
+        digest += hex[value & 15];
+    }
+    return digest;
+}
+
+static HRESULT GetSourceFile(const CHAR* path, SOURCE_FILE* file)
+{
+    CHAR absolute[PATH_MAX];
+    struct stat info;
+    if (realpath(path, absolute) == NULL || stat(absolute, &info) != 0 || !S_ISREG(info.st_mode)) {
+        return E_INVALIDARG;
+    }
+    file->uri = GetFileUri(absolute);
+    file->mtime = std::to_string((long long)info.st_mtime);
+    file->size = std::to_string((long long)info.st_size);
+    return S_OK;
+}
+
+static ULONG GetBigEndian(const BYTE* p)
+{
+    return ((ULONG)p[0] << 24) | ((ULONG)p[1] << 16) | ((ULONG)p[2] << 8) | p[3];
+}
+
+// TRUE if the PNG at path is a thumbnail of file as it is now. Only the chunk headers and
+// the text chunks are read, the image itself never needs decoding.
+static BOOL IsThumbnailCurrent(const std::string& path, const SOURCE_FILE& file)
+{
+    FILE* png = fopen(path.c_str(), "rb");
+    if (png == NULL) {
+        return FALSE;
+    }
+
+    static const BYTE signature[8] = { 137, 80, 78, 71, 13, 10, 26, 10 };
+    BYTE header[8];
+    BOOL uriMatches = FALSE;
+    BOOL mtimeMatches = FALSE;
+    BOOL sizeMatches = TRUE; // optional, but must agree when present
+
+    if (fread(header, 1, 8, png) == 8 && memcmp(header, signature, 8) == 0) {
+        while (fread(header, 1, 8, png) == 8 && memcmp(header + 4, "IEND", 4) != 0) {
+            ULONG length = GetBigEndian(header);
+            if (memcmp(header + 4, "tEXt", 4) != 0 || length > 4096) {
+                if (fseek(png, (long)length + 4, SEEK_CUR) != 0) {
+                    break;
+                }
+                continue;
+            }
+
+            std::string chunk(length + 4, '\0');
+            if (fread(&chunk[0], 1, length + 4, png) != length + 4) {
+                break;
+            }
+            chunk.resize(length);
+            SIZE_T separator = chunk.find('\0');
+            if (separator == std::string::npos) {
+                continue;
+            }
+            std::string keyword = chunk.substr(0, separator);
+            std::string text = chunk.substr(separator + 1);
+
+            if (keyword == "Thumb::URI") {
+                uriMatches = text == file.uri;
+            } else if (keyword == "Thumb::MTime") {
+                mtimeMatches = text == file.mtime;
+            } else if (keyword == "Thumb::Size") {
+                sizeMatches = text == file.size;
+            }
+        }
+    }
+
+    fclose(png);
+    return uriMatches && mtimeMatches && sizeMatches;
+}
+
+// The thumbnail of the texture at path, fitted inside a size x size box and badged as
+// GetThumbnail would. Downscales go through the streaming decode in linear light, there
+// is no shell here to do the scaling afterwards.
+static HRESULT RenderThumbnail(const CHAR* path, LONG size, PapaScratch* scratch, PAPA_IMAGE* thumbnail, PAPA_TEXTURE_INFO* info)
+{
+    PAPA_SOURCE source;
+    HRESULT result = PapaOpenFileSource(path, &source);
+    if (FAILED(result)) {
+        return result;
+    }
+
+    result = PapaReadTextureInfo(&source, 0, info);
+    if (SUCCEEDED(result) && (info->width == 0 || info->height == 0)) {
+        result = E_INVALIDARG;
+    }
+    if (SUCCEEDED(result)) {
+        // the long side is set to size outright, no cx on the short side rounds to it for every
+        // aspect. cx is still what previews and the downscale are judged against
+        LONG shorter = min(info->width, info->height);
+        LONG longer = max(info->width, info->height);
+        UINT cx = (UINT)max(((LONG64)size * shorter + longer / 2) / longer, (LONG64)1);
+
+        PAPA_THUMB_OPTIONS options = {};
+        options.linearLight = TRUE;
+        options.streaming = TRUE;
+        options.longSide = (UINT)size;
+        result = PapaRenderThumbnail(&source, cx, &options, scratch, thumbnail);
+    }
+    PapaCloseFileSource(&source);
+    return result;
+}
+
+static HRESULT WriteThumbnail(FILE* out, const PAPA_IMAGE* thumbnail, const PAPA_TEXTURE_INFO* info, const SOURCE_FILE& file)
+{
+    std::string width = std::to_string(info->width);
+    std::string height = std::to_string(info->height);
+
+    PapaPngWriter writer;
+    HRESULT result = writer.Begin(PapaWriteToFile, out, (ULONG)thumbnail->width, (ULONG)thumbnail->height, PNG_LEVEL);
+    const CHAR* text[][2] = {
+        { "Thumb::URI", file.uri.c_str() },
+        { "Thumb::MTime", file.mtime.c_str() },
+        { "Thumb::Size", file.size.c_str() },
+        { "Thumb::Mimetype", MIME_TYPE },
+        { "Thumb::Image::Width", width.c_str() },
+        { "Thumb::Image::Height", height.c_str() },
+        { "Software", "papa-thumbnailer" },
+    };
+    for (SIZE_T i = 0; i < sizeof(text) / sizeof(text[0]) && SUCCEEDED(result); i++) {
+        result = writer.WriteText(text[i][0], text[i][1]);
+    }
+
+    // bottom-up, so from the last row
+    for (LONG y = thumbnail->height - 1; y >= 0 && SUCCEEDED(result); y--) {
+        result = writer.WriteRow(thumbnail->pixels + (SIZE_T)y * thumbnail->width * 4);
+    }
+    return SUCCEEDED(result) ? writer.End() : result;
+}
+
+static HRESULT WriteThumbnailFile(const std::string& path, const PAPA_IMAGE* thumbnail, const PAPA_TEXTURE_INFO* info, const SOURCE_FILE& file)
+{
+    FILE* out = fopen(path.c_str(), "wb");
+    if (out == NULL) {
+        return E_ACCESSDENIED;
+    }
+    HRESULT result = WriteThumbnail(out, thumbnail, info, file);
+    if (fclose(out) != 0 && SUCCEEDED(result)) {
+        result = E_FAIL;
+    }
+    return result;
+}
+
+static VOID MakeDirectory(const std::string& path)
+{
+    for (SIZE_T slash = path.find('/', 1); slash != std::string::npos; slash = path.find('/', slash + 1)) {
+        mkdir(path.substr(0, slash).c_str(), 0700);
+    }
+    mkdir(path.c_str(), 0700);
+}
+
+// Writes the cache entry under a temporary name and renames it into place, so a reader
+// never sees half a file. Entries are private to the user as the standard asks.
+static HRESULT StoreThumbnail(const std::string& directory, const std::string& name, const PAPA_IMAGE* thumbnail, const PAPA_TEXTURE_INFO* info, const SOURCE_FILE& file)
+{
+    MakeDirectory(directory);
+
+    std::string temporary = directory + "/" + name + ".XXXXXX";
+    int descriptor = mkstemp(&temporary[0]);
+    if (descriptor < 0) {
+        return E_ACCESSDENIED;
+    }
+    fchmod(descriptor, 0600);
+
+    FILE* out = fdopen(descriptor, "wb");
+    if (out == NULL) {
+        close(descriptor);
+        unlink(temporary.c_str());
+        return E_FAIL;
+    }
+    HRESULT result = WriteThumbnail(out, thumbnail, info, file);
+    if (fclose(out) != 0 && SUCCEEDED(result)) {
+        result = E_FAIL;
+    }
+
+    if (SUCCEEDED(result) && rename(temporary.c_str(), (directory + "/" + name).c_str()) != 0) {
+        result = E_FAIL;
+    }
+    if (FAILED(result)) {
+        unlink(temporary.c_str());
+    }
+    return result;
+}
+
+static HRESULT CopyFile(const std::string& from, const std::string& to)
+{
+    FILE* in = fopen(from.c_str(), "rb");
+    if (in == NULL) {
+        return E_FAIL;
+    }
+    FILE* out = fopen(to.c_str(), "wb");
+    if (out == NULL) {
+        fclose(in);
+        return E_ACCESSDENIED;
+    }
+
+    HRESULT result = S_OK;
+    BYTE buffer[64 * 1024];
+    SIZE_T read;
+    while ((read = fread(buffer, 1, sizeof(buffer), in)) > 0 && SUCCEEDED(result)) {
+        result = fwrite(buffer, 1, read, out) == read ? S_OK : E_FAIL;
+    }
+    if (ferror(in)) {
+        result = E_FAIL;
+    }
+    fclose(in);
+    if (fclose(out) != 0 && SUCCEEDED(result)) {
+        result = E_FAIL;
+    }
+    return result;
+}
+
+// Thumbnails path at size, from the cache when its entry is current. output, if given,
+// receives a copy. S_FALSE when the cache already had it.
+static HRESULT Thumbnail(const CHAR* path, LONG size, const CHAR* output, PapaScratch* scratch)
+{
+    SOURCE_FILE file;
+    HRESULT result = GetSourceFile(path, &file);
+    if (FAILED(result)) {
+        return result;
+    }
+
+    std::string root = GetCacheRoot();
+    const CHAR* directory = GetCacheDirectory(size);
+    std::string cacheDirectory = root.empty() || directory == NULL ? std::string() : root + "/" + directory;
+    std::string name = GetMd5Hex(file.uri) + ".png";
+
+    if (!cacheDirectory.empty() && IsThumbnailCurrent(cacheDirectory + "/" + name, file)) {
+        if (output != NULL) {
+            result = CopyFile(cacheDirectory + "/" + name, output);
+        }
+        return SUCCEEDED(result) ? S_FALSE : result;
+    }
+
+    PAPA_IMAGE thumbnail;
+    PAPA_TEXTURE_INFO info;
+    result = RenderThumbnail(path, size, scratch, &thumbnail, &info);
+    if (FAILED(result)) {
+        return result;
+    }
+
+    if (output != NULL) {
+        result = WriteThumbnailFile(output, &thumbnail, &info, file);
+    }
+    if (SUCCEEDED(result) && !cacheDirectory.empty()) {
+        // the file manager will still get its copy if the cache can't be written
+        HRESULT stored = StoreThumbnail(cacheDirectory, name, &thumbnail, &info, file);
+        if (FAILED(stored) && output == NULL) {
+            result = stored;
+        }
+    }
+    PapaFreeImage(&thumbnail);
+    return result;
+}
+
+struct FILL_JOB
+{
+    const std::vector<std::string>* files;
+    LONG size;
+    std::atomic<UINT> rendered;
+    std::atomic<UINT> current;
+    std::atomic<UINT> failed;
+};
+
+static VOID FillTask(VOID* context, UINT index)
+{
+    FILL_JOB* job = (FILL_JOB*)context;
+    thread_local PapaScratch scratch;
+
+    const CHAR* path = (*job->files)[index].c_str();
+    HRESULT result = Thumbnail(path, job->size, NULL, &scratch);
+    scratch.Trim(SCRATCH_KEEP_BYTES);
+
+    if (FAILED(result)) {
+        fprintf(stderr, "%s: failed (0x%08x)\n", path, (unsigned)result);
+        job->failed++;
+    } else if (result == S_FALSE) {
+        job->current++;
+    } else {
+        job->rendered++;
+    }
+}
+
+int main(int argc, CHAR** argv)
+{
+    LONG size = 0;
+    UINT threads = 0;
+    BOOL fill = FALSE;
+    BOOL usage = FALSE;
+    int opt;
+    while ((opt = getopt(argc, argv, "s:cj:")) != -1) {
+        switch (opt) {
+        case 's':
+            size = atol(optarg);
+            break;
+        case 'c':
+            fill = TRUE;
+            break;
+        case 'j':
+            threads = (UINT)atoi(optarg);
+            break;
+        default:
+            usage = TRUE;
+            break;
+        }
+    }
+
+    if (fill && size == 0) {
+        size = DEFAULT_CACHE_SIZE;
+    }
+    if (usage || size <= 0 || (fill ? optind >= argc || GetCacheDirectory(size) == NULL : argc - optind != 2)) {
+        fprintf(stderr, "usage: papa-thumbnailer -s size input output\n"
+                        "       papa-thumbnailer -c [-s 128|256|512|1024] [-j threads] paths...\n");
+        return 2;
+    }
+
+    if (!fill) {
+        PapaScratch scratch;
+        HRESULT result = Thumbnail(argv[optind], size, argv[optind + 1], &scratch);
+        if (FAILED(result)) {
+            fprintf(stderr, "papa-thumbnailer: %s: failed (0x%08x)\n", argv[optind], (unsigned)result);
+            return 1;
+        }
+        return 0;
+    }
+
+    if (GetCacheRoot().empty()) {
+        fprintf(stderr, "papa-thumbnailer: neither XDG_CACHE_HOME nor HOME is set\n");
+        return 1;
+    }
+
+    std::vector<std::string> files;
+    PapaCollectFiles(argv + optind, argc - optind, &files);
+
+    FILL_JOB job;
+    job.files = &files;
+    job.size = size;
+    job.rendered = 0;
+    job.current = 0;
+    job.failed = 0;
+
+    PapaScheduler scheduler(threads);
+    scheduler.ParallelFor((UINT)files.size(), FillTask, &job);
+
+    fprintf(stderr, "%zu files, %u rendered, %u already current, %u failed\n", files.size(), job.rendered.load(), job.current.load(), job.failed.load());
+    return job.failed > 0 ? 1 : 0;
+}
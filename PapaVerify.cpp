@@ -0,0 +1,653 @@
+// The MIT License
+// 
+// Copyright (c) 2022     Marcus Der      marcusder@hotmail.com
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+// papa-verify runs every fast decode and scale path next to the plain reference it stands in
+// for, over a corpus, and reports how far each strays and how much time it saves. The
+// reference is a serial PapaDecodeTexture of the full texture then a serial bicubic scale to
+// cx, the way GetThumbnail first did it, and PapaBlit for the badge. A path that strays past
+// its bound on any file fails the run, so an aggressive mode can be checked against real
+// textures before it is turned on. Before any of that the PNG and QOI writers are run into
+// a sink that fails part way through, and must stop and hand the failure back.
+//
+// POSIX only, build with:
+//   g++ -std=c++17 -O2 -pthread -o papa-verify PapaVerify.cpp PapaFiles.cpp PapaCore.cpp PapaAdaptive.cpp PapaColour.cpp PapaEncoder.cpp PapaScheduler.cpp
+//
+//   papa-verify [-s sizes] [-r repeats] [-j threads] [-l path=psnr[/error]]... [-n worst]
+//               [-o results.tsv] paths...
+//
+//   -s  comma separated cx values, 32,256 by default
+//   -r  timed runs of each path, the median is its time. 3 by default
+//   -j  also check the scheduled decode and scale against the serial ones, with this many workers
+//   -l  the bound for a path: the lowest PSNR in dB it may reach on any sample and, after a
+//       slash, the largest error in any channel. "inf" for a path that must be exact
+//   -n  how many of the worst samples to list, 10 by default
+//   -o  save every sample, one path on one file at one cx per line
+//
+// Exits 1 when a path broke its bound or a writer mishandled the failing sink, 0 otherwise.
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <algorithm>
+#include <chrono>
+#include <string>
+#include <vector>
+#include "PapaColour.h"
+#include "PapaCore.h"
+#include "PapaEncoder.h"
+#include "PapaFiles.h"
+#include "PapaResample.h"
+#include "PapaScheduler.h"
+
+#define DEFAULT_REPEATS 3
+#define DEFAULT_WORST 10
+#define MAX_SIZES 16
+// thumbnails bigger than this, such as a sliver of a texture scaled up to cx, are skipped
+#define MAX_THUMBNAIL_PIXELS (1 << 24)
+// the image the writers are checked with, noise so it spans many sink blocks
+#define SINK_CHECK_SIZE 512
+#define SINK_CHECK_FAILURES 8
+
+static const UINT g_defaultSizes[] = { 32, 256 };
+
+enum FAST_PATH_ID
+{
+    PATH_DECODE_PARALLEL,
+    PATH_BICUBIC_PARALLEL,
+    PATH_NEAREST,
+    PATH_BILINEAR,
+    PATH_BOX,
+    PATH_LINEAR,
+    PATH_STREAMING,
+    PATH_SUBSAMPLE_2,
+    PATH_SUBSAMPLE_4,
+    PATH_SUBSAMPLE_8,
+    PATH_PREVIEW,
+    PATH_BLEND_LINEAR,
+    PATH_COUNT
+};
+
+struct FAST_PATH
+{
+    const CHAR* name;
+    const CHAR* description;
+    double minPsnr;     // lowest PSNR allowed on any sample, INFINITY for exact
+    LONG maxError;      // largest difference allowed in any channel
+};
+
+// The defaults are what the paths should keep to on ordinary textures: exact where a path
+// only reorders the work, otherwise loose enough for the difference in filter. Noise and
+// single pixel detail fall well under them, since that is exactly what the cheap paths drop.
+static FAST_PATH g_paths[PATH_COUNT] = {
+    { "decode-mt", "PapaDecodeTexture on the scheduler, against serially", INFINITY, 0 },
+    { "bicubic-mt", "bicubic on the scheduler, against serially", INFINITY, 0 },
+    { "nearest", "column table nearest neighbour", 20, 255 },
+    { "bilinear", "Q8 fixed point separable bilinear", 25, 255 },
+    { "box", "integer box filter in gamma space", 25, 255 },
+    { "linear", "area average in linear light, PapaResampleLinear", 25, 255 },
+    { "streaming", "strips decoded straight into the downscale, PapaDecodeScaled", 25, 255 },
+    { "subsample2", "every 2nd block or texel decoded, then box", 25, 255 },
+    { "subsample4", "every 4th block or texel decoded, then box", 22, 255 },
+    { "subsample8", "every 8th block or texel decoded, then box", 20, 255 },
+    { "preview", "the embedded preview scaled to cx", 25, 255 },
+    { "blend-linear", "badge composited in linear light, against PapaBlit", 30, 255 },
+};
+
+// one path on one file at one cx, cx 0 for the decode that doesn't depend on it
+struct SAMPLE
+{
+    std::string path;
+    std::string format;
+    LONG width;
+    LONG height;
+    UINT cx;
+    UINT fast;
+    double psnr;
+    LONG maxError;
+    double referenceMs;
+    double ms;
+};
+
+// an image that owns its pixels
+struct IMAGE
+{
+    std::vector<BYTE> pixels;
+    PAPA_IMAGE view;
+
+    VOID Resize(LONG width, LONG height)
+    {
+        pixels.assign((SIZE_T)width * height * 4, 0);
+        view.pixels = pixels.data();
+        view.width = width;
+        view.height = height;
+    }
+};
+
+static std::string GetFormatName(BYTE format)
+{
+    static const CHAR* names[] = { "?", "RGBA8888", "RGBX8888", "BGRA8888", "DXT1", "DXT3", "DXT5",
+                                   "R32F", "RG32F", "RGBA32F", "R16F", "RG16F", "RGBA16F", "R8" };
+    if (format < sizeof(names) / sizeof(names[0])) {
+        return names[format];
+    }
+    return "format" + std::to_string(format);
+}
+
+static double GetMilliseconds(std::chrono::steady_clock::time_point start)
+{
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+// median time of repeats runs, the result is the last run's
+template <class Run> static HRESULT TimeRuns(UINT repeats, double* ms, Run run)
+{
+    std::vector<double> runs(repeats);
+    HRESULT result = S_OK;
+    for (UINT i = 0; i < repeats; i++) {
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        result = run();
+        runs[i] = GetMilliseconds(start);
+    }
+    std::sort(runs.begin(), runs.end());
+    *ms = runs[repeats / 2];
+    return result;
+}
+
+// PSNR over every channel, alpha included, INFINITY when they are identical
+static VOID Compare(const PAPA_IMAGE* reference, const PAPA_IMAGE* image, double* psnr, LONG* maxError)
+{
+    SIZE_T count = (SIZE_T)reference->width * reference->height * 4;
+    double squares = 0;
+    LONG worst = 0;
+    for (SIZE_T i = 0; i < count; i++) {
+        LONG difference = abs((LONG)reference->pixels[i] - (LONG)image->pixels[i]);
+        squares += (double)difference * difference;
+        worst = max(worst, difference);
+    }
+    double mse = squares / (double)max(count, (SIZE_T)1);
+    *psnr = mse > 0 ? 10.0 * log10(255.0 * 255.0 / mse) : INFINITY;
+    *maxError = worst;
+}
+
+// reads and decodes an entry to BGRA the way PapaLoadTexture does
+static HRESULT DecodeEntry(const PAPA_SOURCE* source, const PAPA_TEXTURE_INFO* info, PapaScheduler* scheduler, std::vector<BYTE>* payload, IMAGE* image)
+{
+    payload->resize((SIZE_T)info->dataSize);
+    if (FAILED(source->read(source->context, info->dataOffset, payload->data(), (ULONG)info->dataSize))) {
+        return E_INVALIDARG;
+    }
+    image->Resize(info->width, info->height);
+    PapaDecodeTexture(payload->data(), info->width, info->height, info->format, image->view.pixels, scheduler);
+    PapaSwapBR(&image->view);
+    return S_OK;
+}
+
+class PapaVerifier
+{
+public:
+    PapaVerifier(UINT repeats, PapaScheduler* scheduler, std::vector<SAMPLE>* samples)
+        : _repeats(repeats), _scheduler(scheduler), _samples(samples)
+    {
+    }
+
+    // FALSE when the file isn't a texture that can be thumbnailed
+    BOOL VerifyFile(const std::string& path, const UINT* sizes, UINT sizeCount);
+
+private:
+    VOID Add(UINT fast, UINT cx, const PAPA_IMAGE* reference, const PAPA_IMAGE* image, double referenceMs, double ms);
+    VOID VerifySize(const PAPA_SOURCE* source, UINT cx, double decodeMs);
+
+    UINT _repeats;
+    PapaScheduler* _scheduler;
+    std::vector<SAMPLE>* _samples;
+    PapaScratch _scratch;
+
+    std::string _path;
+    PAPA_TEXTURE_INFO _info;
+    std::vector<BYTE> _payload;
+    IMAGE _decoded;     // the reference decode
+};
+
+VOID PapaVerifier::Add(UINT fast, UINT cx, const PAPA_IMAGE* reference, const PAPA_IMAGE* image, double referenceMs, double ms)
+{
+    SAMPLE sample;
+    sample.path = _path;
+    sample.format = GetFormatName(_info.format);
+    sample.width = _info.width;
+    sample.height = _info.height;
+    sample.cx = cx;
+    sample.fast = fast;
+    Compare(reference, image, &sample.psnr, &sample.maxError);
+    sample.referenceMs = referenceMs;
+    sample.ms = ms;
+    _samples->push_back(sample);
+}
+
+BOOL PapaVerifier::VerifyFile(const std::string& path, const UINT* sizes, UINT sizeCount)
+{
+    PAPA_SOURCE source;
+    if (FAILED(PapaOpenFileSource(path.c_str(), &source))) {
+        return FALSE;
+    }
+    _path = path;
+
+    HRESULT result = PapaReadTextureInfo(&source, 0, &_info);
+    if (SUCCEEDED(result) && (_info.width == 0 || _info.height == 0 || _info.dataSize < PapaTextureDataSize(_info.format, _info.width, _info.height) || _info.dataSize > 0xFFFFFFFF)) {
+        result = E_INVALIDARG;
+    }
+
+    double decodeMs = 0;
+    if (SUCCEEDED(result)) {
+        result = TimeRuns(_repeats, &decodeMs, [&]() { return DecodeEntry(&source, &_info, NULL, &_payload, &_decoded); });
+    }
+    if (SUCCEEDED(result) && _scheduler != NULL) {
+        IMAGE decoded;
+        double ms;
+        std::vector<BYTE> payload;
+        TimeRuns(_repeats, &ms, [&]() { return DecodeEntry(&source, &_info, _scheduler, &payload, &decoded); });
+        Add(PATH_DECODE_PARALLEL, 0, &_decoded.view, &decoded.view, decodeMs, ms);
+    }
+    if (SUCCEEDED(result)) {
+        for (UINT i = 0; i < sizeCount; i++) {
+            VerifySize(&source, sizes[i], decodeMs);
+        }
+    }
+
+    PapaCloseFileSource(&source);
+    return SUCCEEDED(result);
+}
+
+VOID PapaVerifier::VerifySize(const PAPA_SOURCE* source, UINT cx, double decodeMs)
+{
+    // cx on the short side, as every path hands back
+    FLOAT factor = (FLOAT)cx / (FLOAT)min(_info.width, _info.height);
+    LONG width = max((LONG)roundf(_info.width * factor), 1);
+    LONG height = max((LONG)roundf(_info.height * factor), 1);
+    if ((LONG64)width * height > MAX_THUMBNAIL_PIXELS) {
+        return;
+    }
+
+    IMAGE reference;
+    reference.Resize(width, height);
+    double scaleMs;
+    TimeRuns(_repeats, &scaleMs, [&]() { PapaRescaleBicubic(&_decoded.view, &reference.view, NULL); return S_OK; });
+    double referenceMs = decodeMs + scaleMs;
+
+    IMAGE image;
+    image.Resize(width, height);
+    double ms;
+
+    if (_scheduler != NULL) {
+        TimeRuns(_repeats, &ms, [&]() { PapaRescaleBicubic(&_decoded.view, &image.view, _scheduler); return S_OK; });
+        Add(PATH_BICUBIC_PARALLEL, cx, &reference.view, &image.view, referenceMs, decodeMs + ms);
+    }
+
+    // the filters on the reference decode, timed with it
+    TimeRuns(_repeats, &ms, [&]() { PapaRescaleNearestNeighbour(&_decoded.view, &image.view, NULL); return S_OK; });
+    Add(PATH_NEAREST, cx, &reference.view, &image.view, referenceMs, decodeMs + ms);
+    TimeRuns(_repeats, &ms, [&]() { PapaRescaleBilinear(&_decoded.view, &image.view, NULL); return S_OK; });
+    Add(PATH_BILINEAR, cx, &reference.view, &image.view, referenceMs, decodeMs + ms);
+    if (SUCCEEDED(TimeRuns(_repeats, &ms, [&]() { return PapaResampleParallel<PapaBoxFilter>(&_decoded.view, &image.view, NULL); }))) {
+        Add(PATH_BOX, cx, &reference.view, &image.view, referenceMs, decodeMs + ms);
+    }
+    if (SUCCEEDED(TimeRuns(_repeats, &ms, [&]() { return PapaResampleLinear(_decoded.view.pixels, _decoded.view.width, _decoded.view.height, image.view.pixels, width, height); }))) {
+        Add(PATH_LINEAR, cx, &reference.view, &image.view, referenceMs, decodeMs + ms);
+    }
+
+    // the paths that never decode the whole texture only ever scale down
+    if (factor < 1) {
+        HRESULT result = TimeRuns(_repeats, &ms, [&]() {
+            HRESULT scaled = PapaDecodeScaled(source, &_info, &_scratch, &image.view);
+            PapaSwapBR(&image.view);
+            return scaled;
+        });
+        if (SUCCEEDED(result)) {
+            Add(PATH_STREAMING, cx, &reference.view, &image.view, referenceMs, ms);
+        }
+
+        for (UINT fast = PATH_SUBSAMPLE_2, stride = 2; fast <= PATH_SUBSAMPLE_8; fast++, stride *= 2) {
+            USHORT subWidth;
+            USHORT subHeight;
+            PapaGetSubsampledSize(_info.format, _info.width, _info.height, stride, &subWidth, &subHeight);
+            if (PapaTextureDataSize(_info.format, 1, 1) == 0 || min(subWidth, subHeight) < cx) {
+                break;
+            }
+            IMAGE subsampled;
+            subsampled.Resize(subWidth, subHeight);
+            result = TimeRuns(_repeats, &ms, [&]() {
+                HRESULT decoded = PapaDecodeSubsampled(source, &_info, stride, NULL, &_scratch, subsampled.view.pixels);
+                if (SUCCEEDED(decoded)) {
+                    PapaSwapBR(&subsampled.view);
+                    decoded = PapaResampleParallel<PapaBoxFilter>(&subsampled.view, &image.view, NULL);
+                }
+                return decoded;
+            });
+            if (SUCCEEDED(result)) {
+                Add(fast, cx, &reference.view, &image.view, referenceMs, ms);
+            }
+        }
+    }
+
+    PAPA_TEXTURE_INFO preview;
+    if (PapaReadPreviewInfo(source, &preview) == S_OK && PapaPreviewCovers(&preview, &_info, cx)) {
+        IMAGE decoded;
+        std::vector<BYTE> payload;
+        HRESULT result = TimeRuns(_repeats, &ms, [&]() {
+            HRESULT read = DecodeEntry(source, &preview, NULL, &payload, &decoded);
+            if (SUCCEEDED(read)) {
+                PapaRescaleBicubic(&decoded.view, &image.view, NULL);
+            }
+            return read;
+        });
+        if (SUCCEEDED(result)) {
+            Add(PATH_PREVIEW, cx, &reference.view, &image.view, referenceMs, ms);
+        }
+    }
+
+    // the badge on the reference thumbnail, each composite timed on its own
+    PAPA_IMAGE badge;
+    if (SUCCEEDED(PapaGetBadge(width, height, &_scratch, &badge))) {
+        IMAGE blitted;
+        LONG dx = width - badge.width - 1;
+        double blitMs;
+        TimeRuns(_repeats, &blitMs, [&]() {
+            blitted.pixels = reference.pixels;
+            blitted.view = { blitted.pixels.data(), width, height };
+            PapaBlit(&badge, &blitted.view, dx, 1);
+            return S_OK;
+        });
+        TimeRuns(_repeats, &ms, [&]() {
+            image.pixels = reference.pixels;
+            image.view.pixels = image.pixels.data();
+            PapaBlendLinear(badge.pixels, badge.width, badge.height, image.view.pixels, width, height, dx, 1);
+            return S_OK;
+        });
+        Add(PATH_BLEND_LINEAR, cx, &blitted.view, &image.view, blitMs, ms);
+    }
+}
+
+// a PAPA_WRITE_PROC that takes failAt - 1 blocks and fails every call from then on
+struct FAILING_SINK
+{
+    UINT calls;
+    UINT failAt;
+    UINT lateCalls;     // calls after the first failure, which a writer shouldn't make
+};
+
+static HRESULT WriteUntilFailure(VOID* context, const BYTE*, SIZE_T)
+{
+    FAILING_SINK* sink = (FAILING_SINK*)context;
+    sink->calls++;
+    if (sink->calls > sink->failAt) {
+        sink->lateCalls++;
+    }
+    return sink->calls >= sink->failAt ? E_FAIL : S_OK;
+}
+
+// runs every writer into sinks that fail on each of the first few blocks, and reports the
+// ones that carried on past the failure or didn't return it. the number that did
+static UINT CheckFailingSinks()
+{
+    std::vector<BYTE> pixels((SIZE_T)SINK_CHECK_SIZE * SINK_CHECK_SIZE * 4);
+    ULONG seed = 1;
+    for (BYTE& value : pixels) {
+        seed = seed * 1103515245 + 12345;
+        value = (BYTE)(seed >> 16);
+    }
+
+    const CHAR* names[] = { "png 0", "png 1", "png 2", "png 3", "qoi" };
+    UINT broken = 0;
+    for (UINT writer = 0; writer < sizeof(names) / sizeof(names[0]); writer++) {
+        for (UINT failAt = 1; failAt <= SINK_CHECK_FAILURES; failAt++) {
+            FAILING_SINK sink = { 0, failAt, 0 };
+            HRESULT result = writer < 4
+                ? PapaWritePng(pixels.data(), SINK_CHECK_SIZE, SINK_CHECK_SIZE, SINK_CHECK_SIZE * 4, writer, WriteUntilFailure, &sink)
+                : PapaWriteQoi(pixels.data(), SINK_CHECK_SIZE, SINK_CHECK_SIZE, SINK_CHECK_SIZE * 4, WriteUntilFailure, &sink);
+            if (result != E_FAIL || sink.lateCalls > 0) {
+                printf("failing sink: %s failing on write %u returned %08x after %u more writes\n", names[writer], failAt, (unsigned)result, sink.lateCalls);
+                broken++;
+            }
+        }
+    }
+    return broken;
+}
+
+static BOOL BreaksBound(const SAMPLE& sample)
+{
+    const FAST_PATH& fast = g_paths[sample.fast];
+    return sample.psnr < fast.minPsnr || sample.maxError > fast.maxError;
+}
+
+static VOID PrintReport(const std::vector<SAMPLE>& samples, UINT worst)
+{
+    printf("path           samples  min dB  mean dB  max err  speedup    bound  verdict\n");
+    for (UINT fast = 0; fast < PATH_COUNT; fast++) {
+        std::vector<double> speedups;
+        double lowest = INFINITY;
+        double total = 0;
+        UINT finite = 0;
+        LONG largest = 0;
+        UINT broken = 0;
+        for (const SAMPLE& sample : samples) {
+            if (sample.fast != fast) {
+                continue;
+            }
+            speedups.push_back(sample.referenceMs / max(sample.ms, 1e-6));
+            lowest = min(lowest, sample.psnr);
+            if (isfinite(sample.psnr)) {
+                total += sample.psnr;
+                finite++;
+            }
+            largest = max(largest, sample.maxError);
+            broken += BreaksBound(sample) ? 1 : 0;
+        }
+        if (speedups.empty()) {
+            continue;
+        }
+        std::sort(speedups.begin(), speedups.end());
+
+        CHAR bound[32];
+        if (isinf(g_paths[fast].minPsnr)) {
+            snprintf(bound, sizeof(bound), "exact");
+        } else {
+            snprintf(bound, sizeof(bound), "%.0f/%d", g_paths[fast].minPsnr, g_paths[fast].maxError);
+        }
+        CHAR verdict[32];
+        snprintf(verdict, sizeof(verdict), broken > 0 ? "FAIL %u" : "ok", broken);
+        printf("%-14s %7zu %7.2f %8.2f %8d %7.2fx %8s  %s\n", g_paths[fast].name, speedups.size(), lowest,
+               finite > 0 ? total / finite : INFINITY, largest, speedups[speedups.size() / 2], bound, verdict);
+    }
+    printf("\nspeedup is the median over the samples of reference time / path time, both from the\n"
+           "payload read to a thumbnail of cx, except blend-linear which is timed against PapaBlit\n");
+
+    // the worst samples by how far under its bound each fell
+    std::vector<const SAMPLE*> sorted;
+    for (const SAMPLE& sample : samples) {
+        if (BreaksBound(sample)) {
+            sorted.push_back(&sample);
+        }
+    }
+    std::sort(sorted.begin(), sorted.end(), [](const SAMPLE* a, const SAMPLE* b) {
+        return a->psnr - g_paths[a->fast].minPsnr < b->psnr - g_paths[b->fast].minPsnr;
+    });
+    if (!sorted.empty()) {
+        printf("\nout of bounds:\n");
+    }
+    for (SIZE_T i = 0; i < sorted.size() && i < worst; i++) {
+        const SAMPLE* sample = sorted[i];
+        printf("%-14s %7.2f dB  err %3d  cx %-5u %-9s %5dx%-5d %s\n", g_paths[sample->fast].name, sample->psnr, sample->maxError,
+               sample->cx, sample->format.c_str(), sample->width, sample->height, sample->path.c_str());
+    }
+}
+
+static BOOL WriteSamples(const CHAR* path, const std::vector<SAMPLE>& samples)
+{
+    FILE* file = fopen(path, "w");
+    if (file == NULL) {
+        return FALSE;
+    }
+    fprintf(file, "path\tformat\twidth\theight\tcx\tfast\tpsnr\tmaxerror\treferencems\tms\n");
+    for (const SAMPLE& sample : samples) {
+        fprintf(file, "%s\t%s\t%d\t%d\t%u\t%s\t%.3f\t%d\t%.4f\t%.4f\n", sample.path.c_str(), sample.format.c_str(), sample.width, sample.height,
+                sample.cx, g_paths[sample.fast].name, sample.psnr, sample.maxError, sample.referenceMs, sample.ms);
+    }
+    return fclose(file) == 0;
+}
+
+// "32,96" into sizes, FALSE if it isn't a list of positive numbers
+static BOOL ParseSizes(const CHAR* text, UINT* sizes, UINT* count)
+{
+    *count = 0;
+    while (*text != '\0') {
+        CHAR* end;
+        long size = strtol(text, &end, 10);
+        if (end == text || size <= 0 || size > 0xFFFF || *count == MAX_SIZES || (*end != ',' && *end != '\0')) {
+            return FALSE;
+        }
+        sizes[(*count)++] = (UINT)size;
+        text = *end == ',' ? end + 1 : end;
+    }
+    return *count > 0;
+}
+
+// "bilinear=30" or "bilinear=30/12" into that path's bound
+static BOOL ParseBound(const CHAR* text)
+{
+    const CHAR* equals = strchr(text, '=');
+    if (equals == NULL) {
+        return FALSE;
+    }
+    for (UINT fast = 0; fast < PATH_COUNT; fast++) {
+        if (strlen(g_paths[fast].name) != (SIZE_T)(equals - text) || strncmp(g_paths[fast].name, text, equals - text) != 0) {
+            continue;
+        }
+        CHAR* end;
+        double psnr = strtod(equals + 1, &end);
+        if (end == equals + 1) {
+            return FALSE;
+        }
+        LONG error = isinf(psnr) ? 0 : 255;
+        if (*end == '/') {
+            error = strtol(end + 1, &end, 10);
+        }
+        if (*end != '\0' || error < 0) {
+            return FALSE;
+        }
+        g_paths[fast].minPsnr = psnr;
+        g_paths[fast].maxError = error;
+        return TRUE;
+    }
+    return FALSE;
+}
+
+int main(int argc, CHAR** argv)
+{
+    UINT sizes[MAX_SIZES];
+    UINT sizeCount = sizeof(g_defaultSizes) / sizeof(g_defaultSizes[0]);
+    memcpy(sizes, g_defaultSizes, sizeof(g_defaultSizes));
+    UINT repeats = DEFAULT_REPEATS;
+    UINT worst = DEFAULT_WORST;
+    INT threads = -1;
+    const CHAR* output = NULL;
+    BOOL usage = FALSE;
+    int opt;
+    while ((opt = getopt(argc, argv, "s:r:j:l:n:o:")) != -1) {
+        switch (opt) {
+        case 's':
+            usage |= !ParseSizes(optarg, sizes, &sizeCount);
+            break;
+        case 'r':
+            repeats = (UINT)atoi(optarg);
+            break;
+        case 'j':
+            threads = atoi(optarg);
+            break;
+        case 'l':
+            if (!ParseBound(optarg)) {
+                fprintf(stderr, "papa-verify: bad bound %s\n", optarg);
+                usage = TRUE;
+            }
+            break;
+        case 'n':
+            worst = (UINT)atoi(optarg);
+            break;
+        case 'o':
+            output = optarg;
+            break;
+        default:
+            usage = TRUE;
+            break;
+        }
+    }
+
+    if (usage || repeats == 0 || optind >= argc) {
+        fprintf(stderr, "usage: papa-verify [-s sizes] [-r repeats] [-j threads] [-l path=psnr[/error]]... [-n worst]\n"
+                        "                   [-o results.tsv] paths...\n\npaths:\n");
+        for (UINT fast = 0; fast < PATH_COUNT; fast++) {
+            fprintf(stderr, "  %-14s %s\n", g_paths[fast].name, g_paths[fast].description);
+        }
+        return 2;
+    }
+
+    std::vector<std::string> files;
+    PapaCollectFiles(argv + optind, argc - optind, &files);
+    if (files.empty()) {
+        fprintf(stderr, "papa-verify: no .papa files found\n");
+        return 1;
+    }
+
+    UINT sinkFailures = CheckFailingSinks();
+
+    PapaScheduler* scheduler = threads >= 0 ? new PapaScheduler((UINT)threads) : NULL;
+    std::vector<SAMPLE> samples;
+    UINT skipped = 0;
+    {
+        PapaVerifier verifier(repeats, scheduler, &samples);
+        for (SIZE_T i = 0; i < files.size(); i++) {
+            skipped += verifier.VerifyFile(files[i], sizes, sizeCount) ? 0 : 1;
+            fprintf(stderr, "\r%zu/%zu", i + 1, files.size());
+        }
+        fprintf(stderr, "\n");
+    }
+    delete scheduler;
+
+    PrintReport(samples, worst);
+    if (skipped > 0) {
+        printf("\n%u files couldn't be read as textures and were skipped\n", skipped);
+    }
+
+    if (output != NULL && !WriteSamples(output, samples)) {
+        fprintf(stderr, "papa-verify: can't write %s\n", output);
+        return 1;
+    }
+    if (sinkFailures > 0) {
+        return 1;
+    }
+    for (const SAMPLE& sample : samples) {
+        if (BreaksBound(sample)) {
+            return 1;
+        }
+    }
+    return 0;
+}
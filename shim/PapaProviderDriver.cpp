@@ -0,0 +1,211 @@
+// The MIT License
+// 
+// Copyright (c) 2022     Marcus Der      marcusder@hotmail.com
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+// papa-provider drives the real CPapaThumbProvider the way the shell does (create, hand it a
+// stream, GetThumbnail, free the bitmap) through the stand-ins in PapaWinShim.h, so the
+// production path can be run under perf, valgrind or the sanitizers on Linux.
+//
+// Build from the repository root with:
+//   g++ -std=c++17 -O2 -g -pthread -Wno-unknown-pragmas -Ishim -I. -o papa-provider shim/PapaProviderDriver.cpp shim/PapaWinShim.cpp PapaThumbnailProvider.cpp PapaCore.cpp PapaAdaptive.cpp PapaColour.cpp PapaScheduler.cpp PapaEncoder.cpp PapaFiles.cpp
+//
+//   papa-provider [-s cx] [-r repeats] [-f] [-j threads] [-L] [-S] [-B ms] [-o thumbnail.png] paths...
+//
+//   -s  the size asked for, 256 by default
+//   -r  GetThumbnail calls per file, each on a fresh provider and stream as the shell makes
+//   -f  read through a file backed stream rather than one loaded into memory up front
+//   -j  -L  -S  -B  scheduler, linear light, streaming and latency budget, as PAPA_THUMB_OPTIONS
+//   -o  write the last thumbnail as a PNG, for a single file
+//
+// Each file prints its result, size, alpha type, the mean time per call and a checksum of the
+// pixels, so two builds can be diffed for identical output.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <chrono>
+#include <string>
+#include <vector>
+#include "PapaEncoder.h"
+#include "PapaFiles.h"
+#include "PapaThumbnailProvider.h"
+
+#define DEFAULT_SIZE 256
+#define PNG_LEVEL 1
+
+HRESULT CPapaThumbProvider_CreateInstance(REFIID riid, void **ppv);
+
+struct RUN
+{
+    UINT cx;
+    BOOL fileStream;
+    PAPA_THUMB_OPTIONS options;
+};
+
+// one shell request, the bitmap is the caller's to delete
+static HRESULT GetThumbnail(const CHAR* path, const RUN* run, HBITMAP* bitmap, WTS_ALPHATYPE* alpha)
+{
+    IStream* stream;
+    HRESULT hr = run->fileStream ? PapaCreateFileStream(path, &stream) : PapaCreateMemoryStream(path, &stream);
+    if (FAILED(hr)) {
+        return hr;
+    }
+
+    IInitializeWithStream* initialize;
+    hr = CPapaThumbProvider_CreateInstance(__uuidof(IInitializeWithStream), (void**)&initialize);
+    if (SUCCEEDED(hr)) {
+        static_cast<CPapaThumbProvider*>(initialize)->SetOptions(&run->options);
+        hr = initialize->Initialize(stream, STGM_READ);
+        if (SUCCEEDED(hr)) {
+            IThumbnailProvider* provider;
+            hr = initialize->QueryInterface(&provider);
+            if (SUCCEEDED(hr)) {
+                hr = provider->GetThumbnail(run->cx, bitmap, alpha);
+                provider->Release();
+            }
+        }
+        initialize->Release();
+    }
+    stream->Release();
+    return hr;
+}
+
+// FNV-1a over the section's pixels
+static ULONGLONG GetChecksum(const DIBSECTION* dib)
+{
+    const BYTE* pixels = (const BYTE*)dib->dsBm.bmBits;
+    SIZE_T bytes = (SIZE_T)dib->dsBm.bmWidthBytes * dib->dsBm.bmHeight;
+    ULONGLONG checksum = 1469598103934665603ULL;
+    for (SIZE_T i = 0; i < bytes; i++) {
+        checksum = (checksum ^ pixels[i]) * 1099511628211ULL;
+    }
+    return checksum;
+}
+
+static HRESULT WriteBitmap(const CHAR* path, const DIBSECTION* dib)
+{
+    FILE* file = fopen(path, "wb");
+    if (file == NULL) {
+        return E_ACCESSDENIED;
+    }
+
+    PapaPngWriter writer;
+    HRESULT result = writer.Begin(PapaWriteToFile, file, (ULONG)dib->dsBm.bmWidth, (ULONG)dib->dsBm.bmHeight, PNG_LEVEL);
+    // bottom-up, so from the last row
+    for (LONG y = dib->dsBm.bmHeight - 1; y >= 0 && SUCCEEDED(result); y--) {
+        result = writer.WriteRow((const BYTE*)dib->dsBm.bmBits + (SIZE_T)y * dib->dsBm.bmWidthBytes);
+    }
+    if (SUCCEEDED(result)) {
+        result = writer.End();
+    }
+    if (fclose(file) != 0 && SUCCEEDED(result)) {
+        result = E_FAIL;
+    }
+    return result;
+}
+
+int main(int argc, CHAR** argv)
+{
+    RUN run = {};
+    run.cx = DEFAULT_SIZE;
+    UINT repeats = 1;
+    INT threads = -1;
+    const CHAR* output = NULL;
+    BOOL usage = FALSE;
+    int opt;
+    while ((opt = getopt(argc, argv, "s:r:fj:LSB:o:")) != -1) {
+        switch (opt) {
+        case 's':
+            run.cx = (UINT)atoi(optarg);
+            break;
+        case 'r':
+            repeats = (UINT)atoi(optarg);
+            break;
+        case 'f':
+            run.fileStream = TRUE;
+            break;
+        case 'j':
+            threads = atoi(optarg);
+            break;
+        case 'L':
+            run.options.linearLight = TRUE;
+            break;
+        case 'S':
+            run.options.streaming = TRUE;
+            break;
+        case 'B':
+            run.options.latencyBudget = (FLOAT)atof(optarg);
+            break;
+        case 'o':
+            output = optarg;
+            break;
+        default:
+            usage = TRUE;
+            break;
+        }
+    }
+
+    std::vector<std::string> files;
+    if (!usage && optind < argc) {
+        PapaCollectFiles(argv + optind, argc - optind, &files);
+    }
+    if (usage || run.cx == 0 || repeats == 0 || files.empty() || (output != NULL && files.size() != 1)) {
+        fprintf(stderr, "usage: papa-provider [-s cx] [-r repeats] [-f] [-j threads] [-L] [-S] [-B ms] [-o thumbnail.png] paths...\n");
+        return 2;
+    }
+
+    PapaScheduler* scheduler = threads >= 0 ? new PapaScheduler((UINT)threads) : NULL;
+    run.options.scheduler = scheduler;
+
+    UINT failed = 0;
+    for (const std::string& path : files) {
+        HRESULT hr = S_OK;
+        HBITMAP bitmap = NULL;
+        WTS_ALPHATYPE alpha = WTSAT_UNKNOWN;
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        for (UINT i = 0; i < repeats && SUCCEEDED(hr); i++) {
+            if (bitmap != NULL) {
+                DeleteObject(bitmap);
+                bitmap = NULL;
+            }
+            hr = GetThumbnail(path.c_str(), &run, &bitmap, &alpha);
+        }
+        double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count() / repeats;
+
+        DIBSECTION dib;
+        if (FAILED(hr) || bitmap == NULL || GetObject(bitmap, sizeof(dib), &dib) != sizeof(dib)) {
+            printf("%s hr=%08x\n", path.c_str(), (unsigned)hr);
+            failed++;
+            continue;
+        }
+        printf("%s hr=%08x %dx%d alpha=%d %.3fms %016llx\n", path.c_str(), (unsigned)hr, dib.dsBm.bmWidth, dib.dsBm.bmHeight, (int)alpha, ms,
+               (unsigned long long)GetChecksum(&dib));
+
+        if (output != NULL && FAILED(WriteBitmap(output, &dib))) {
+            fprintf(stderr, "papa-provider: can't write %s\n", output);
+            failed++;
+        }
+        DeleteObject(bitmap);
+    }
+
+    delete scheduler;
+    return failed > 0 ? 1 : 0;
+}
@@ -0,0 +1,313 @@
+// The MIT License
+// 
+// Copyright (c) 2022     Marcus Der      marcusder@hotmail.com
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <mutex>
+#include <new>
+#include <set>
+#include <vector>
+#include "PapaWinShim.h"
+
+constexpr GUID PapaShimIid<IUnknown>::value;
+constexpr GUID PapaShimIid<ISequentialStream>::value;
+constexpr GUID PapaShimIid<IStream>::value;
+constexpr GUID PapaShimIid<IInitializeWithStream>::value;
+constexpr GUID PapaShimIid<IThumbnailProvider>::value;
+
+#define DIB_ALIGNMENT 64
+
+HRESULT QISearch(void* that, const QITAB* pqit, REFIID riid, void** ppv)
+{
+    // IUnknown resolves to the first interface, as in shlwapi
+    for (const QITAB* entry = pqit; entry->piid != NULL; entry++) {
+        if (riid == *entry->piid || riid == __uuidof(IUnknown)) {
+            IUnknown* unknown = (IUnknown*)((BYTE*)that + entry->dwOffset);
+            unknown->AddRef();
+            *ppv = unknown;
+            return S_OK;
+        }
+    }
+    *ppv = NULL;
+    return E_NOINTERFACE;
+}
+
+struct HBITMAP__
+{
+    DIBSECTION dib;
+};
+
+// live sections, so stale and foreign handles fail the way they do with GDI
+static std::set<HBITMAP> g_bitmaps;
+static std::mutex g_bitmapsLock;
+
+HBITMAP CreateDIBSection(HDC, const BITMAPINFO* pbmi, UINT usage, void** ppvBits, HANDLE hSection, DWORD)
+{
+    if (ppvBits != NULL) {
+        *ppvBits = NULL;
+    }
+    const BITMAPINFOHEADER* header = &pbmi->bmiHeader;
+    if (usage != DIB_RGB_COLORS || hSection != NULL || header->biBitCount != 32 || header->biCompression != BI_RGB ||
+        header->biWidth <= 0 || header->biHeight == 0) {
+        return NULL;
+    }
+
+    // 32bpp rows need no padding, and a negative height only flips the row order
+    SIZE_T height = (SIZE_T)(header->biHeight < 0 ? -(LONG64)header->biHeight : header->biHeight);
+    SIZE_T bytes = (SIZE_T)header->biWidth * height * 4;
+    void* bits;
+    if (posix_memalign(&bits, DIB_ALIGNMENT, bytes) != 0) {
+        return NULL;
+    }
+    memset(bits, 0, bytes);
+
+    HBITMAP bitmap = new (std::nothrow) HBITMAP__();
+    if (bitmap == NULL) {
+        free(bits);
+        return NULL;
+    }
+    bitmap->dib.dsBm.bmWidth = header->biWidth;
+    bitmap->dib.dsBm.bmHeight = (LONG)height;
+    bitmap->dib.dsBm.bmWidthBytes = header->biWidth * 4;
+    bitmap->dib.dsBm.bmPlanes = 1;
+    bitmap->dib.dsBm.bmBitsPixel = 32;
+    bitmap->dib.dsBm.bmBits = bits;
+    bitmap->dib.dsBmih = *header;
+    bitmap->dib.dsBmih.biSize = sizeof(BITMAPINFOHEADER);
+    bitmap->dib.dsBmih.biSizeImage = (DWORD)bytes;
+
+    {
+        std::lock_guard<std::mutex> lock(g_bitmapsLock);
+        g_bitmaps.insert(bitmap);
+    }
+    if (ppvBits != NULL) {
+        *ppvBits = bits;
+    }
+    return bitmap;
+}
+
+int GetObject(HGDIOBJ h, int c, LPVOID pv)
+{
+    std::lock_guard<std::mutex> lock(g_bitmapsLock);
+    HBITMAP bitmap = (HBITMAP)h;
+    if (g_bitmaps.count(bitmap) == 0) {
+        return 0;
+    }
+    if (pv == NULL) {
+        return sizeof(DIBSECTION);
+    }
+    // a DIBSECTION buffer gets all of it, a BITMAP one just the BITMAP
+    int size = c >= (int)sizeof(DIBSECTION) ? (int)sizeof(DIBSECTION) : c >= (int)sizeof(BITMAP) ? (int)sizeof(BITMAP) : 0;
+    memcpy(pv, &bitmap->dib, size);
+    return size;
+}
+
+BOOL DeleteObject(HGDIOBJ ho)
+{
+    HBITMAP bitmap = (HBITMAP)ho;
+    {
+        std::lock_guard<std::mutex> lock(g_bitmapsLock);
+        if (g_bitmaps.erase(bitmap) == 0) {
+            return FALSE;
+        }
+    }
+    free(bitmap->dib.dsBm.bmBits);
+    delete bitmap;
+    return TRUE;
+}
+
+// a read-only stream, Seek and reference counting shared by both backings
+class CPapaShimStream : public IStream
+{
+public:
+    CPapaShimStream() : _cRef(1), _position(0), _size(0)
+    {
+    }
+
+    IFACEMETHODIMP QueryInterface(REFIID riid, void** ppv)
+    {
+        if (riid == __uuidof(IUnknown) || riid == __uuidof(ISequentialStream) || riid == __uuidof(IStream)) {
+            AddRef();
+            *ppv = static_cast<IStream*>(this);
+            return S_OK;
+        }
+        *ppv = NULL;
+        return E_NOINTERFACE;
+    }
+
+    IFACEMETHODIMP_(ULONG) AddRef()
+    {
+        return InterlockedIncrement(&_cRef);
+    }
+
+    IFACEMETHODIMP_(ULONG) Release()
+    {
+        ULONG cRef = InterlockedDecrement(&_cRef);
+        if (!cRef) {
+            delete this;
+        }
+        return cRef;
+    }
+
+    IFACEMETHODIMP Write(const void*, ULONG, ULONG* pcbWritten)
+    {
+        if (pcbWritten != NULL) {
+            *pcbWritten = 0;
+        }
+        return STG_E_ACCESSDENIED;
+    }
+
+    IFACEMETHODIMP Seek(LARGE_INTEGER dlibMove, DWORD dwOrigin, ULARGE_INTEGER* plibNewPosition)
+    {
+        LONGLONG base = dwOrigin == STREAM_SEEK_SET ? 0 : dwOrigin == STREAM_SEEK_CUR ? (LONGLONG)_position : dwOrigin == STREAM_SEEK_END ? (LONGLONG)_size : -1;
+        if (base < 0 || base + dlibMove.QuadPart < 0) {
+            return STG_E_INVALIDFUNCTION;
+        }
+        // past the end is allowed, reads from there just come back short
+        _position = (ULONGLONG)(base + dlibMove.QuadPart);
+        if (plibNewPosition != NULL) {
+            plibNewPosition->QuadPart = _position;
+        }
+        return S_OK;
+    }
+
+    // S_FALSE on a short read, as a file stream gives
+    IFACEMETHODIMP Read(void* pv, ULONG cb, ULONG* pcbRead)
+    {
+        ULONG read = 0;
+        if (_position < _size) {
+            read = (ULONG)min((ULONGLONG)cb, _size - _position);
+            if (!ReadAt(_position, pv, read)) {
+                read = 0;
+            }
+        }
+        _position += read;
+        if (pcbRead != NULL) {
+            *pcbRead = read;
+        }
+        return read == cb ? S_OK : S_FALSE;
+    }
+
+protected:
+    virtual ~CPapaShimStream()
+    {
+    }
+
+    virtual BOOL ReadAt(ULONGLONG position, void* buffer, ULONG bytes) = 0;
+
+    long _cRef;
+    ULONGLONG _position;
+    ULONGLONG _size;
+};
+
+class CPapaMemoryStream : public CPapaShimStream
+{
+public:
+    HRESULT Load(const CHAR* path)
+    {
+        FILE* file = fopen(path, "rb");
+        if (file == NULL) {
+            return STG_E_ACCESSDENIED;
+        }
+        BYTE buffer[64 * 1024];
+        SIZE_T read;
+        while ((read = fread(buffer, 1, sizeof(buffer), file)) > 0) {
+            _data.insert(_data.end(), buffer, buffer + read);
+        }
+        BOOL failed = ferror(file);
+        fclose(file);
+        _size = _data.size();
+        return failed ? E_FAIL : S_OK;
+    }
+
+private:
+    BOOL ReadAt(ULONGLONG position, void* buffer, ULONG bytes)
+    {
+        memcpy(buffer, &_data[(SIZE_T)position], bytes);
+        return TRUE;
+    }
+
+    std::vector<BYTE> _data;
+};
+
+class CPapaFileStream : public CPapaShimStream
+{
+public:
+    CPapaFileStream() : _file(NULL)
+    {
+    }
+
+    HRESULT Open(const CHAR* path)
+    {
+        _file = fopen(path, "rb");
+        if (_file == NULL || fseeko(_file, 0, SEEK_END) != 0) {
+            return STG_E_ACCESSDENIED;
+        }
+        _size = (ULONGLONG)ftello(_file);
+        return S_OK;
+    }
+
+private:
+    ~CPapaFileStream()
+    {
+        if (_file != NULL) {
+            fclose(_file);
+        }
+    }
+
+    BOOL ReadAt(ULONGLONG position, void* buffer, ULONG bytes)
+    {
+        return fseeko(_file, (off_t)position, SEEK_SET) == 0 && fread(buffer, 1, bytes, _file) == bytes;
+    }
+
+    FILE* _file;
+};
+
+HRESULT PapaCreateMemoryStream(const CHAR* path, IStream** stream)
+{
+    CPapaMemoryStream* memory = new (std::nothrow) CPapaMemoryStream();
+    if (memory == NULL) {
+        return E_OUTOFMEMORY;
+    }
+    HRESULT hr = memory->Load(path);
+    if (FAILED(hr)) {
+        memory->Release();
+        return hr;
+    }
+    *stream = memory;
+    return S_OK;
+}
+
+HRESULT PapaCreateFileStream(const CHAR* path, IStream** stream)
+{
+    CPapaFileStream* file = new (std::nothrow) CPapaFileStream();
+    if (file == NULL) {
+        return E_OUTOFMEMORY;
+    }
+    HRESULT hr = file->Open(path);
+    if (FAILED(hr)) {
+        file->Release();
+        return hr;
+    }
+    *stream = file;
+    return S_OK;
+}
@@ -0,0 +1,266 @@
+// The MIT License
+// 
+// Copyright (c) 2022     Marcus Der      marcusder@hotmail.com
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#pragma once
+
+// Just enough of COM, IStream and GDI DIB sections for PapaThumbnailProvider.cpp (and
+// PapaBatch.cpp) to compile and run unmodified off-Windows, so the production GetThumbnail
+// path can be profiled under perf or valgrind. Only built with -Ishim on Linux, where the
+// stand-in Windows.h, shlwapi.h and friends in this directory all lead here. None of it is
+// a general Win32 emulation, it covers what the provider calls and nothing else.
+
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+#include "../PapaPlatform.h"
+
+#ifdef _WIN32
+#error the shim headers are for non-Windows builds, drop -Ishim
+#endif
+
+typedef wchar_t WCHAR;
+typedef uintptr_t DWORD_PTR;
+typedef void* HANDLE;
+typedef void* HDC;
+typedef void* HGDIOBJ;
+
+#define STG_E_INVALIDFUNCTION ((HRESULT)0x80030001L)
+#define STG_E_ACCESSDENIED    ((HRESULT)0x80030005L)
+
+// COM
+
+struct GUID
+{
+    uint32_t data1;
+    uint16_t data2;
+    uint16_t data3;
+    uint8_t data4[8];
+};
+
+typedef GUID IID;
+typedef const IID& REFIID;
+
+inline bool operator==(const GUID& a, const GUID& b)
+{
+    return memcmp(&a, &b, sizeof(GUID)) == 0;
+}
+
+// __uuidof through a trait, each interface below specialises it
+template <class T> struct PapaShimIid;
+#define __uuidof(T) (PapaShimIid<T>::value)
+
+#define STDMETHODCALLTYPE
+#define IFACEMETHODIMP HRESULT STDMETHODCALLTYPE
+#define IFACEMETHODIMP_(type) type STDMETHODCALLTYPE
+
+struct IUnknown
+{
+    virtual HRESULT STDMETHODCALLTYPE QueryInterface(REFIID riid, void** ppv) = 0;
+    virtual ULONG STDMETHODCALLTYPE AddRef() = 0;
+    virtual ULONG STDMETHODCALLTYPE Release() = 0;
+
+    // the typed overload from unknwn.h
+    template <class Q> HRESULT QueryInterface(Q** pp)
+    {
+        return QueryInterface(__uuidof(Q), (void**)pp);
+    }
+
+protected:
+    virtual ~IUnknown()
+    {
+    }
+};
+
+struct ISequentialStream : IUnknown
+{
+    virtual HRESULT STDMETHODCALLTYPE Read(void* pv, ULONG cb, ULONG* pcbRead) = 0;
+    virtual HRESULT STDMETHODCALLTYPE Write(const void* pv, ULONG cb, ULONG* pcbWritten) = 0;
+};
+
+union LARGE_INTEGER
+{
+    struct
+    {
+        DWORD LowPart;
+        LONG HighPart;
+    };
+    LONGLONG QuadPart;
+};
+
+union ULARGE_INTEGER
+{
+    struct
+    {
+        DWORD LowPart;
+        DWORD HighPart;
+    };
+    ULONGLONG QuadPart;
+};
+
+enum STREAM_SEEK
+{
+    STREAM_SEEK_SET = 0,
+    STREAM_SEEK_CUR = 1,
+    STREAM_SEEK_END = 2
+};
+
+#define STGM_READ 0x00000000L
+
+// Seek, Read and Write only, the rest of IStream is never called by the provider
+struct IStream : ISequentialStream
+{
+    virtual HRESULT STDMETHODCALLTYPE Seek(LARGE_INTEGER dlibMove, DWORD dwOrigin, ULARGE_INTEGER* plibNewPosition) = 0;
+};
+
+struct HBITMAP__;
+typedef HBITMAP__* HBITMAP;
+
+typedef enum WTS_ALPHATYPE
+{
+    WTSAT_UNKNOWN = 0,
+    WTSAT_RGB = 1,
+    WTSAT_ARGB = 2
+} WTS_ALPHATYPE;
+
+struct IInitializeWithStream : IUnknown
+{
+    virtual HRESULT STDMETHODCALLTYPE Initialize(IStream* pstream, DWORD grfMode) = 0;
+};
+
+struct IThumbnailProvider : IUnknown
+{
+    virtual HRESULT STDMETHODCALLTYPE GetThumbnail(UINT cx, HBITMAP* phbmp, WTS_ALPHATYPE* pdwAlpha) = 0;
+};
+
+template <> struct PapaShimIid<IUnknown>
+{
+    static constexpr GUID value = { 0x00000000, 0x0000, 0x0000, { 0xC0, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x46 } };
+};
+
+template <> struct PapaShimIid<ISequentialStream>
+{
+    static constexpr GUID value = { 0x0c733a30, 0x2a1c, 0x11ce, { 0xad, 0xe5, 0x00, 0xaa, 0x00, 0x44, 0x77, 0x3d } };
+};
+
+template <> struct PapaShimIid<IStream>
+{
+    static constexpr GUID value = { 0x0000000c, 0x0000, 0x0000, { 0xC0, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x46 } };
+};
+
+template <> struct PapaShimIid<IInitializeWithStream>
+{
+    static constexpr GUID value = { 0xb824b49d, 0x22ac, 0x4161, { 0xac, 0x8a, 0x99, 0x16, 0xe8, 0xfa, 0x3f, 0x7f } };
+};
+
+template <> struct PapaShimIid<IThumbnailProvider>
+{
+    static constexpr GUID value = { 0xe357fccd, 0xa995, 0x4576, { 0xb0, 0x1f, 0x23, 0x46, 0x30, 0x15, 0x4e, 0x96 } };
+};
+
+// QISearch from shlwapi.h
+struct QITAB
+{
+    const IID* piid;
+    DWORD dwOffset;
+};
+
+#define OFFSETOFCLASS(base, derived) ((DWORD)(DWORD_PTR)(static_cast<base*>((derived*)8)) - 8)
+#define QITABENT(Cthis, Ifoo) { &__uuidof(Ifoo), OFFSETOFCLASS(Ifoo, Cthis) }
+
+HRESULT QISearch(void* that, const QITAB* pqit, REFIID riid, void** ppv);
+
+inline long InterlockedIncrement(long volatile* addend)
+{
+    return __atomic_add_fetch(addend, 1, __ATOMIC_SEQ_CST);
+}
+
+inline long InterlockedDecrement(long volatile* addend)
+{
+    return __atomic_sub_fetch(addend, 1, __ATOMIC_SEQ_CST);
+}
+
+// GDI
+
+struct BITMAPINFOHEADER
+{
+    DWORD biSize;
+    LONG biWidth;
+    LONG biHeight;
+    WORD biPlanes;
+    WORD biBitCount;
+    DWORD biCompression;
+    DWORD biSizeImage;
+    LONG biXPelsPerMeter;
+    LONG biYPelsPerMeter;
+    DWORD biClrUsed;
+    DWORD biClrImportant;
+};
+
+struct RGBQUAD
+{
+    BYTE rgbBlue;
+    BYTE rgbGreen;
+    BYTE rgbRed;
+    BYTE rgbReserved;
+};
+
+struct BITMAPINFO
+{
+    BITMAPINFOHEADER bmiHeader;
+    RGBQUAD bmiColors[1];
+};
+
+struct BITMAP
+{
+    LONG bmType;
+    LONG bmWidth;
+    LONG bmHeight;
+    LONG bmWidthBytes;
+    WORD bmPlanes;
+    WORD bmBitsPixel;
+    LPVOID bmBits;
+};
+
+struct DIBSECTION
+{
+    BITMAP dsBm;
+    BITMAPINFOHEADER dsBmih;
+    DWORD dsBitfields[3];
+    HANDLE dshSection;
+    DWORD dsOffset;
+};
+
+#define BI_RGB 0
+#define DIB_RGB_COLORS 0
+
+// 32bpp BI_RGB sections only, over 64 byte aligned buffers. GetObject and DeleteObject
+// reject handles that aren't live sections, as GDI does.
+HBITMAP CreateDIBSection(HDC hdc, const BITMAPINFO* pbmi, UINT usage, void** ppvBits, HANDLE hSection, DWORD offset);
+int GetObject(HGDIOBJ h, int c, LPVOID pv);
+BOOL DeleteObject(HGDIOBJ ho);
+
+// streams for driving the provider, with one reference owned by the caller
+
+// reads path into memory, as a shell stream over a local file mostly behaves
+HRESULT PapaCreateMemoryStream(const CHAR* path, IStream** stream);
+// reads from the file on every call, to profile with the I/O in the path
+HRESULT PapaCreateFileStream(const CHAR* path, IStream** stream);
@@ -0,0 +1,3 @@
+// stand-in for the Windows SDK header, see PapaWinShim.h
+#pragma once
+#include "PapaWinShim.h"